@@ -0,0 +1,14 @@
+#pragma once
+
+// Each returns false if a check along the way failed, timings are printed as they're measured
+
+// Unfilters the same scanlines with every filter type, bytes per pixel and SIMD level the CPU supports,
+// checking each level against the scalar output
+bool RunFilterBenchmarks();
+
+// Inflates PNG scanlines split into IDAT sized chunks with the built-in inflater and with zlib, the way the decoder
+// feeds each of them, checking both give the same bytes
+bool RunInflateBenchmarks();
+
+// Copies and moves PixelBuffers and Texture2Ds, checking through PixelBuffer's counters that only the first write to a copy allocates
+bool RunPixelBufferTests();
@@ -0,0 +1,84 @@
+#include "Benchmarks.h"
+
+#include <CPUFeatures.h>
+#include <PNGFilters.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static constexpr size_t ROW_BYTES = 8192;
+static constexpr size_t ROW_COUNT = 128;
+static constexpr int REPEATS = 20;
+
+// Unfilters every row of _filtered into _out, each row's prior being the one unfiltered before it
+static void UnfilterImage(unsigned char _filterType, const std::vector<unsigned char>& _filtered, std::vector<unsigned char>& _out, size_t _bytesPerPixel)
+{
+	for (size_t row = 0; row < ROW_COUNT; row++)
+	{
+		const unsigned char* prior = (row > 0) ? _out.data() + (row - 1) * ROW_BYTES : nullptr;
+		PNGFilters::UnfilterScanline(_filterType, _filtered.data() + row * ROW_BYTES, _out.data() + row * ROW_BYTES, prior, ROW_BYTES, _bytesPerPixel);
+	}
+}
+
+bool RunFilterBenchmarks()
+{
+	static const char* filterNames[PNGFilters::TOTAL_FILTER_TYPES] = { "None", "Sub", "Up", "Average", "Paeth" };
+	static const char* levelNames[] = { "scalar", "SSE2", "AVX2" };
+	static constexpr size_t bytesPerPixel[] = { 1, 2, 3, 4, 6, 8 };
+
+	const SIMDLevel supported = CPUFeatures::GetInstance().GetSIMDLevel();
+	bool passed = true;
+
+	std::mt19937 random(1234);
+	std::vector<unsigned char> filtered(ROW_BYTES * ROW_COUNT), expected(filtered.size()), out(filtered.size());
+	std::generate(filtered.begin(), filtered.end(), [&random]() { return (unsigned char)random(); });
+
+	printf("PNG unfilter, %zu rows of %zu bytes, MB/s\n", ROW_COUNT, ROW_BYTES);
+	printf("%-8s %4s", "filter", "bpp");
+	for (int level = SIMD_SCALAR; level <= supported; level++) printf(" %10s", levelNames[level]);
+	printf("\n");
+
+	for (unsigned char filterType = PNGFilters::SUB; filterType < PNGFilters::TOTAL_FILTER_TYPES; filterType++)
+	{
+		for (size_t bpp : bytesPerPixel)
+		{
+			printf("%-8s %4zu", filterNames[filterType], bpp);
+
+			for (int level = SIMD_SCALAR; level <= supported; level++)
+			{
+				PNGFilters::SetSIMDLevel((SIMDLevel)level);
+
+				// Best of the repeats, the first one warms the caches
+				double best = 1e30;
+				for (int repeat = 0; repeat < REPEATS; repeat++)
+				{
+					auto start = std::chrono::steady_clock::now();
+					UnfilterImage(filterType, filtered, out, bpp);
+					best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				}
+
+				if (level == SIMD_SCALAR)
+				{
+					expected = out;
+				}
+				else if (out != expected)
+				{
+					printf(" %10s", "MISMATCH");
+					passed = false;
+					continue;
+				}
+
+				printf(" %10.0f", (double)filtered.size() / best / 1e6);
+			}
+
+			printf("\n");
+		}
+	}
+
+	PNGFilters::SetSIMDLevel(supported);
+
+	return passed;
+}
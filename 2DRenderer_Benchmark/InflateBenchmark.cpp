@@ -0,0 +1,230 @@
+#include "Benchmarks.h"
+
+#include <Inflater.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <vector>
+#include <zlib.h>
+
+// Images are inflated the way PNG stores them: filtered RGBA scanlines, each with its filter type byte in front,
+// compressed as one zlib stream and split into IDAT chunks of the size libpng writes
+static constexpr unsigned int IMAGE_WIDTH = 2048, IMAGE_HEIGHT = 2048;
+static constexpr size_t ROW_BYTES = IMAGE_WIDTH * 4;
+static constexpr size_t IDAT_CHUNK_BYTES = 8192;
+static constexpr int REPEATS = 10;
+
+static unsigned char Paeth(int _left, int _up, int _upLeft)
+{
+	int estimate = _left + _up - _upLeft;
+	int distLeft = std::abs(estimate - _left), distUp = std::abs(estimate - _up), distUpLeft = std::abs(estimate - _upLeft);
+
+	if (distLeft <= distUp && distLeft <= distUpLeft) return (unsigned char)_left;
+	return (unsigned char)((distUp <= distUpLeft) ? _up : _upLeft);
+}
+
+// Filters every row of _pixels with _filterType, Sub (1) or Paeth (4), into the scanlines an encoder compresses
+static std::vector<unsigned char> FilterImage(const std::vector<unsigned char>& _pixels, unsigned char _filterType)
+{
+	std::vector<unsigned char> scanlines;
+	scanlines.reserve(IMAGE_HEIGHT * (1 + ROW_BYTES));
+
+	for (size_t y = 0; y < IMAGE_HEIGHT; y++)
+	{
+		const unsigned char* row = _pixels.data() + y * ROW_BYTES;
+		const unsigned char* prior = (y > 0) ? row - ROW_BYTES : nullptr;
+
+		scanlines.push_back(_filterType);
+
+		for (size_t x = 0; x < ROW_BYTES; x++)
+		{
+			int left = (x >= 4) ? row[x - 4] : 0, up = prior ? prior[x] : 0, upLeft = (prior && x >= 4) ? prior[x - 4] : 0;
+			unsigned char predicted = (_filterType == 4) ? Paeth(left, up, upLeft) : (unsigned char)left;
+
+			scanlines.push_back((unsigned char)(row[x] - predicted));
+		}
+	}
+
+	return scanlines;
+}
+
+// Smooth gradients with a little noise, Paeth filtered like photographic PNGs usually are
+static std::vector<unsigned char> MakePhotoData(std::mt19937& _random)
+{
+	std::vector<unsigned char> pixels(IMAGE_HEIGHT * ROW_BYTES);
+
+	for (size_t y = 0; y < IMAGE_HEIGHT; y++)
+	{
+		for (size_t x = 0; x < IMAGE_WIDTH; x++)
+		{
+			unsigned char* pixel = pixels.data() + y * ROW_BYTES + x * 4;
+			pixel[0] = (unsigned char)(x / 8 + _random() % 6);
+			pixel[1] = (unsigned char)(y / 8 + _random() % 6);
+			pixel[2] = (unsigned char)((x + y) / 16 + _random() % 6);
+			pixel[3] = 255;
+		}
+	}
+
+	return FilterImage(pixels, 4);
+}
+
+// Flat coloured rectangles, Sub filtered, like UI art
+static std::vector<unsigned char> MakeFlatData(std::mt19937& _random)
+{
+	std::vector<unsigned char> pixels(IMAGE_HEIGHT * ROW_BYTES);
+
+	for (int rect = 0; rect < 400; rect++)
+	{
+		const unsigned int left = _random() % IMAGE_WIDTH, top = _random() % IMAGE_HEIGHT;
+		const unsigned int right = std::min<unsigned int>(IMAGE_WIDTH, left + 16 + _random() % 512);
+		const unsigned int bottom = std::min<unsigned int>(IMAGE_HEIGHT, top + 16 + _random() % 512);
+		const unsigned int colour = (unsigned int)_random() | 0xff000000u;
+
+		for (unsigned int y = top; y < bottom; y++)
+		{
+			for (unsigned int x = left; x < right; x++)
+			{
+				memcpy(pixels.data() + y * ROW_BYTES + x * 4, &colour, 4);
+			}
+		}
+	}
+
+	return FilterImage(pixels, 1);
+}
+
+// Noise, mostly stored blocks
+static std::vector<unsigned char> MakeNoiseData(std::mt19937& _random)
+{
+	std::vector<unsigned char> pixels(IMAGE_HEIGHT * ROW_BYTES);
+	std::generate(pixels.begin(), pixels.end(), [&_random]() { return (unsigned char)_random(); });
+
+	return FilterImage(pixels, 1);
+}
+
+// The decoder's zlib path, which inflates each IDAT chunk as it's read
+static bool InflateWithZlib(z_stream& _stream, const std::vector<unsigned char>& _in, std::vector<unsigned char>& _out)
+{
+	if (inflateReset(&_stream) != Z_OK)
+		return false;
+
+	_stream.next_out = _out.data();
+	_stream.avail_out = (uInt)_out.size();
+
+	int result = Z_OK;
+
+	for (size_t offset = 0; offset < _in.size() && result == Z_OK; offset += IDAT_CHUNK_BYTES)
+	{
+		_stream.next_in = (Bytef*)_in.data() + offset;
+		_stream.avail_in = (uInt)std::min(IDAT_CHUNK_BYTES, _in.size() - offset);
+
+		result = inflate(&_stream, Z_NO_FLUSH);
+	}
+
+	return result == Z_STREAM_END && _stream.total_out == _out.size();
+}
+
+template <typename FUNCTION>
+static double BestSeconds(FUNCTION _function)
+{
+	double best = 1e30;
+
+	for (int repeat = 0; repeat < REPEATS; repeat++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		_function();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	return best;
+}
+
+bool RunInflateBenchmarks()
+{
+	struct Source
+	{
+		const char* name;
+		std::vector<unsigned char> (*make)(std::mt19937&);
+	};
+
+	static const Source sources[] = { { "photo", MakePhotoData }, { "flat", MakeFlatData }, { "noise", MakeNoiseData } };
+	static constexpr int levels[] = { 1, 6, 9 };
+
+	bool passed = true;
+	std::mt19937 random(1234);
+
+	z_stream stream = {};
+
+	if (inflateInit(&stream) != Z_OK)
+	{
+		printf("inflateInit failed\n");
+		return false;
+	}
+
+	printf("\nInflate, %ux%u RGBA8 PNG scanlines in %zu byte IDAT chunks, MB/s of output\n", IMAGE_WIDTH, IMAGE_HEIGHT, IDAT_CHUNK_BYTES);
+	printf("%-12s %5s %8s %10s %10s %8s\n", "data", "level", "ratio", "Inflater", "zlib", "speedup");
+
+	for (const Source& source : sources)
+	{
+		const std::vector<unsigned char> data = source.make(random);
+
+		for (int level : levels)
+		{
+			uLongf compressedSize = compressBound((uLong)data.size());
+			std::vector<unsigned char> compressed(compressedSize);
+
+			if (compress2(compressed.data(), &compressedSize, data.data(), (uLong)data.size(), level) != Z_OK)
+			{
+				printf("%-12s %5d compress2 failed\n", source.name, level);
+				passed = false;
+				continue;
+			}
+
+			compressed.resize(compressedSize);
+
+			// Chunks the decoder hands the inflater as views of the mapped file
+			std::vector<InflateSpan> chunks;
+
+			for (size_t offset = 0; offset < compressed.size(); offset += IDAT_CHUNK_BYTES)
+			{
+				chunks.push_back({ compressed.data() + offset, std::min(IDAT_CHUNK_BYTES, compressed.size() - offset) });
+			}
+
+			std::vector<unsigned char> inflaterOut(data.size()), zlibOut(data.size());
+			bool inflaterOK = true, zlibOK = true;
+
+			const double inflaterSeconds = BestSeconds([&]()
+			{
+				try
+				{
+					inflaterOK &= (Inflater::InflateZlib(chunks.data(), chunks.size(), inflaterOut.data(), inflaterOut.size()) == data.size());
+				}
+				catch (const std::exception&)
+				{
+					inflaterOK = false;
+				}
+			});
+
+			const double zlibSeconds = BestSeconds([&]() { zlibOK &= InflateWithZlib(stream, compressed, zlibOut); });
+
+			printf("%-12s %5d %8.2f", source.name, level, (double)data.size() / compressed.size());
+
+			if (!inflaterOK || !zlibOK || inflaterOut != data || zlibOut != data)
+			{
+				printf(" %10s\n", "MISMATCH");
+				passed = false;
+				continue;
+			}
+
+			printf(" %10.0f %10.0f %7.2fx\n", data.size() / inflaterSeconds / 1e6, data.size() / zlibSeconds / 1e6, zlibSeconds / inflaterSeconds);
+		}
+	}
+
+	inflateEnd(&stream);
+
+	return passed;
+}
@@ -0,0 +1,168 @@
+#include "Benchmarks.h"
+
+#include <PixelBuffer.h>
+#include <Texture2D.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+static constexpr size_t PIXEL_BYTES = 256 * 256 * 4;
+
+// Every operator new this binary makes, counted by the replacements below. A DLL build of the library
+// allocates through its own operator new, so its storage is checked with PixelBuffer's counters as well
+static std::atomic<size_t> gNewCalls = { 0 }, gNewBytes = { 0 };
+
+void* operator new(size_t _size)
+{
+	gNewCalls++;
+	gNewBytes += _size;
+
+	if (void* memory = std::malloc(_size ? _size : 1))
+		return memory;
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t _size)											{ return operator new(_size); }
+
+void* operator new(size_t _size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(_size);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t _size, const std::nothrow_t& _nothrow) noexcept	{ return operator new(_size, _nothrow); }
+
+void operator delete(void* _memory) noexcept									{ std::free(_memory); }
+void operator delete[](void* _memory) noexcept									{ std::free(_memory); }
+void operator delete(void* _memory, size_t) noexcept							{ std::free(_memory); }
+void operator delete[](void* _memory, size_t) noexcept							{ std::free(_memory); }
+void operator delete(void* _memory, const std::nothrow_t&) noexcept			{ std::free(_memory); }
+void operator delete[](void* _memory, const std::nothrow_t&) noexcept			{ std::free(_memory); }
+
+// What the allocation counters report right now, compared before and after each step
+struct AllocationSnapshot
+{
+	size_t newCalls = gNewCalls;
+	size_t newBytes = gNewBytes;
+	size_t bytes = PixelBuffer::GetBytesHeld();
+	unsigned int storages = PixelBuffer::GetStorageCount();
+};
+
+static bool Check(bool _condition, const char* _name)
+{
+	printf("%-48s %s\n", _name, _condition ? "ok" : "FAILED");
+	return _condition;
+}
+
+// Nothing allocated since _before, and no pixel storage created or freed
+static bool Unchanged(const AllocationSnapshot& _before, const char* _name)
+{
+	const AllocationSnapshot after;
+	return Check(after.newCalls == _before.newCalls && after.newBytes == _before.newBytes &&
+		after.bytes == _before.bytes && after.storages == _before.storages, _name);
+}
+
+static Texture2D PassThrough(Texture2D _tex)
+{
+	return _tex;
+}
+
+static bool TestPixelBuffer()
+{
+	bool passed = true;
+
+	PixelBuffer original;
+	original.assign(PIXEL_BYTES, 7);
+
+	// Containers get their memory up front, so only the buffers themselves are counted
+	std::vector<PixelBuffer> copies;
+	copies.reserve(16);
+
+	const AllocationSnapshot beforeCopies;
+
+	copies.assign(16, original);
+	PixelBuffer moved = std::move(copies.back());
+	copies.pop_back();
+	PixelBuffer assigned;
+	assigned = moved;
+
+	passed &= Unchanged(beforeCopies, "PixelBuffer copies and moves allocate nothing");
+	passed &= Check(copies[3].data() == original.data() && assigned.data() == original.data(), "PixelBuffer copies share the bytes");
+
+	const AllocationSnapshot beforeWrite;
+	copies[0].GetWritableData()[0] = 9;
+	const AllocationSnapshot afterWrite;
+
+	passed &= Check(afterWrite.storages == beforeWrite.storages + 1 && afterWrite.bytes >= beforeWrite.bytes + PIXEL_BYTES,
+		"PixelBuffer first write detaches one copy");
+	passed &= Check(copies[0][0] == 9 && original[0] == 7 && copies[1][0] == 7, "PixelBuffer write leaves the other copies alone");
+
+	copies[0].GetWritableData()[1] = 9;
+	passed &= Unchanged(afterWrite, "PixelBuffer second write allocates nothing");
+
+	return passed;
+}
+
+static bool TestTexture2D()
+{
+	bool passed = true;
+
+	// No file behind it, only the pixels matter here
+	Texture2D original;
+	original.mPNGProps.pixels.assign(PIXEL_BYTES, 7);
+
+	std::vector<Texture2D> textures;
+	textures.reserve(32);
+
+	const AllocationSnapshot beforeCopies;
+
+	for (int i = 0; i < 16; i++)
+	{
+		textures.push_back(original);
+		textures.push_back(PassThrough(original));
+	}
+
+	Texture2D moved = std::move(textures.back());
+	textures.pop_back();
+	Texture2D assigned;
+	assigned = moved;
+	assigned = std::move(moved);
+
+	passed &= Unchanged(beforeCopies, "Texture2D copies and moves allocate nothing");
+	passed &= Check(textures[5].mPNGProps.pixels.data() == original.mPNGProps.pixels.data(), "Texture2D copies share the pixels");
+
+	const AllocationSnapshot beforeWrite;
+	textures[0].mPNGProps.pixels.GetWritableData()[0] = 9;
+	const AllocationSnapshot afterWrite;
+
+	passed &= Check(afterWrite.storages == beforeWrite.storages + 1 && afterWrite.bytes >= beforeWrite.bytes + PIXEL_BYTES,
+		"Texture2D first write detaches one copy");
+
+	textures[0].mPNGProps.pixels.GetWritableData()[1] = 9;
+	passed &= Unchanged(afterWrite, "Texture2D second write allocates nothing");
+
+	return passed;
+}
+
+bool RunPixelBufferTests()
+{
+	printf("\nPixel storage sharing\n");
+
+	bool passed = true;
+
+	passed &= TestPixelBuffer();
+	passed &= TestTexture2D();
+
+	return passed;
+}
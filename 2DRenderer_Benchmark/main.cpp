@@ -0,0 +1,16 @@
+#include "Benchmarks.h"
+
+#include <iostream>
+
+int main()
+{
+	bool passed = true;
+
+	passed &= RunFilterBenchmarks();
+	passed &= RunInflateBenchmarks();
+	passed &= RunPixelBufferTests();
+
+	std::cout << (passed ? "All checks passed." : "!! Some checks failed !!") << std::endl;
+
+	return passed ? 0 : 1;
+}
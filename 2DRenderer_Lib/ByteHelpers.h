@@ -1,10 +1,13 @@
 #pragma once
 #include "DLLCommon.h"
 
+#include <cstdint>
+#include <cstring>
+
 class RENDERER_API R2D_BH
 {
 public:
-	static unsigned int CharArrToUInt(char* _arr, unsigned int _len)
+	static unsigned int CharArrToUInt(const char* _arr, unsigned int _len)
 	{
 		unsigned int out = 0;
 
@@ -28,22 +31,16 @@ public:
 		return true;
 	}
 
+	// Reads up to 4 big-endian bytes from the stream into an unsigned int.
 	static unsigned int ReadBytesIntoUInt(std::ifstream& _reader, unsigned int _byteCount)
 	{
-		char* num = new char[_byteCount];
+		char num[4] = {};
+		_byteCount = (_byteCount > 4) ? 4 : _byteCount;
 		_reader.read(num, _byteCount);
 
 		return CharArrToUInt(num, _byteCount);
 	}
 
-	static char* ReadBytesIntoStr(std::ifstream& _reader, unsigned int _byteCount)
-	{
-		char* str = new char[_byteCount];
-		_reader.read(str, _byteCount);
-
-		return str;
-	}
-
 	static bool IsLittleEndian()
 	{
 		unsigned int x = 1;
@@ -64,4 +61,33 @@ public:
 		
 		return _value;
 	}
+
+	// 64 bit hash, 8 bytes a step. Not cryptographic, only meant to tell different files apart. Never returns 0
+	static unsigned long long HashBytes(const unsigned char* _data, size_t _size, std::uint64_t _seed = 0)
+	{
+		constexpr std::uint64_t PRIME = 0x9E3779B97F4A7C15ull;
+
+		std::uint64_t hash = _seed ^ (_size * PRIME);
+
+		for (; _size >= 8; _size -= 8, _data += 8)
+		{
+			std::uint64_t word;
+			memcpy(&word, _data, 8);
+
+			hash ^= word * PRIME;
+			hash = ((hash << 31) | (hash >> 33)) * PRIME;
+		}
+
+		for (; _size > 0; _size--, _data++)
+		{
+			hash = (hash ^ *_data) * PRIME;
+		}
+
+		hash ^= hash >> 29;
+		hash *= 0xBF58476D1CE4E5B9ull;
+		hash ^= hash >> 32;
+
+		// 0 is left free to mean "not hashed"
+		return (hash != 0) ? hash : 1;
+	}
 };
\ No newline at end of file
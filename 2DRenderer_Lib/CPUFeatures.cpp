@@ -0,0 +1,71 @@
+#include "CPUFeatures.h"
+
+#if defined(R2D_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(R2D_X86)
+static void QueryCPUID(unsigned int _leaf, unsigned int _subLeaf, unsigned int _registers[4])
+{
+#if defined(_MSC_VER)
+	int registers[4] = {};
+	__cpuidex(registers, (int)_leaf, (int)_subLeaf);
+
+	for (unsigned int i = 0; i < 4; i++) _registers[i] = (unsigned int)registers[i];
+#else
+	__cpuid_count(_leaf, _subLeaf, _registers[0], _registers[1], _registers[2], _registers[3]);
+#endif
+}
+
+// Whether the OS saves the YMM registers on context switches, required before using AVX
+static bool OSSupportsAVX()
+{
+#if defined(_MSC_VER)
+	return (_xgetbv(0) & 0x6) == 0x6;
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (eax & 0x6) == 0x6;
+#endif
+}
+#endif
+
+CPUFeatures::CPUFeatures()
+{
+	sse2 = false;
+	ssse3 = false;
+	sse41 = false;
+	pclmul = false;
+	avx2 = false;
+
+#if defined(R2D_X86)
+	unsigned int registers[4] = {}; // eax, ebx, ecx, edx
+
+	QueryCPUID(0, 0, registers);
+	unsigned int maxLeaf = registers[0];
+
+	if (maxLeaf >= 1)
+	{
+		QueryCPUID(1, 0, registers);
+
+		sse2	= (registers[3] & (1u << 26)) != 0;
+		ssse3	= (registers[2] & (1u << 9)) != 0;
+		sse41	= (registers[2] & (1u << 19)) != 0;
+		pclmul	= (registers[2] & (1u << 1)) != 0;
+
+		bool osxsave = (registers[2] & (1u << 27)) != 0;
+		bool avx = (registers[2] & (1u << 28)) != 0;
+
+		if (maxLeaf >= 7 && osxsave && avx && OSSupportsAVX())
+		{
+			QueryCPUID(7, 0, registers);
+
+			avx2 = (registers[1] & (1u << 5)) != 0;
+		}
+	}
+#endif
+}
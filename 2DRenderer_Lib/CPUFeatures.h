@@ -0,0 +1,45 @@
+#pragma once
+#include "DLLCommon.h"
+
+// Highest instruction set a SIMD code path may use, in increasing order.
+enum RENDERER_API SIMDLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2
+};
+
+// Instruction set extensions supported by the CPU we're running on, queried once.
+class RENDERER_API CPUFeatures
+{
+protected:
+	CPUFeatures();
+
+public:
+	static const CPUFeatures& GetInstance()
+	{
+		static CPUFeatures instance = CPUFeatures();
+		return instance;
+	}
+
+	const SIMDLevel GetSIMDLevel() const
+	{
+		if (avx2) return SIMD_AVX2;
+		if (sse2) return SIMD_SSE2;
+		return SIMD_SCALAR;
+	}
+
+public:
+	bool sse2, ssse3, sse41, pclmul, avx2;
+};
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define R2D_X86 1
+#endif
+
+// MSVC allows any intrinsic in any function, GCC/Clang need the target enabled per function
+#if defined(R2D_X86) && (defined(__GNUC__) || defined(__clang__))
+#define R2D_TARGET(_isa) __attribute__((target(_isa)))
+#else
+#define R2D_TARGET(_isa)
+#endif
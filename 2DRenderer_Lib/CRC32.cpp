@@ -0,0 +1,187 @@
+#include "CRC32.h"
+#include "CPUFeatures.h"
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(R2D_X86)
+#include <immintrin.h>
+#endif
+
+static constexpr uint32_t POLYNOMIAL = 0xEDB88320u;
+
+// Shortest run worth setting up the folding for, it consumes 64 bytes before its first fold
+static constexpr size_t FOLD_MIN_BYTES = 64;
+
+static std::atomic<int> gHardwareEnabled = { -1 }; // -1 until first use
+
+// tables[0] is the classic byte at a time table, tables[k] advances a byte through k more zero bytes
+struct SliceTables
+{
+	uint32_t tables[8][256];
+
+	SliceTables()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+			}
+
+			tables[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			for (int k = 1; k < 8; k++)
+			{
+				tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+			}
+		}
+	}
+
+	static const SliceTables& Get()
+	{
+		static SliceTables instance = SliceTables();
+		return instance;
+	}
+};
+
+// Works on the inverted register, as does the folding kernel below
+static uint32_t UpdateTables(uint32_t _crc, const unsigned char* _data, size_t _size)
+{
+	const SliceTables& slice = SliceTables::Get();
+	const uint32_t (*t)[256] = slice.tables;
+
+	for (; _size >= 8; _size -= 8, _data += 8)
+	{
+		uint32_t low = ((uint32_t)_data[0] | ((uint32_t)_data[1] << 8) | ((uint32_t)_data[2] << 16) | ((uint32_t)_data[3] << 24)) ^ _crc;
+
+		_crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+			t[3][_data[4]] ^ t[2][_data[5]] ^ t[1][_data[6]] ^ t[0][_data[7]];
+	}
+
+	for (; _size > 0; _size--, _data++)
+	{
+		_crc = (_crc >> 8) ^ t[0][(_crc ^ *_data) & 0xff];
+	}
+
+	return _crc;
+}
+
+#if defined(R2D_X86)
+// Folds 4 x 128 bits at a time with carry-less multiplies, then reduces to 32 bits with a Barrett reduction
+// (Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction").
+// _size must be at least FOLD_MIN_BYTES and a multiple of 16.
+R2D_TARGET("pclmul,sse4.1") static uint32_t UpdateFolding(uint32_t _crc, const unsigned char* _data, size_t _size)
+{
+	// x^(4*128+32) mod P and x^(4*128-32) mod P, then the same for a 128 bit fold, bit reflected
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124ll);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll); // P' (Barrett constant) and P
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(_data + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(_data + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(_data + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(_data + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)_crc));
+
+	_data += 64;
+	_size -= 64;
+
+	// Four independent folds per step keep the multiplier busy
+	for (; _size >= 64; _size -= 64, _data += 64)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(_data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(_data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(_data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(_data + 0x30)));
+	}
+
+	// Fold the four lanes into one, then any 16 byte blocks left
+	__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+	for (; _size >= 16; _size -= 16, _data += 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_loadu_si128((const __m128i*)_data)), x5);
+	}
+
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), x2);
+
+	// Barrett reduction down to 32
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+unsigned int CRC32::Compute(const unsigned char* _data, size_t _size, unsigned int _crc)
+{
+	uint32_t crc = ~(uint32_t)_crc;
+
+#if defined(R2D_X86)
+	if (_size >= FOLD_MIN_BYTES && IsHardwareEnabled())
+	{
+		size_t folded = _size & ~(size_t)15;
+
+		crc = UpdateFolding(crc, _data, folded);
+		_data += folded;
+		_size -= folded;
+	}
+#endif
+
+	return ~UpdateTables(crc, _data, _size);
+}
+
+void CRC32::SetHardwareEnabled(bool _enabled)
+{
+	const CPUFeatures& cpu = CPUFeatures::GetInstance();
+
+	gHardwareEnabled = (_enabled && cpu.pclmul && cpu.sse41) ? 1 : 0;
+}
+
+bool CRC32::IsHardwareEnabled()
+{
+	int enabled = gHardwareEnabled;
+
+	if (enabled < 0)
+	{
+		const CPUFeatures& cpu = CPUFeatures::GetInstance();
+
+		enabled = (cpu.pclmul && cpu.sse41) ? 1 : 0;
+		gHardwareEnabled = enabled;
+	}
+
+	return enabled != 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "DLLCommon.h"
+
+#include <cstddef>
+
+// CRC-32 as used by PNG chunks and zlib (reflected polynomial 0xEDB88320).
+// Long runs are folded with PCLMULQDQ when the CPU has it, everything else goes through slice-by-8 tables.
+class RENDERER_API CRC32
+{
+public:
+	// Running checksum, pass the previous result as _crc to continue it over more data.
+	static unsigned int Compute(const unsigned char* _data, size_t _size, unsigned int _crc = 0);
+
+	// Forces the table path, mainly for benchmarking against the carry-less multiply one.
+	static void SetHardwareEnabled(bool _enabled);
+	static bool IsHardwareEnabled();
+};
@@ -0,0 +1,923 @@
+#include "Inflater.h"
+#include "CPUFeatures.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(R2D_X86)
+#include <immintrin.h>
+#endif
+
+// Root table sizes, longer codes continue into subtables
+static constexpr unsigned int LITLEN_TABLE_BITS = 11, DIST_TABLE_BITS = 8, PRECODE_TABLE_BITS = 7;
+
+// Worst case size of each table, the root plus a subtable of up to 2^(15 - root bits) entries per long code
+static constexpr unsigned int LITLEN_TABLE_SIZE = (1u << LITLEN_TABLE_BITS) + 288 * (1u << (15 - LITLEN_TABLE_BITS));
+static constexpr unsigned int DIST_TABLE_SIZE = (1u << DIST_TABLE_BITS) + 32 * (1u << (15 - DIST_TABLE_BITS));
+
+// Bytes of output the LZ77 window can reach back into
+static constexpr size_t WINDOW_SIZE = 32768;
+
+// Output written between progress callbacks
+static constexpr size_t PROGRESS_INTERVAL = 1u << 18;
+
+// Room the fast loop needs past the output pointer, the longest match plus its copy overrun
+static constexpr size_t FAST_OUTPUT_SLACK = 258 + 16;
+
+// Huffman table entry, from the low bits up: code length (5), kind (3), extra bits or subtable bits (5), value (16)
+enum EntryKind
+{
+	INVALID,
+	LITERAL,
+	DOUBLE_LITERAL,	// two literals, low byte first
+	MATCH,			// length or distance base, plus extra bits
+	END_OF_BLOCK,
+	SUBTABLE		// value is the subtable offset, extra bits its index width
+};
+
+static inline unsigned int MakeEntry(unsigned int _kind, unsigned int _extra, unsigned int _value)
+{
+	return (_kind << 5) | (_extra << 8) | (_value << 16);
+}
+
+static inline unsigned int EntryLength(unsigned int _entry)	{ return _entry & 0x1f; }
+static inline unsigned int EntryKind(unsigned int _entry)	{ return (_entry >> 5) & 0x7; }
+static inline unsigned int EntryExtra(unsigned int _entry)	{ return (_entry >> 8) & 0x1f; }
+static inline unsigned int EntryValue(unsigned int _entry)	{ return _entry >> 16; }
+
+static constexpr unsigned short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr unsigned char LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+static constexpr unsigned short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order the code length code lengths are stored in
+static constexpr unsigned char PRECODE_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static unsigned int LitLenEntry(unsigned int _symbol)
+{
+	if (_symbol < 256)	return MakeEntry(LITERAL, 0, _symbol);
+	if (_symbol == 256)	return MakeEntry(END_OF_BLOCK, 0, 0);
+	if (_symbol < 286)	return MakeEntry(MATCH, LENGTH_EXTRA[_symbol - 257], LENGTH_BASE[_symbol - 257]);
+
+	return MakeEntry(INVALID, 0, 0);
+}
+
+static unsigned int DistEntry(unsigned int _symbol)
+{
+	if (_symbol < 30)	return MakeEntry(MATCH, DIST_EXTRA[_symbol], DIST_BASE[_symbol]);
+
+	return MakeEntry(INVALID, 0, 0);
+}
+
+static unsigned int PrecodeEntry(unsigned int _symbol)
+{
+	return MakeEntry(LITERAL, 0, _symbol);
+}
+
+// Builds a lookup table for the canonical Huffman code given by _lengths, indexed by the next _tableBits bits
+// of the stream. Returns false if the code is over-subscribed, unused codes of an incomplete code stay invalid.
+static bool BuildTable(const unsigned char* _lengths, unsigned int _symbolCount, unsigned int _tableBits,
+	unsigned int (*_symbolEntry)(unsigned int), bool _doubleLiterals, unsigned int* _table)
+{
+	unsigned int lengthCounts[16] = {};
+
+	for (unsigned int i = 0; i < _symbolCount; i++)
+	{
+		lengthCounts[_lengths[i]]++;
+	}
+
+	lengthCounts[0] = 0;
+
+	int codesLeft = 1;
+	unsigned int nextCode[16] = {};
+
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		codesLeft = (codesLeft << 1) - (int)lengthCounts[length];
+
+		if (codesLeft < 0)
+			return false;
+
+		nextCode[length] = (nextCode[length - 1] + lengthCounts[length - 1]) << 1;
+	}
+
+	// Deflate packs codes most significant bit first into a stream read from the least significant bit
+	unsigned short reversedCodes[288] = {};
+
+	for (unsigned int symbol = 0; symbol < _symbolCount; symbol++)
+	{
+		unsigned int length = _lengths[symbol];
+
+		if (length == 0)
+			continue;
+
+		unsigned int code = nextCode[length]++, reversed = 0;
+
+		for (unsigned int i = 0; i < length; i++)
+		{
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		}
+
+		reversedCodes[symbol] = (unsigned short)reversed;
+	}
+
+	const unsigned int rootSize = 1u << _tableBits, rootMask = rootSize - 1;
+
+	for (unsigned int i = 0; i < rootSize; i++)
+	{
+		_table[i] = MakeEntry(INVALID, 0, 0);
+	}
+
+	// Each root entry shared by longer codes gets a subtable wide enough for the longest of them
+	unsigned char subtableBits[1u << LITLEN_TABLE_BITS] = {};
+
+	for (unsigned int symbol = 0; symbol < _symbolCount; symbol++)
+	{
+		if (_lengths[symbol] > _tableBits)
+		{
+			unsigned int prefix = reversedCodes[symbol] & rootMask;
+			unsigned int bits = _lengths[symbol] - _tableBits;
+
+			if (bits > subtableBits[prefix]) subtableBits[prefix] = (unsigned char)bits;
+		}
+	}
+
+	unsigned int tableEnd = rootSize;
+
+	for (unsigned int prefix = 0; prefix < rootSize; prefix++)
+	{
+		if (subtableBits[prefix] == 0)
+			continue;
+
+		_table[prefix] = MakeEntry(SUBTABLE, subtableBits[prefix], tableEnd) | _tableBits;
+
+		for (unsigned int i = 0; i < (1u << subtableBits[prefix]); i++)
+		{
+			_table[tableEnd + i] = MakeEntry(INVALID, 0, 0);
+		}
+
+		tableEnd += 1u << subtableBits[prefix];
+	}
+
+	// Every index whose low bits match a code maps to it
+	for (unsigned int symbol = 0; symbol < _symbolCount; symbol++)
+	{
+		unsigned int length = _lengths[symbol];
+
+		if (length == 0)
+			continue;
+
+		unsigned int entry = _symbolEntry(symbol);
+
+		if (length <= _tableBits)
+		{
+			for (unsigned int i = reversedCodes[symbol]; i < rootSize; i += 1u << length)
+			{
+				_table[i] = entry | length;
+			}
+		}
+		else
+		{
+			unsigned int prefix = reversedCodes[symbol] & rootMask;
+			unsigned int* subtable = _table + EntryValue(_table[prefix]);
+			unsigned int subLength = length - _tableBits;
+
+			for (unsigned int i = reversedCodes[symbol] >> _tableBits; i < (1u << subtableBits[prefix]); i += 1u << subLength)
+			{
+				subtable[i] = entry | subLength;
+			}
+		}
+	}
+
+	// Pair up literals whose codes both fit in the root index, the bits after the first code index the second
+	if (_doubleLiterals)
+	{
+		unsigned int singles[1u << LITLEN_TABLE_BITS];
+		memcpy(singles, _table, rootSize * sizeof(unsigned int));
+
+		for (unsigned int i = 0; i < rootSize; i++)
+		{
+			unsigned int first = singles[i], firstLength = EntryLength(first);
+
+			if (EntryKind(first) != LITERAL || firstLength >= _tableBits)
+				continue;
+
+			unsigned int second = singles[i >> firstLength], secondLength = EntryLength(second);
+
+			if (EntryKind(second) != LITERAL || firstLength + secondLength > _tableBits)
+				continue;
+
+			_table[i] = MakeEntry(DOUBLE_LITERAL, 0, EntryValue(first) | (EntryValue(second) << 8)) | (firstLength + secondLength);
+		}
+	}
+
+	return true;
+}
+
+// Tables for the fixed Huffman codes of block type 1, built once
+struct FixedTables
+{
+	FixedTables()
+	{
+		unsigned char lengths[288];
+
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		BuildTable(lengths, 288, LITLEN_TABLE_BITS, LitLenEntry, true, litLen);
+
+		memset(lengths, 5, 32);
+		BuildTable(lengths, 32, DIST_TABLE_BITS, DistEntry, false, dist);
+	}
+
+	static const FixedTables& Get()
+	{
+		static const FixedTables tables = FixedTables();
+		return tables;
+	}
+
+	unsigned int litLen[LITLEN_TABLE_SIZE];
+	unsigned int dist[DIST_TABLE_SIZE];
+};
+
+// Bits are consumed from the bottom of a 64-bit buffer, refilled whole bytes at a time to at least 56 bits.
+// The input is a list of spans, in and inEnd cover the current one and refills step a byte at a time across the ends.
+// Past the end of the last span it's padded with zero bytes, which are counted so truncation can be spotted.
+struct BitStream
+{
+	const unsigned char* in;
+	const unsigned char* inEnd;
+	const InflateSpan* span;
+	const InflateSpan* spansEnd;
+	uint64_t bits;
+	unsigned int count;
+	size_t overrun;
+
+	// Moves on to the next span with anything in it, false if there isn't one
+	bool NextSpan()
+	{
+		while (span + 1 < spansEnd)
+		{
+			span++;
+			in = span->data;
+			inEnd = span->data + span->size;
+
+			if (in < inEnd)
+				return true;
+		}
+
+		return false;
+	}
+
+	inline void Refill()
+	{
+		if (inEnd - in >= 8)
+		{
+			// All supported targets are little-endian, so this is the next 8 bytes of the stream in order
+			uint64_t next;
+			memcpy(&next, in, 8);
+
+			bits |= next << count;
+			in += (63 - count) >> 3;
+			count |= 56;
+		}
+		else RefillSlow();
+	}
+
+	void RefillSlow()
+	{
+		while (count <= 56)
+		{
+			uint64_t next = 0;
+
+			if (in < inEnd || NextSpan()) next = *in++;
+			else overrun++;
+
+			bits |= next << count;
+			count += 8;
+		}
+	}
+
+	inline unsigned int Peek(unsigned int _count) const	{ return (unsigned int)(bits & ((1ull << _count) - 1)); }
+	inline void Drop(unsigned int _count)				{ bits >>= _count; count -= _count; }
+
+	inline unsigned int Read(unsigned int _count)
+	{
+		unsigned int value = Peek(_count);
+		Drop(_count);
+		return value;
+	}
+
+	// Whether any of the zero padding has been consumed
+	inline bool IsTruncated() const						{ return overrun * 8 > count; }
+
+	// Drops the rest of the current byte and hands the whole bytes still buffered back to the input
+	bool AlignAndRewind()
+	{
+		Drop(count & 7);
+
+		size_t buffered = count / 8;
+
+		if (buffered < overrun)
+			return false;
+
+		// They may have come from the spans before this one
+		size_t rewind = buffered - overrun;
+
+		while (rewind > (size_t)(in - span->data))
+		{
+			rewind -= in - span->data;
+			span--;
+			in = inEnd = span->data + span->size;
+		}
+
+		in -= rewind;
+		bits = 0, count = 0, overrun = 0;
+
+		return true;
+	}
+
+	// Copies up to _size whole bytes straight from the input once aligned and rewound, returns how many there were
+	size_t CopyBytes(unsigned char* _out, size_t _size)
+	{
+		size_t copied = 0;
+
+		while (copied < _size && (in < inEnd || NextSpan()))
+		{
+			size_t available = (size_t)(inEnd - in);
+			size_t run = (_size - copied < available) ? _size - copied : available;
+
+			memcpy(_out + copied, in, run);
+			copied += run;
+			in += run;
+		}
+
+		return copied;
+	}
+};
+
+struct OutputWindow
+{
+	unsigned char* start;
+	unsigned char* out;
+	unsigned char* end;
+
+	unsigned char* nextProgress;
+	InflateProgressCallback progress;
+	void* progressContext;
+
+	// Output is checksummed as it settles, before the callback is free to modify it
+	bool verifyChecksum;
+	unsigned char* checked;
+	unsigned int adler;
+
+	void ReportProgress()
+	{
+		size_t written = out - start;
+
+		if (progress != nullptr)
+		{
+			unsigned char* settled = (written > WINDOW_SIZE) ? out - WINDOW_SIZE : start;
+
+			if (verifyChecksum)
+			{
+				adler = Inflater::Adler32(checked, settled - checked, adler);
+				checked = settled;
+			}
+
+			progress(settled - start, progressContext);
+		}
+
+		nextProgress = ((size_t)(end - out) > PROGRESS_INTERVAL) ? out + PROGRESS_INTERVAL : end;
+	}
+};
+
+static void ThrowOverflow()
+{
+	throw std::runtime_error("Inflated data is larger than the output buffer!");
+}
+
+static void ThrowCorrupt()
+{
+	throw std::runtime_error("Corrupt DEFLATE data!");
+}
+
+static inline void CopyMatchFast(unsigned char*& _out, unsigned int _length, unsigned int _distance)
+{
+	const unsigned char* src = _out - _distance;
+	unsigned char* end = _out + _length;
+
+	if (_distance >= 16)
+	{
+		do
+		{
+			memcpy(_out, src, 16);
+			_out += 16, src += 16;
+		} while (_out < end);
+	}
+	else if (_distance >= 8)
+	{
+		// Each 8 byte step only reads bytes already written, overlapping matches repeat correctly
+		do
+		{
+			memcpy(_out, src, 8);
+			_out += 8, src += 8;
+		} while (_out < end);
+	}
+	else if (_distance == 1)
+	{
+		memset(_out, src[0], _length);
+	}
+	else
+	{
+		// Short repeating pattern, lay down its first 8 bytes then step by the largest multiple of the distance
+		// that fits in 8, so every 8 byte read only covers bytes the previous step already wrote
+		for (unsigned int i = 0; i < 8; i++) _out[i] = src[i];
+
+		const unsigned int step = 8 - 8 % _distance;
+
+		for (unsigned char* dst = _out + step; dst < end; dst += step)
+		{
+			unsigned long long pattern;
+			memcpy(&pattern, dst - step, 8);
+			memcpy(dst, &pattern, 8);
+		}
+	}
+
+	_out = end;
+}
+
+// Decodes one Huffman coded block, returns false if the input ran out first
+static bool DecodeBlock(BitStream& _bits, OutputWindow& _window, const unsigned int* _litLen, const unsigned int* _dist)
+{
+	unsigned char* out = _window.out;
+
+	while (true)
+	{
+		// Fast loop, every symbol fits in one refill and there's room for copies to overrun
+		const unsigned char* fastEnd = (_window.end - out > (ptrdiff_t)FAST_OUTPUT_SLACK) ? _window.end - FAST_OUTPUT_SLACK : out;
+		if (fastEnd > _window.nextProgress) fastEnd = _window.nextProgress;
+
+		while (out < fastEnd && _bits.inEnd - _bits.in >= 8)
+		{
+			_bits.Refill();
+
+			unsigned int entry = _litLen[_bits.Peek(LITLEN_TABLE_BITS)];
+
+			if (EntryKind(entry) == SUBTABLE)
+			{
+				_bits.Drop(LITLEN_TABLE_BITS);
+				entry = _litLen[EntryValue(entry) + _bits.Peek(EntryExtra(entry))];
+			}
+
+			_bits.Drop(EntryLength(entry));
+
+			switch (EntryKind(entry))
+			{
+				case LITERAL:
+				{
+					*out++ = (unsigned char)EntryValue(entry);
+					continue;
+				}
+
+				case DOUBLE_LITERAL:
+				{
+					unsigned int value = EntryValue(entry);
+					out[0] = (unsigned char)value;
+					out[1] = (unsigned char)(value >> 8);
+					out += 2;
+					continue;
+				}
+
+				case MATCH:
+				{
+					unsigned int length = EntryValue(entry) + _bits.Read(EntryExtra(entry));
+
+					unsigned int distEntry = _dist[_bits.Peek(DIST_TABLE_BITS)];
+
+					if (EntryKind(distEntry) == SUBTABLE)
+					{
+						_bits.Drop(DIST_TABLE_BITS);
+						distEntry = _dist[EntryValue(distEntry) + _bits.Peek(EntryExtra(distEntry))];
+					}
+
+					if (EntryKind(distEntry) != MATCH)
+						ThrowCorrupt();
+
+					_bits.Drop(EntryLength(distEntry));
+					unsigned int distance = EntryValue(distEntry) + _bits.Read(EntryExtra(distEntry));
+
+					if (distance > (size_t)(out - _window.start))
+						ThrowCorrupt();
+
+					CopyMatchFast(out, length, distance);
+					continue;
+				}
+
+				case END_OF_BLOCK:
+				{
+					_window.out = out;
+					return true;
+				}
+
+				default:
+					ThrowCorrupt();
+			}
+		}
+
+		if (out >= _window.nextProgress && out < _window.end)
+		{
+			_window.out = out;
+			_window.ReportProgress();
+			continue;
+		}
+
+		// Careful path near the end of the input or output, one symbol at a time with exact bounds
+		_bits.Refill();
+
+		unsigned int entry = _litLen[_bits.Peek(LITLEN_TABLE_BITS)];
+
+		if (EntryKind(entry) == SUBTABLE)
+		{
+			_bits.Drop(LITLEN_TABLE_BITS);
+			entry = _litLen[EntryValue(entry) + _bits.Peek(EntryExtra(entry))];
+		}
+
+		_bits.Drop(EntryLength(entry));
+
+		unsigned int length = 0, distance = 0;
+
+		if (EntryKind(entry) == MATCH)
+		{
+			length = EntryValue(entry) + _bits.Read(EntryExtra(entry));
+
+			unsigned int distEntry = _dist[_bits.Peek(DIST_TABLE_BITS)];
+
+			if (EntryKind(distEntry) == SUBTABLE)
+			{
+				_bits.Drop(DIST_TABLE_BITS);
+				distEntry = _dist[EntryValue(distEntry) + _bits.Peek(EntryExtra(distEntry))];
+			}
+
+			if (EntryKind(distEntry) != MATCH && !_bits.IsTruncated())
+				ThrowCorrupt();
+
+			_bits.Drop(EntryLength(distEntry));
+			distance = EntryValue(distEntry) + _bits.Read(EntryExtra(distEntry));
+		}
+
+		if (_bits.IsTruncated())
+		{
+			_window.out = out;
+			return false;
+		}
+
+		switch (EntryKind(entry))
+		{
+			case LITERAL:
+			{
+				if (out == _window.end) ThrowOverflow();
+
+				*out++ = (unsigned char)EntryValue(entry);
+				break;
+			}
+
+			case DOUBLE_LITERAL:
+			{
+				if (_window.end - out < 2) ThrowOverflow();
+
+				unsigned int value = EntryValue(entry);
+				out[0] = (unsigned char)value;
+				out[1] = (unsigned char)(value >> 8);
+				out += 2;
+				break;
+			}
+
+			case MATCH:
+			{
+				if (distance > (size_t)(out - _window.start)) ThrowCorrupt();
+				if (length > (size_t)(_window.end - out)) ThrowOverflow();
+
+				const unsigned char* src = out - distance;
+
+				for (unsigned int i = 0; i < length; i++) out[i] = src[i];
+				out += length;
+				break;
+			}
+
+			case END_OF_BLOCK:
+			{
+				_window.out = out;
+				return true;
+			}
+
+			default:
+				ThrowCorrupt();
+		}
+	}
+}
+
+// Reads the code lengths of a dynamic block and builds its tables, returns false if the input ran out first
+static bool ReadDynamicTables(BitStream& _bits, unsigned int* _litLen, unsigned int* _dist)
+{
+	_bits.Refill();
+
+	unsigned int litLenCount = _bits.Read(5) + 257;
+	unsigned int distCount = _bits.Read(5) + 1;
+	unsigned int precodeCount = _bits.Read(4) + 4;
+
+	unsigned char precodeLengths[19] = {};
+
+	for (unsigned int i = 0; i < precodeCount; i++)
+	{
+		_bits.Refill();
+		precodeLengths[PRECODE_ORDER[i]] = (unsigned char)_bits.Read(3);
+	}
+
+	unsigned int precode[1u << PRECODE_TABLE_BITS];
+
+	if (!BuildTable(precodeLengths, 19, PRECODE_TABLE_BITS, PrecodeEntry, false, precode))
+		ThrowCorrupt();
+
+	// Literal/length and distance code lengths are one run, repeats may cross from one into the other
+	unsigned char lengths[288 + 32] = {};
+	unsigned int total = litLenCount + distCount;
+
+	for (unsigned int i = 0; i < total;)
+	{
+		_bits.Refill();
+
+		if (_bits.IsTruncated())
+			return false;
+
+		unsigned int entry = precode[_bits.Peek(PRECODE_TABLE_BITS)];
+
+		if (EntryKind(entry) != LITERAL)
+			ThrowCorrupt();
+
+		_bits.Drop(EntryLength(entry));
+
+		unsigned int symbol = EntryValue(entry);
+
+		if (symbol < 16)
+		{
+			lengths[i++] = (unsigned char)symbol;
+			continue;
+		}
+
+		unsigned char repeated = 0;
+		unsigned int count = 0;
+
+		switch (symbol)
+		{
+			case 16:
+			{
+				if (i == 0) ThrowCorrupt();
+
+				repeated = lengths[i - 1];
+				count = 3 + _bits.Read(2);
+				break;
+			}
+
+			case 17:	count = 3 + _bits.Read(3);	break;
+			default:	count = 11 + _bits.Read(7);	break;
+		}
+
+		if (count > total - i)
+			ThrowCorrupt();
+
+		memset(lengths + i, repeated, count);
+		i += count;
+	}
+
+	if (_bits.IsTruncated())
+		return false;
+
+	// A block without an end of block code could never finish
+	if (lengths[256] == 0)
+		ThrowCorrupt();
+
+	if (!BuildTable(lengths, litLenCount, LITLEN_TABLE_BITS, LitLenEntry, true, _litLen) ||
+		!BuildTable(lengths + litLenCount, distCount, DIST_TABLE_BITS, DistEntry, false, _dist))
+	{
+		ThrowCorrupt();
+	}
+
+	return true;
+}
+
+size_t Inflater::InflateZlib(const unsigned char* _in, size_t _inSize, unsigned char* _out, size_t _outSize,
+	InflateProgressCallback _progress, void* _progressContext, bool _verifyChecksum)
+{
+	const InflateSpan span = { _in, _inSize };
+
+	return InflateZlib(&span, 1, _out, _outSize, _progress, _progressContext, _verifyChecksum);
+}
+
+size_t Inflater::InflateZlib(const InflateSpan* _spans, size_t _spanCount, unsigned char* _out, size_t _outSize,
+	InflateProgressCallback _progress, void* _progressContext, bool _verifyChecksum)
+{
+	if (_spanCount == 0)
+		return 0;
+
+	BitStream bits = { _spans[0].data, _spans[0].data + _spans[0].size, _spans, _spans + _spanCount, 0, 0, 0 };
+	bits.Refill();
+
+	// zlib header, deflate with at most a 32K window and no preset dictionary
+	unsigned int cmf = bits.Read(8), flg = bits.Read(8);
+
+	if (bits.IsTruncated())
+		return 0;
+
+	if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20) != 0)
+	{
+		throw std::runtime_error("Invalid zlib stream header!");
+	}
+
+	OutputWindow window = { _out, _out, _out + _outSize, _out, _progress, _progressContext, _verifyChecksum, _out, 1 };
+	window.ReportProgress();
+
+	// Dynamic tables live on the stack, about 44 KB
+	unsigned int litLen[LITLEN_TABLE_SIZE];
+	unsigned int dist[DIST_TABLE_SIZE];
+
+	bool finalBlock = false;
+
+	while (!finalBlock)
+	{
+		bits.Refill();
+
+		finalBlock = bits.Read(1) != 0;
+		unsigned int blockType = bits.Read(2);
+
+		if (bits.IsTruncated())
+			return window.out - _out;
+
+		switch (blockType)
+		{
+			case 0: // stored
+			{
+				unsigned char header[4];
+
+				if (!bits.AlignAndRewind() || bits.CopyBytes(header, 4) < 4)
+					return window.out - _out;
+
+				unsigned int length = header[0] | (header[1] << 8);
+				unsigned int lengthComplement = header[2] | (header[3] << 8);
+
+				if ((length ^ 0xffff) != lengthComplement)
+					ThrowCorrupt();
+
+				if (length > (size_t)(window.end - window.out))
+					ThrowOverflow();
+
+				size_t copied = bits.CopyBytes(window.out, length);
+				window.out += copied;
+
+				if (copied < length)
+					return window.out - _out;
+
+				if (window.out >= window.nextProgress && window.out < window.end)
+					window.ReportProgress();
+
+				break;
+			}
+
+			case 1: // fixed Huffman codes
+			{
+				const FixedTables& fixed = FixedTables::Get();
+
+				if (!DecodeBlock(bits, window, fixed.litLen, fixed.dist))
+					return window.out - _out;
+
+				break;
+			}
+
+			case 2: // dynamic Huffman codes
+			{
+				if (!ReadDynamicTables(bits, litLen, dist) || !DecodeBlock(bits, window, litLen, dist))
+					return window.out - _out;
+
+				break;
+			}
+
+			default:
+				ThrowCorrupt();
+		}
+	}
+
+	// Adler-32 of the uncompressed data follows the last block, most significant byte first
+	unsigned char trailer[4];
+
+	if (!bits.AlignAndRewind() || bits.CopyBytes(trailer, 4) < 4)
+		return window.out - _out;
+
+	unsigned int storedAdler = ((unsigned int)trailer[0] << 24) | (trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+
+	if (_verifyChecksum && storedAdler != Adler32(window.checked, window.out - window.checked, window.adler))
+	{
+		throw std::runtime_error("Inflated data does not match its Adler-32 checksum!");
+	}
+
+	return window.out - _out;
+}
+
+// Largest run of bytes before Adler-32's sums have to be reduced to stay within 32 bits
+static constexpr size_t ADLER_MAX_RUN = 5552;
+static constexpr unsigned int ADLER_MOD = 65521;
+
+#if defined(R2D_X86)
+// 16 bytes a step: a's share of the step is the byte sum, b's is each byte weighted by how many of the step's bytes
+// it comes before (16 down to 1), plus 16 times everything a held before the step, which is gathered up in previous
+// and added once per run. _size must be a multiple of 16.
+R2D_TARGET("sse2") static unsigned int Adler32SSE2(const unsigned char* _data, size_t _size, unsigned int _adler)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weightsLow = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i weightsHigh = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+	uint32_t a = _adler & 0xffff, b = _adler >> 16;
+
+	while (_size > 0)
+	{
+		size_t run = (_size < ADLER_MAX_RUN) ? _size : ADLER_MAX_RUN & ~(size_t)15;
+		_size -= run;
+
+		b += a * (uint32_t)run;
+
+		__m128i sums = zero, weighted = zero, previous = zero;
+
+		for (; run > 0; run -= 16, _data += 16)
+		{
+			const __m128i bytes = _mm_loadu_si128((const __m128i*)_data);
+
+			previous = _mm_add_epi32(previous, sums);
+			sums = _mm_add_epi32(sums, _mm_sad_epu8(bytes, zero));
+			weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow));
+			weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+		}
+
+		// Horizontal sums, the byte sums are in the low half of each 64-bit lane
+		previous = _mm_add_epi32(previous, _mm_shuffle_epi32(previous, _MM_SHUFFLE(1, 0, 3, 2)));
+		sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+		weighted = _mm_add_epi32(weighted, _mm_shuffle_epi32(weighted, _MM_SHUFFLE(1, 0, 3, 2)));
+		weighted = _mm_add_epi32(weighted, _mm_shuffle_epi32(weighted, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		a += (uint32_t)_mm_cvtsi128_si32(sums);
+		b += 16 * (uint32_t)_mm_cvtsi128_si32(previous) + (uint32_t)_mm_cvtsi128_si32(weighted);
+
+		a %= ADLER_MOD;
+		b %= ADLER_MOD;
+	}
+
+	return (b << 16) | a;
+}
+#endif
+
+unsigned int Inflater::Adler32(const unsigned char* _data, size_t _size, unsigned int _adler)
+{
+#if defined(R2D_X86)
+	if (_size >= 64 && CPUFeatures::GetInstance().sse2)
+	{
+		size_t vectorised = _size & ~(size_t)15;
+
+		_adler = Adler32SSE2(_data, vectorised, _adler);
+		_data += vectorised;
+		_size -= vectorised;
+	}
+#endif
+
+	unsigned int a = _adler & 0xffff, b = _adler >> 16;
+
+	while (_size > 0)
+	{
+		size_t run = (_size < ADLER_MAX_RUN) ? _size : ADLER_MAX_RUN;
+		_size -= run;
+
+		for (; run >= 8; run -= 8, _data += 8)
+		{
+			a += _data[0]; b += a;
+			a += _data[1]; b += a;
+			a += _data[2]; b += a;
+			a += _data[3]; b += a;
+			a += _data[4]; b += a;
+			a += _data[5]; b += a;
+			a += _data[6]; b += a;
+			a += _data[7]; b += a;
+		}
+
+		for (; run > 0; run--, _data++)
+		{
+			a += *_data; b += a;
+		}
+
+		a %= ADLER_MOD;
+		b %= ADLER_MOD;
+	}
+
+	return (b << 16) | a;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "DLLCommon.h"
+
+#include <cstddef>
+
+// Called every so often while inflating with the number of output bytes that are final and no longer
+// referenced by the LZ77 window, so they can be modified in place.
+typedef void (*InflateProgressCallback)(size_t _settledBytes, void* _context);
+
+// One piece of a zlib stream split across several buffers, the way PNG splits it across IDAT chunks
+struct RENDERER_API InflateSpan
+{
+	const unsigned char* data;
+	size_t size;
+};
+
+// DEFLATE decoder for whole zlib streams whose decompressed size is known up front, as it is for PNG.
+// The output buffer doubles as the LZ77 window, so none of zlib's streaming bookkeeping is needed.
+// Huffman codes are decoded through lookup tables that hold two literals per entry where they fit,
+// bits are refilled 64 at a time and match copies write 8 bytes at a time, overrunning into the
+// part of the output not yet written.
+class RENDERER_API Inflater
+{
+public:
+	// Inflates the zlib stream in _in into _out, returning the number of bytes written. Stops early and
+	// returns less than _outSize if _in is truncated. Throws on corrupt data, a failed Adler-32 check
+	// (unless _verifyChecksum is false) or data that inflates to more than _outSize.
+	static size_t InflateZlib(const unsigned char* _in, size_t _inSize, unsigned char* _out, size_t _outSize,
+		InflateProgressCallback _progress = nullptr, void* _progressContext = nullptr, bool _verifyChecksum = true);
+
+	// Same for a stream split across _spanCount spans, read in order where they are without gathering them first
+	static size_t InflateZlib(const InflateSpan* _spans, size_t _spanCount, unsigned char* _out, size_t _outSize,
+		InflateProgressCallback _progress = nullptr, void* _progressContext = nullptr, bool _verifyChecksum = true);
+
+	// Running checksum, pass the previous result as _adler to continue it over more data. 16 bytes at a time with SSE2.
+	static unsigned int Adler32(const unsigned char* _data, size_t _size, unsigned int _adler = 1);
+};
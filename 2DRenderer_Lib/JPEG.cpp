@@ -0,0 +1,1139 @@
+#include "JPEG.h"
+
+#include "JPEGKernels.h"
+#include "MappedFile.h"
+#include "PNGConverters.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static constexpr unsigned char MARKER_SOF0 = 0xC0, MARKER_SOF1 = 0xC1, MARKER_SOF2 = 0xC2, MARKER_DHT = 0xC4,
+	MARKER_RST0 = 0xD0, MARKER_RST7 = 0xD7, MARKER_SOI = 0xD8, MARKER_EOI = 0xD9, MARKER_SOS = 0xDA,
+	MARKER_DQT = 0xDB, MARKER_DRI = 0xDD, MARKER_APP14 = 0xEE, MARKER_TEM = 0x01;
+
+// Coefficient order in the stream -> natural (row major) order
+static constexpr unsigned char ZIGZAG[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Huffman codes up to this long decode with a single table lookup
+static constexpr unsigned int HUFFMAN_FAST_BITS = 9;
+
+// The most blocks an MCU may have, across every component of an interleaved scan
+static constexpr unsigned int MAX_MCU_BLOCKS = 10;
+
+// Scans with restart markers are split into tasks of at least this many MCUs, and rows are converted
+// in tasks of about this many pixels. Anything smaller is done on the calling thread
+static constexpr unsigned int DECODE_TASK_UNITS = 256;
+static constexpr unsigned int CONVERT_TASK_PIXELS = 1u << 16;
+
+struct JPEGHuffmanTable
+{
+	// Next HUFFMAN_FAST_BITS bits -> (code length << 8) | symbol, 0 where the code is longer
+	unsigned short fast[1u << HUFFMAN_FAST_BITS];
+
+	// AC tables, the same bits -> (value << 8) | (run << 4) | bits used, where the code and the value after it both fit.
+	// 0 where they don't, the value is then read separately
+	short fastAC[1u << HUFFMAN_FAST_BITS];
+
+	// Longer codes, compared left aligned to 16 bits. One past the largest code of each length,
+	// and what to add to a code of that length to get the index of its symbol
+	unsigned int maxCode[18];
+	int symbolOffset[17];
+	unsigned char symbols[256];
+	unsigned int symbolCount;
+
+	bool defined = false;
+};
+
+struct JPEGComponent
+{
+	unsigned char id, h, v, quantTable;
+	unsigned char dcTable, acTable; // of the current scan
+
+	unsigned int width, height; // samples that are part of the image, before upsampling
+	unsigned int blocksX, blocksY; // blocks covering them, what a scan of just this component codes
+
+	// Samples each block's transform gives a side, 8 at full size. Downscaled decodes use smaller transforms,
+	// except subsampled components may use bigger ones than the rest to save upsampling them
+	unsigned int blockSize;
+	unsigned int upsampleX, upsampleY; // output pixels per sample
+	bool fancyUpsample; // interpolated, or just replicated when samples are means of whole blocks
+
+	// Samples of every block the frame codes for this component, padded out to whole MCUs
+	std::vector<unsigned char> plane;
+	size_t stride;
+};
+
+struct JPEGDecodeState
+{
+	JPEGHuffmanTable dcTables[4], acTables[4];
+
+	unsigned short quantTables[4][64]; // zigzag order, as stored
+	bool quantDefined[4] = {};
+
+	JPEGComponent components[3];
+	unsigned int hMax = 1, vMax = 1;
+	unsigned int mcusX = 0, mcusY = 0;
+
+	unsigned int restartInterval = 0; // MCUs, 0 without restart markers
+	int adobeTransform = -1; // from an Adobe APP14 segment, -1 without one
+
+	bool frameRead = false, scanRead = false;
+	bool pooled = true; // see JPEGProperties::LoadJPEG
+	unsigned int scale = 1; // output is 1 / scale the size of the image
+};
+
+// The components of one scan and the units it codes, MCUs for an interleaved scan or blocks of its one component
+struct JPEGScan
+{
+	JPEGComponent* components[3];
+	unsigned int componentCount;
+
+	unsigned int unitsX, unitCount;
+};
+
+// MSB first reader over entropy coded data that drops the zero byte stuffed after each 0xFF. It stops at the
+// next marker and feeds zero bits from there, so truncated data decodes to flat blocks instead of overrunning.
+struct JPEGBitReader
+{
+	const unsigned char* data;
+	size_t size, offset;
+
+	std::uint64_t bits = 0; // left aligned
+	unsigned int count = 0;
+	bool atMarker = false;
+
+	void Refill()
+	{
+		// Whole bytes at once while there's no 0xFF among the next 8
+		if (count <= 56 && !atMarker && offset + 8 <= size)
+		{
+			std::uint64_t next = 0;
+
+			for (unsigned int i = 0; i < 8; i++)
+			{
+				next = (next << 8) | data[offset + i];
+			}
+
+			// Any byte of ~next that is zero was 0xFF
+			if (((~next - 0x0101010101010101ull) & next & 0x8080808080808080ull) == 0)
+			{
+				unsigned int byteCount = (64 - count) >> 3;
+
+				bits |= (next >> (64 - byteCount * 8)) << (64 - byteCount * 8 - count);
+				count += byteCount * 8;
+				offset += byteCount;
+				return;
+			}
+		}
+
+		while (count <= 56)
+		{
+			unsigned int byte = 0;
+
+			if (!atMarker && offset < size)
+			{
+				byte = data[offset];
+
+				if (byte != 0xFF)
+				{
+					offset++;
+				}
+				else if (offset + 1 < size && data[offset + 1] == 0x00)
+				{
+					offset += 2;
+				}
+				else
+				{
+					atMarker = true;
+					byte = 0;
+				}
+			}
+
+			bits |= (std::uint64_t)byte << (56 - count);
+			count += 8;
+		}
+	}
+
+	// _count is 1 to 16
+	unsigned int Peek(unsigned int _count) const	{ return (unsigned int)(bits >> (64 - _count)); }
+	void Skip(unsigned int _count)					{ bits <<= _count; count -= _count; }
+
+	unsigned int Read(unsigned int _count)
+	{
+		unsigned int value = Peek(_count);
+		Skip(_count);
+		return value;
+	}
+
+	// Drops what's left of the current interval and steps over the restart marker that ends it
+	void Restart()
+	{
+		bits = 0;
+		count = 0;
+		atMarker = false;
+
+		while (offset + 1 < size && !(data[offset] == 0xFF && data[offset + 1] != 0x00 && data[offset + 1] != 0xFF))
+		{
+			offset++;
+		}
+
+		if (offset + 1 < size && data[offset + 1] >= MARKER_RST0 && data[offset + 1] <= MARKER_RST7)
+		{
+			offset += 2;
+		}
+	}
+};
+
+static unsigned int ReadUInt16(const unsigned char* _data)
+{
+	return ((unsigned int)_data[0] << 8) | _data[1];
+}
+
+static void BuildHuffmanTable(const unsigned char* _counts, const unsigned char* _symbols, unsigned int _symbolCount, JPEGHuffmanTable& _table)
+{
+	memset(_table.fast, 0, sizeof(_table.fast));
+	memset(_table.fastAC, 0, sizeof(_table.fastAC));
+	memcpy(_table.symbols, _symbols, _symbolCount);
+	_table.symbolCount = _symbolCount;
+
+	unsigned int code = 0, symbol = 0;
+
+	for (unsigned int length = 1; length <= 16; length++)
+	{
+		_table.symbolOffset[length] = (int)symbol - (int)code;
+
+		for (unsigned int i = 0; i < _counts[length - 1]; i++, code++, symbol++)
+		{
+			if (length <= HUFFMAN_FAST_BITS)
+			{
+				// Every lookup index starting with this code
+				unsigned int first = code << (HUFFMAN_FAST_BITS - length), last = (code + 1) << (HUFFMAN_FAST_BITS - length);
+
+				for (unsigned int index = first; index < last; index++)
+				{
+					_table.fast[index] = (unsigned short)((length << 8) | _symbols[symbol]);
+				}
+			}
+		}
+
+		if (code > (1u << length))
+		{
+			throw std::runtime_error("DHT segment has more codes of length " + std::to_string(length) + " than fit.");
+		}
+
+		_table.maxCode[length] = code << (16 - length);
+		code <<= 1;
+	}
+
+	_table.maxCode[17] = 0xFFFFFFFF;
+	_table.defined = true;
+
+	// Codes short enough that the value after them is in the same lookup
+	for (unsigned int index = 0; index < (1u << HUFFMAN_FAST_BITS); index++)
+	{
+		unsigned int entry = _table.fast[index];
+
+		if (entry == 0)
+			continue;
+
+		unsigned int codeLength = entry >> 8, run = (entry >> 4) & 15, valueLength = entry & 15;
+
+		if (valueLength == 0 || codeLength + valueLength > HUFFMAN_FAST_BITS)
+			continue;
+
+		int value = (index >> (HUFFMAN_FAST_BITS - codeLength - valueLength)) & ((1 << valueLength) - 1);
+
+		if (value < (1 << (valueLength - 1)))
+		{
+			value += 1 - (1 << valueLength);
+		}
+
+		// Values needing more than 8 bits can't share the entry
+		if (value >= -128 && value <= 127)
+		{
+			_table.fastAC[index] = (short)((value * 256) + (run << 4) + codeLength + valueLength);
+		}
+	}
+}
+
+static inline unsigned int DecodeSymbol(JPEGBitReader& _bits, const JPEGHuffmanTable& _table)
+{
+	unsigned int entry = _table.fast[_bits.Peek(HUFFMAN_FAST_BITS)];
+
+	if (entry != 0)
+	{
+		_bits.Skip(entry >> 8);
+		return entry & 0xFF;
+	}
+
+	unsigned int code = _bits.Peek(16), length = HUFFMAN_FAST_BITS + 1;
+
+	while (code >= _table.maxCode[length])
+	{
+		length++;
+	}
+
+	int index = (length <= 16) ? (int)(code >> (16 - length)) + _table.symbolOffset[length] : -1;
+
+	if (index < 0 || index >= (int)_table.symbolCount)
+	{
+		throw std::runtime_error("Invalid Huffman code in JPEG scan data.");
+	}
+
+	_bits.Skip(length);
+	return _table.symbols[index];
+}
+
+// A _length bit value read after a Huffman coded length, values below half the range are negative
+static inline int ReadSigned(JPEGBitReader& _bits, unsigned int _length)
+{
+	if (_length == 0)
+		return 0;
+
+	int value = (int)_bits.Read(_length);
+	return (value < (1 << (_length - 1))) ? value - (1 << _length) + 1 : value;
+}
+
+// Decodes one block's coefficients, dequantised, into _block in natural order
+static void DecodeBlock(JPEGBitReader& _bits, const JPEGHuffmanTable& _dc, const JPEGHuffmanTable& _ac,
+	const unsigned short* _quant, int& _dcPredictor, short* _block)
+{
+	memset(_block, 0, 64 * sizeof(short));
+
+	// A symbol and the value after it are at most 32 bits
+	if (_bits.count < 32) _bits.Refill();
+
+	unsigned int length = DecodeSymbol(_bits, _dc);
+
+	if (length > 11)
+	{
+		throw std::runtime_error("Invalid DC coefficient length in JPEG scan data.");
+	}
+
+	_dcPredictor += ReadSigned(_bits, length);
+	_block[0] = (short)(_dcPredictor * _quant[0]);
+
+	for (unsigned int k = 1; k < 64;)
+	{
+		if (_bits.count < 32) _bits.Refill();
+
+		int fast = _ac.fastAC[_bits.Peek(HUFFMAN_FAST_BITS)];
+
+		if (fast != 0)
+		{
+			k += (fast >> 4) & 15;
+
+			if (k > 63)
+			{
+				throw std::runtime_error("AC coefficients run past the end of a block in JPEG scan data.");
+			}
+
+			_bits.Skip(fast & 15);
+			_block[ZIGZAG[k]] = (short)((fast >> 8) * _quant[k]);
+			k++;
+			continue;
+		}
+
+		unsigned int symbol = DecodeSymbol(_bits, _ac);
+		unsigned int run = symbol >> 4;
+		length = symbol & 15;
+
+		// Zero length is either 16 zeros (run 15) or the end of the block
+		if (length == 0)
+		{
+			if (run != 15)
+				break;
+
+			k += 16;
+			continue;
+		}
+
+		k += run;
+
+		if (k > 63)
+		{
+			throw std::runtime_error("AC coefficients run past the end of a block in JPEG scan data.");
+		}
+
+		_block[ZIGZAG[k]] = (short)(ReadSigned(_bits, length) * _quant[k]);
+		k++;
+	}
+}
+
+// Decodes units [_first, _last) of _scan, _bits starting at the data of unit _first, which has to begin a restart
+// interval (or the scan). Each unit's blocks are inverse transformed straight into the component planes
+static void DecodeUnits(JPEGBitReader& _bits, const JPEGDecodeState& _state, const JPEGScan& _scan, unsigned int _first, unsigned int _last)
+{
+	short blocks[MAX_MCU_BLOCKS * 64];
+	unsigned char* outputs[MAX_MCU_BLOCKS];
+	size_t strides[MAX_MCU_BLOCKS];
+
+	int dcPredictors[3] = {};
+	unsigned int intervalLeft = _state.restartInterval;
+
+	for (unsigned int unit = _first; unit < _last; unit++)
+	{
+		if (_state.restartInterval != 0)
+		{
+			if (intervalLeft == 0)
+			{
+				_bits.Restart();
+				intervalLeft = _state.restartInterval;
+
+				dcPredictors[0] = dcPredictors[1] = dcPredictors[2] = 0;
+			}
+
+			intervalLeft--;
+		}
+
+		const unsigned int unitX = unit % _scan.unitsX, unitY = unit / _scan.unitsX;
+		unsigned int blockCount = 0;
+
+		for (unsigned int i = 0; i < _scan.componentCount; i++)
+		{
+			JPEGComponent& component = *_scan.components[i];
+			const unsigned int blocksX = (_scan.componentCount == 1) ? 1 : component.h, blocksY = (_scan.componentCount == 1) ? 1 : component.v;
+
+			for (unsigned int y = 0; y < blocksY; y++)
+			{
+				for (unsigned int x = 0; x < blocksX; x++, blockCount++)
+				{
+					DecodeBlock(_bits, _state.dcTables[component.dcTable], _state.acTables[component.acTable],
+						_state.quantTables[component.quantTable], dcPredictors[i], blocks + blockCount * 64);
+
+					size_t blockRow = (size_t)(unitY * blocksY + y) * component.blockSize, blockColumn = (size_t)(unitX * blocksX + x) * component.blockSize;
+					outputs[blockCount] = component.plane.data() + blockRow * component.stride + blockColumn;
+					strides[blockCount] = component.stride;
+				}
+			}
+		}
+
+		// Blocks of the same size transform together, so full size ones still go through the SIMD kernels in pairs
+		for (unsigned int i = 0, first = 0; i < _scan.componentCount; i++)
+		{
+			const JPEGComponent& component = *_scan.components[i];
+			const unsigned int count = (_scan.componentCount == 1) ? 1 : component.h * component.v;
+
+			if (component.blockSize == 8)
+			{
+				JPEGKernels::InverseDCT(blocks + first * 64, outputs + first, strides + first, count);
+			}
+			else JPEGKernels::ReducedInverseDCT(blocks + first * 64, outputs + first, strides + first, count, component.blockSize);
+
+			first += count;
+		}
+	}
+}
+
+// Walks the entropy coded data from _offset to the marker ending it, noting where each of the _intervalCount restart
+// intervals starts in _starts and where the marker is in _end. False unless exactly the expected RST markers are found
+static bool FindRestartIntervals(const unsigned char* _data, size_t _size, size_t _offset, unsigned int _intervalCount, std::vector<size_t>& _starts, size_t& _end)
+{
+	_starts.assign(1, _offset);
+	_end = _size;
+
+	for (size_t offset = _offset; offset + 1 < _size; offset++)
+	{
+		const void* next = memchr(_data + offset, 0xFF, _size - 1 - offset);
+
+		if (next == nullptr)
+			break;
+
+		offset = (size_t)((const unsigned char*)next - _data);
+		const unsigned char marker = _data[offset + 1];
+
+		// Stuffed zero, or a fill byte before the marker
+		if (marker == 0x00 || marker == 0xFF)
+			continue;
+
+		if (marker < MARKER_RST0 || marker > MARKER_RST7)
+		{
+			_end = offset;
+			break;
+		}
+
+		// RST markers count 0 to 7 and wrap
+		if ((size_t)(marker - MARKER_RST0) != (_starts.size() - 1) % 8 || _starts.size() == _intervalCount)
+			return false;
+
+		_starts.push_back(offset + 2);
+		offset++;
+	}
+
+	return _starts.size() == _intervalCount;
+}
+
+// Upsampling, rows of the image past a component's edge repeat its edge samples
+
+// 2x horizontally, each output sample 3/4 the nearer input and 1/4 the further
+static void UpsampleH2V1(const unsigned char* _in, unsigned int _width, unsigned char* _out)
+{
+	if (_width == 1)
+	{
+		_out[0] = _out[1] = _in[0];
+		return;
+	}
+
+	_out[0] = _in[0];
+	_out[1] = (unsigned char)((_in[0] * 3 + _in[1] + 2) >> 2);
+
+	for (unsigned int x = 1; x + 1 < _width; x++)
+	{
+		unsigned int centre = _in[x] * 3;
+		_out[x * 2] = (unsigned char)((centre + _in[x - 1] + 1) >> 2);
+		_out[x * 2 + 1] = (unsigned char)((centre + _in[x + 1] + 2) >> 2);
+	}
+
+	_out[_width * 2 - 2] = (unsigned char)((_in[_width - 1] * 3 + _in[_width - 2] + 1) >> 2);
+	_out[_width * 2 - 1] = _in[_width - 1];
+}
+
+// 2x vertically, _far is the input row on the other side of the output row from _near
+static void UpsampleH1V2(const unsigned char* _near, const unsigned char* _far, unsigned int _width, unsigned int _bias, unsigned char* _out)
+{
+	for (unsigned int x = 0; x < _width; x++)
+	{
+		_out[x] = (unsigned char)((_near[x] * 3 + _far[x] + _bias) >> 2);
+	}
+}
+
+// 2x both ways, a vertical 3:1 blend of the two rows followed by a horizontal one
+static void UpsampleH2V2(const unsigned char* _near, const unsigned char* _far, unsigned int _width, unsigned char* _out)
+{
+	unsigned int current = _near[0] * 3 + _far[0];
+
+	if (_width == 1)
+	{
+		_out[0] = (unsigned char)((current * 4 + 8) >> 4);
+		_out[1] = (unsigned char)((current * 4 + 7) >> 4);
+		return;
+	}
+
+	unsigned int next = _near[1] * 3 + _far[1];
+
+	_out[0] = (unsigned char)((current * 4 + 8) >> 4);
+	_out[1] = (unsigned char)((current * 3 + next + 7) >> 4);
+
+	// Column sums recomputed per sample rather than carried over, so the loop has no dependency between steps
+	for (unsigned int x = 1; x + 1 < _width; x++)
+	{
+		unsigned int left = _near[x - 1] * 3 + _far[x - 1], centre = (_near[x] * 3 + _far[x]) * 3, right = _near[x + 1] * 3 + _far[x + 1];
+
+		_out[x * 2] = (unsigned char)((centre + left + 8) >> 4);
+		_out[x * 2 + 1] = (unsigned char)((centre + right + 7) >> 4);
+	}
+
+	unsigned int previous = _near[_width - 2] * 3 + _far[_width - 2];
+	current = _near[_width - 1] * 3 + _far[_width - 1];
+
+	_out[_width * 2 - 2] = (unsigned char)((current * 3 + previous + 8) >> 4);
+	_out[_width * 2 - 1] = (unsigned char)((current * 4 + 7) >> 4);
+}
+
+// Row _y of _component at full resolution, straight out of its plane or upsampled into _scratch
+static const unsigned char* GetComponentRow(const JPEGComponent& _component, unsigned int _y, unsigned char* _scratch)
+{
+	const unsigned int scaleX = _component.upsampleX, scaleY = _component.upsampleY;
+	const unsigned int row = _y / scaleY;
+
+	const unsigned char* near = _component.plane.data() + row * _component.stride;
+
+	if (scaleX == 1 && scaleY == 1)
+		return near;
+
+	// Replicated samples when they're means of whole blocks, as libjpeg does at 1/8 size, or rows are too narrow to interpolate
+	if (_component.fancyUpsample && scaleY == 2 && scaleX <= 2)
+	{
+		unsigned int farRow = (_y & 1) ? std::min(row + 1, _component.height - 1) : (row > 0 ? row - 1 : 0);
+		const unsigned char* far = _component.plane.data() + farRow * _component.stride;
+
+		if (scaleX == 2)
+		{
+			UpsampleH2V2(near, far, _component.width, _scratch);
+		}
+		else UpsampleH1V2(near, far, _component.width, (_y & 1) ? 2 : 1, _scratch);
+
+		return _scratch;
+	}
+
+	if (_component.fancyUpsample && scaleY == 1 && scaleX == 2)
+	{
+		UpsampleH2V1(near, _component.width, _scratch);
+		return _scratch;
+	}
+
+	for (unsigned int x = 0; x < _component.width * scaleX; x++)
+	{
+		_scratch[x] = near[x / scaleX];
+	}
+
+	return _scratch;
+}
+
+JPEGProperties::JPEGProperties()
+{
+	width = height = 0;
+	componentCount = 0;
+	pixelFormat = RGBA8;
+}
+
+void JPEGProperties::LoadJPEG(const char* _filePath, PixelFormat _format, bool _pooled, unsigned int _scale)
+{
+	width = height = 0;
+	componentCount = 0;
+	pixelFormat = _format;
+	pixels.clear();
+
+	if (_scale != 1 && _scale != 2 && _scale != 4 && _scale != 8)
+	{
+		throw std::runtime_error("JPEGs can only be decoded at 1/1, 1/2, 1/4 or 1/8 size, not 1/" + std::to_string(_scale) + ".");
+	}
+
+	MappedFile file;
+
+	if (!file.Open(_filePath))
+	{
+		throw std::runtime_error(std::string("Could not map file at: \"") + _filePath + std::string("\""));
+	}
+
+	JPEGDecodeState state = JPEGDecodeState();
+	state.pooled = _pooled;
+	state.scale = _scale;
+
+	Load(file.GetData(), file.GetSize(), state);
+}
+
+void JPEGProperties::Load(const unsigned char* _data, size_t _size, JPEGDecodeState& _state)
+{
+	if (_size < 2 || _data[0] != 0xFF || _data[1] != MARKER_SOI)
+	{
+		throw std::runtime_error("JPEG file does not start with an SOI marker.");
+	}
+
+	size_t offset = 2;
+	bool reading = true;
+
+	while (reading)
+	{
+		JPEGSegment segment = ReadSegment(_data, _size, offset);
+
+		switch (segment.marker)
+		{
+			case MARKER_SOF0:
+			case MARKER_SOF1:	Segment_SOF(segment, _state);	break;
+			case MARKER_DHT:	Segment_DHT(segment, _state);	break;
+			case MARKER_DQT:	Segment_DQT(segment, _state);	break;
+			case MARKER_DRI:	Segment_DRI(segment, _state);	break;
+			case MARKER_APP14:	Segment_APP14(segment, _state);	break;
+
+			case MARKER_SOS:	offset = DecodeScan(segment, _data, _size, _state);	break;
+			case MARKER_EOI:	reading = false;	break;
+
+			case MARKER_SOI:
+			{
+				throw std::runtime_error("Unexpected SOI marker inside JPEG file.");
+			}
+
+			case MARKER_SOF2:
+			{
+				throw std::runtime_error("Progressive JPEGs are not supported.");
+			}
+
+			default:
+			{
+				// The remaining SOFs, except JPG (0xC8) and DAC (0xCC) which aren't frames
+				if ((segment.marker & 0xF0) == 0xC0 && segment.marker != 0xC4 && segment.marker != 0xC8 && segment.marker != 0xCC)
+				{
+					throw std::runtime_error("Only baseline and extended sequential Huffman coded JPEGs are supported.");
+				}
+
+				break; // APPn, COM and the like
+			}
+		}
+	}
+
+	if (!_state.scanRead)
+	{
+		throw std::runtime_error("No SOS segment present in JPEG file.");
+	}
+
+	ConvertRows(_state);
+}
+
+JPEGSegment JPEGProperties::ReadSegment(const unsigned char* _data, size_t _size, size_t& _offset)
+{
+	JPEGSegment segment = JPEGSegment();
+
+	// Skips to the next marker, past fill bytes, stuffed zeros and restart markers. Running out of file counts as EOI,
+	// plenty of files are cut off after their last scan
+	while (true)
+	{
+		while (_offset < _size && _data[_offset] != 0xFF) _offset++;
+		while (_offset < _size && _data[_offset] == 0xFF) _offset++;
+
+		if (_offset >= _size)
+		{
+			segment.marker = MARKER_EOI;
+			return segment;
+		}
+
+		segment.marker = _data[_offset++];
+
+		if (segment.marker != 0x00 && segment.marker != MARKER_TEM && !(segment.marker >= MARKER_RST0 && segment.marker <= MARKER_RST7))
+			break;
+	}
+
+	if (segment.marker == MARKER_SOI || segment.marker == MARKER_EOI)
+		return segment;
+
+	if (_offset + 2 > _size)
+	{
+		throw std::runtime_error("Unexpected end of JPEG file while reading segment.");
+	}
+
+	size_t length = ReadUInt16(_data + _offset);
+
+	if (length < 2 || _offset + length > _size)
+	{
+		throw std::runtime_error("Unexpected end of JPEG file while reading segment.");
+	}
+
+	segment.data = _data + _offset + 2;
+	segment.length = length - 2;
+	_offset += length;
+
+	return segment;
+}
+
+void JPEGProperties::Segment_SOF(const JPEGSegment& _segment, JPEGDecodeState& _state)
+{
+	if (_state.frameRead)
+	{
+		throw std::runtime_error("JPEG file has more than one SOF segment.");
+	}
+
+	const unsigned char* data = _segment.data;
+
+	if (_segment.length < 6)
+	{
+		throw std::runtime_error("SOF segment is too short.");
+	}
+
+	if (data[0] != 8)
+	{
+		throw std::runtime_error("Only 8-bit JPEGs are supported, this one is " + std::to_string(data[0]) + "-bit.");
+	}
+
+	const unsigned int imageHeight = ReadUInt16(data + 1), imageWidth = ReadUInt16(data + 3);
+	componentCount = data[5];
+
+	if (imageWidth == 0 || imageHeight == 0)
+	{
+		throw std::runtime_error("SOF segment has a zero width or height.");
+	}
+
+	if (componentCount != 1 && componentCount != 3)
+	{
+		throw std::runtime_error("Only gray and 3 component colour JPEGs are supported, this one has " + std::to_string(componentCount) + " components.");
+	}
+
+	if (_segment.length < 6 + 3 * (size_t)componentCount)
+	{
+		throw std::runtime_error("SOF segment is too short.");
+	}
+
+	unsigned int mcuBlocks = 0;
+
+	for (unsigned int i = 0; i < componentCount; i++)
+	{
+		JPEGComponent& component = _state.components[i];
+		component.id = data[6 + i * 3];
+		component.h = data[7 + i * 3] >> 4;
+		component.v = data[7 + i * 3] & 15;
+		component.quantTable = data[8 + i * 3];
+
+		if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3)
+		{
+			throw std::runtime_error("SOF segment has invalid sampling factors or quantisation table for component " + std::to_string(i) + ".");
+		}
+
+		_state.hMax = std::max(_state.hMax, (unsigned int)component.h);
+		_state.vMax = std::max(_state.vMax, (unsigned int)component.v);
+		mcuBlocks += component.h * component.v;
+	}
+
+	if (componentCount > 1 && mcuBlocks > MAX_MCU_BLOCKS)
+	{
+		throw std::runtime_error("SOF segment sampling factors give more than " + std::to_string(MAX_MCU_BLOCKS) + " blocks per MCU.");
+	}
+
+	_state.mcusX = (imageWidth + _state.hMax * 8 - 1) / (_state.hMax * 8);
+	_state.mcusY = (imageHeight + _state.vMax * 8 - 1) / (_state.vMax * 8);
+
+	// Rounded up, like every component's size
+	width = (imageWidth + _state.scale - 1) / _state.scale;
+	height = (imageHeight + _state.scale - 1) / _state.scale;
+
+	const unsigned int smallestBlock = 8 / _state.scale;
+
+	for (unsigned int i = 0; i < componentCount; i++)
+	{
+		JPEGComponent& component = _state.components[i];
+
+		if (_state.hMax % component.h != 0 || _state.vMax % component.v != 0)
+		{
+			throw std::runtime_error("Unsupported JPEG chroma subsampling, sampling factors must divide the largest ones.");
+		}
+
+		component.blocksX = ((imageWidth * component.h + _state.hMax - 1) / _state.hMax + 7) / 8;
+		component.blocksY = ((imageHeight * component.v + _state.vMax - 1) / _state.vMax + 7) / 8;
+
+		// As libjpeg does, subsampled components are transformed at up to twice the size while that still leaves
+		// a whole number of output pixels per sample both ways, so upsampling them is cheaper or not needed at all
+		unsigned int blockSize = smallestBlock;
+
+		while (blockSize < 8 && (_state.hMax * smallestBlock) % (component.h * blockSize * 2) == 0 &&
+			(_state.vMax * smallestBlock) % (component.v * blockSize * 2) == 0)
+		{
+			blockSize *= 2;
+		}
+
+		component.blockSize = blockSize;
+		component.upsampleX = (_state.hMax * smallestBlock) / (component.h * blockSize);
+		component.upsampleY = (_state.vMax * smallestBlock) / (component.v * blockSize);
+
+		component.width = (imageWidth * component.h * blockSize + _state.hMax * 8 - 1) / (_state.hMax * 8);
+		component.height = (imageHeight * component.v * blockSize + _state.vMax * 8 - 1) / (_state.vMax * 8);
+
+		// libjpeg only interpolates across rows more than 2 samples wide, narrower ones are replicated
+		component.fancyUpsample = (smallestBlock > 1 && (component.upsampleX != 2 || component.width > 2));
+
+		component.stride = (size_t)_state.mcusX * component.h * blockSize;
+		component.plane.resize(component.stride * _state.mcusY * component.v * blockSize);
+	}
+
+	_state.frameRead = true;
+}
+
+void JPEGProperties::Segment_DHT(const JPEGSegment& _segment, JPEGDecodeState& _state)
+{
+	const unsigned char* data = _segment.data;
+
+	for (size_t offset = 0; offset < _segment.length;)
+	{
+		if (offset + 17 > _segment.length)
+		{
+			throw std::runtime_error("DHT segment is too short.");
+		}
+
+		unsigned int tableClass = data[offset] >> 4, tableID = data[offset] & 15;
+
+		if (tableClass > 1 || tableID > 3)
+		{
+			throw std::runtime_error("DHT segment has an invalid table class or ID.");
+		}
+
+		const unsigned char* counts = data + offset + 1;
+		unsigned int symbolCount = 0;
+
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			symbolCount += counts[i];
+		}
+
+		if (symbolCount > 256 || offset + 17 + symbolCount > _segment.length)
+		{
+			throw std::runtime_error("DHT segment is too short.");
+		}
+
+		JPEGHuffmanTable& table = (tableClass == 0) ? _state.dcTables[tableID] : _state.acTables[tableID];
+		BuildHuffmanTable(counts, data + offset + 17, symbolCount, table);
+
+		offset += 17 + symbolCount;
+	}
+}
+
+void JPEGProperties::Segment_DQT(const JPEGSegment& _segment, JPEGDecodeState& _state)
+{
+	const unsigned char* data = _segment.data;
+
+	for (size_t offset = 0; offset < _segment.length;)
+	{
+		unsigned int precision = data[offset] >> 4, tableID = data[offset] & 15;
+
+		if (precision > 1 || tableID > 3)
+		{
+			throw std::runtime_error("DQT segment has an invalid precision or table ID.");
+		}
+
+		const size_t tableBytes = precision ? 128 : 64;
+
+		if (offset + 1 + tableBytes > _segment.length)
+		{
+			throw std::runtime_error("DQT segment is too short.");
+		}
+
+		for (unsigned int i = 0; i < 64; i++)
+		{
+			_state.quantTables[tableID][i] = (unsigned short)(precision ? ReadUInt16(data + offset + 1 + i * 2) : data[offset + 1 + i]);
+		}
+
+		_state.quantDefined[tableID] = true;
+		offset += 1 + tableBytes;
+	}
+}
+
+void JPEGProperties::Segment_DRI(const JPEGSegment& _segment, JPEGDecodeState& _state)
+{
+	if (_segment.length < 2)
+	{
+		throw std::runtime_error("DRI segment is too short.");
+	}
+
+	_state.restartInterval = ReadUInt16(_segment.data);
+}
+
+void JPEGProperties::Segment_APP14(const JPEGSegment& _segment, JPEGDecodeState& _state)
+{
+	// Adobe's, says whether 3 components are YCbCr (1) or RGB (0)
+	if (_segment.length >= 12 && memcmp(_segment.data, "Adobe", 5) == 0)
+	{
+		_state.adobeTransform = _segment.data[11];
+	}
+}
+
+size_t JPEGProperties::DecodeScan(const JPEGSegment& _segment, const unsigned char* _data, size_t _size, JPEGDecodeState& _state)
+{
+	if (!_state.frameRead)
+	{
+		throw std::runtime_error("SOS segment found before a valid SOF segment.");
+	}
+
+	const unsigned char* data = _segment.data;
+	const unsigned int scanCount = (_segment.length > 0) ? data[0] : 0;
+
+	if (scanCount < 1 || scanCount > componentCount || _segment.length < 4 + 2 * (size_t)scanCount)
+	{
+		throw std::runtime_error("SOS segment is invalid.");
+	}
+
+	JPEGScan scan = JPEGScan();
+	scan.componentCount = scanCount;
+
+	for (unsigned int i = 0; i < scanCount; i++)
+	{
+		for (unsigned int c = 0; c < componentCount; c++)
+		{
+			if (_state.components[c].id == data[1 + i * 2])
+			{
+				scan.components[i] = &_state.components[c];
+			}
+		}
+
+		JPEGComponent* component = scan.components[i];
+
+		if (component == nullptr || std::find(scan.components, scan.components + i, component) != scan.components + i)
+		{
+			throw std::runtime_error("SOS segment names a component that isn't in the frame, or names one twice.");
+		}
+
+		component->dcTable = data[2 + i * 2] >> 4;
+		component->acTable = data[2 + i * 2] & 15;
+
+		if (component->dcTable > 3 || component->acTable > 3 || !_state.dcTables[component->dcTable].defined ||
+			!_state.acTables[component->acTable].defined || !_state.quantDefined[component->quantTable])
+		{
+			throw std::runtime_error("SOS segment uses a Huffman or quantisation table that hasn't been defined.");
+		}
+	}
+
+	const unsigned char* selection = data + 1 + scanCount * 2;
+
+	if (selection[0] != 0 || selection[1] != 63 || selection[2] != 0)
+	{
+		throw std::runtime_error("SOS segment uses spectral selection or successive approximation, which only progressive JPEGs have.");
+	}
+
+	// An interleaved scan codes MCUs holding blocks of every component, a single component scan codes its blocks one by one
+	scan.unitsX = _state.mcusX;
+	unsigned int unitsY = _state.mcusY;
+
+	if (scanCount == 1)
+	{
+		scan.unitsX = scan.components[0]->blocksX;
+		unitsY = scan.components[0]->blocksY;
+	}
+
+	scan.unitCount = scan.unitsX * unitsY;
+
+	const size_t dataOffset = (size_t)(_segment.data + _segment.length - _data);
+
+	// Restart intervals are independent of each other, so with enough of them they're decoded in parallel,
+	// a few consecutive intervals per task. Each task writes only the blocks of its own units
+	ThreadPool& pool = ThreadPool::GetShared();
+	const unsigned int interval = _state.restartInterval;
+
+	if (_state.pooled && interval != 0 && pool.GetThreadCount() > 0 && scan.unitCount >= DECODE_TASK_UNITS * 2)
+	{
+		const unsigned int intervalCount = (scan.unitCount + interval - 1) / interval;
+
+		std::vector<size_t> starts;
+		size_t end = 0;
+
+		if (intervalCount > 1 && FindRestartIntervals(_data, _size, dataOffset, intervalCount, starts, end))
+		{
+			const unsigned int intervalsPerTask = std::max((DECODE_TASK_UNITS + interval - 1) / interval,
+				(intervalCount + (pool.GetThreadCount() + 1) * 4 - 1) / ((pool.GetThreadCount() + 1) * 4));
+
+			std::exception_ptr error;
+			std::mutex errorMutex;
+
+			{
+				TaskGroup tasks(pool);
+
+				for (unsigned int first = 0; first < intervalCount; first += intervalsPerTask)
+				{
+					tasks.Run([&, first]()
+					{
+						try
+						{
+							JPEGBitReader bits = JPEGBitReader();
+							bits.data = _data;
+							bits.size = _size;
+							bits.offset = starts[first];
+
+							DecodeUnits(bits, _state, scan, first * interval, std::min(scan.unitCount, (first + intervalsPerTask) * interval));
+						}
+						catch (...)
+						{
+							std::lock_guard<std::mutex> lock(errorMutex);
+
+							if (!error)
+							{
+								error = std::current_exception();
+							}
+						}
+					});
+				}
+			}
+
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+
+			_state.scanRead = true;
+
+			return end;
+		}
+	}
+
+	JPEGBitReader bits = JPEGBitReader();
+	bits.data = _data;
+	bits.size = _size;
+	bits.offset = dataOffset;
+
+	DecodeUnits(bits, _state, scan, 0, scan.unitCount);
+
+	_state.scanRead = true;
+
+	return bits.offset;
+}
+
+void JPEGProperties::ConvertRows(JPEGDecodeState& _state)
+{
+	const size_t bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+
+	pixels.assign((size_t)width * height * bytesPerPixel, 0);
+	unsigned char* out = pixels.GetWritableData();
+
+	// RGBA8 is written straight into pixels, other formats are converted from an RGBA8 row by the PNG converter for 8-bit RGBA
+	PNGScanlineConverter convert = nullptr;
+	PNGConvertParams params = PNGConvertParams();
+	std::vector<unsigned char> sampleTable;
+
+	if (pixelFormat != RGBA8)
+	{
+		sampleTable.resize(PNGConverters::GetSampleTableSize(8, pixelFormat));
+		PNGConverters::BuildSampleTable(8, pixelFormat, sampleTable.data());
+
+		params.sampleTable = params.alphaTable = sampleTable.data();
+		convert = PNGConverters::GetConverter(6, 8, pixelFormat, true);
+	}
+
+	// 3 components are YCbCr unless an Adobe marker says otherwise, or without one, their IDs spell out RGB
+	const JPEGComponent* components = _state.components;
+	const bool isRGB = (componentCount == 3) && (_state.adobeTransform == 0 ||
+		(_state.adobeTransform < 0 && components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B'));
+
+	// Rows only read the decoded planes, so bands of them convert independently, each with its own buffers
+	auto convertBand = [&](unsigned int _firstRow, unsigned int _lastRow)
+	{
+		// Full resolution rows of subsampled components
+		std::vector<unsigned char> scratch[3], rgbaRow(convert ? (size_t)width * 4 : 0);
+
+		for (unsigned int c = 0; c < componentCount; c++)
+		{
+			scratch[c].resize((size_t)_state.mcusX * _state.hMax * 8);
+		}
+
+		for (unsigned int y = _firstRow; y < _lastRow; y++)
+		{
+			unsigned char* row = convert ? rgbaRow.data() : out + (size_t)y * width * 4;
+
+			const unsigned char* samples[3] = {};
+
+			for (unsigned int c = 0; c < componentCount; c++)
+			{
+				samples[c] = GetComponentRow(components[c], y, scratch[c].data());
+			}
+
+			if (componentCount == 1)
+			{
+				JPEGKernels::GrayToRGBA(samples[0], row, width);
+			}
+			else if (isRGB)
+			{
+				for (unsigned int x = 0; x < width; x++)
+				{
+					row[x * 4] = samples[0][x];
+					row[x * 4 + 1] = samples[1][x];
+					row[x * 4 + 2] = samples[2][x];
+					row[x * 4 + 3] = 255;
+				}
+			}
+			else JPEGKernels::YCbCrToRGBA(samples[0], samples[1], samples[2], row, width);
+
+			if (convert)
+			{
+				convert(rgbaRow.data(), width, out + (size_t)y * width * bytesPerPixel, bytesPerPixel, params);
+			}
+		}
+	};
+
+	if (!_state.pooled || (size_t)width * height <= CONVERT_TASK_PIXELS)
+	{
+		convertBand(0, height);
+		return;
+	}
+
+	const unsigned int rowsPerTask = std::max(1u, CONVERT_TASK_PIXELS / width);
+	TaskGroup tasks;
+
+	for (unsigned int y = 0; y < height; y += rowsPerTask)
+	{
+		tasks.Run([&convertBand, y, rowsPerTask, this]() { convertBand(y, std::min(height, y + rowsPerTask)); });
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "DLLCommon.h"
+#include "PixelBuffer.h"
+#include "PixelFormat.h"
+
+#pragma warning(disable : 4251)
+#include <cstddef>
+
+struct JPEGDecodeState;
+
+// A marker segment, data points at the bytes after its length field.
+struct RENDERER_API JPEGSegment
+{
+	unsigned char marker;
+	const unsigned char* data;
+	size_t length;
+};
+
+// Baseline JPEG, 8-bit Huffman coded sequential DCT, as gray or YCbCr (RGB with an Adobe marker saying so).
+// Chroma may be subsampled by any whole factor, 2x1 and 2x2 (4:2:2 and 4:2:0) and 1x2 are upsampled
+// the way libjpeg's fancy upsampling does it, anything else is replicated. Like libjpeg, 2x1 and 2x2 chroma only
+// 2 samples wide (after any scaling) is replicated too.
+// Progressive, lossless, arithmetic coded, 12-bit and CMYK files throw.
+class RENDERER_API JPEGProperties
+{
+public:
+	JPEGProperties();
+
+	// Decodes the whole image into pixels as _format. RGBA8 is written straight out by the colour conversion,
+	// other formats go through the PNG converters a row at a time.
+	// Scans with restart markers are decoded across the shared pool, and rows converted across it, unless _pooled is off.
+	// Callers already running on a pool worker must turn it off, for the same reason as PNGDecoder::SetPooledConversion.
+	// _scale 2, 4 or 8 decodes at 1/_scale the size (rounded up) with reduced inverse DCTs, full resolution is never
+	// reconstructed. width and height are the scaled size.
+	void LoadJPEG(const char* _filePath, PixelFormat _format = RGBA8, bool _pooled = true, unsigned int _scale = 1);
+
+protected:
+	void Load(const unsigned char* _data, size_t _size, JPEGDecodeState& _state);
+
+	JPEGSegment ReadSegment(const unsigned char* _data, size_t _size, size_t& _offset);
+
+	// Segment handlers
+
+	void Segment_SOF(const JPEGSegment& _segment, JPEGDecodeState& _state);
+	void Segment_DHT(const JPEGSegment& _segment, JPEGDecodeState& _state);
+	void Segment_DQT(const JPEGSegment& _segment, JPEGDecodeState& _state);
+	void Segment_DRI(const JPEGSegment& _segment, JPEGDecodeState& _state);
+	void Segment_APP14(const JPEGSegment& _segment, JPEGDecodeState& _state);
+
+	// Decodes the entropy coded data after an SOS segment, returns the offset of the first byte after it
+	size_t DecodeScan(const JPEGSegment& _segment, const unsigned char* _data, size_t _size, JPEGDecodeState& _state);
+
+	// Upsampling and colour conversion, once every scan is decoded
+	void ConvertRows(JPEGDecodeState& _state);
+
+public:
+	unsigned int width, height;
+	unsigned char componentCount; // 1 for gray, 3 for colour
+
+	PixelFormat pixelFormat;
+	PixelBuffer pixels; // width * height pixels laid out as pixelFormat, shared between copies
+};
@@ -0,0 +1,690 @@
+#include "JPEGKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#if defined(R2D_X86)
+#include <immintrin.h>
+#endif
+
+typedef void (*IDCTKernel)(const short* _block, unsigned char* _out, size_t _stride);
+typedef void (*IDCTPairKernel)(const short* _blockA, unsigned char* _outA, size_t _strideA, const short* _blockB, unsigned char* _outB, size_t _strideB);
+typedef void (*ColourKernel)(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count);
+
+struct KernelTable
+{
+	IDCTKernel idct;
+	IDCTPairKernel idctPair; // two blocks at once, nullptr without a wide enough instruction set
+	ColourKernel ycbcr;
+};
+
+static std::atomic<int> gSIMDLevel = { -1 }; // -1 until first use, then the level in use
+
+// IDCT constants, 12 fractional bits
+static constexpr int Fix(double _x)
+{
+	return (int)(_x * 4096 + 0.5);
+}
+
+// The multiplies are rotations of two inputs, each pair here is the multiplier of the first and second input.
+// Interleaving the inputs lets SSE2's madd do both multiplies and the add in one instruction.
+enum Rotation
+{
+	EVEN_T2,	// rows 2, 6
+	EVEN_T3,
+	ODD_Y0,		// rows 7, 3
+	ODD_Y2,
+	ODD_Y1,		// rows 5, 1
+	ODD_Y3,
+	ODD_Y4,		// rows 1 + 7, 3 + 5
+	ODD_Y5,
+
+	TOTAL_ROTATIONS
+};
+
+static constexpr short ROTATIONS[TOTAL_ROTATIONS][2] = {
+	{ Fix(0.5411961), Fix(0.5411961) + Fix(-1.847759065) },
+	{ Fix(0.5411961) + Fix(0.765366865), Fix(0.5411961) },
+	{ Fix(-1.961570560) + Fix(0.298631336), Fix(-1.961570560) },
+	{ Fix(-1.961570560), Fix(-1.961570560) + Fix(3.072711026) },
+	{ Fix(-0.390180644) + Fix(2.053119869), Fix(-0.390180644) },
+	{ Fix(-0.390180644), Fix(-0.390180644) + Fix(1.501321110) },
+	{ Fix(1.175875602) + Fix(-0.899976223), Fix(1.175875602) },
+	{ Fix(1.175875602), Fix(1.175875602) + Fix(-2.562915447) }
+};
+
+// The column pass keeps 2 extra bits of precision, the row pass removes them and re-centres samples on 128
+static constexpr int COLUMN_BIAS = 1 << 9, COLUMN_SHIFT = 10;
+static constexpr int ROW_BIAS = (1 << 16) + (128 << 17), ROW_SHIFT = 17;
+
+// YCbCr -> RGB constants, 14 fractional bits
+static constexpr int COLOUR_BITS = 14, COLOUR_ROUND = 1 << (COLOUR_BITS - 1), Y_ONE = 1 << COLOUR_BITS;
+static constexpr int CR_R = 22970, CB_G = -5638, CR_G = -11700, CB_B = 29032; // 1.402, -0.34414, -0.71414, 1.772
+
+static inline unsigned char ClampSample(int _value)
+{
+	return (unsigned char)std::min(255, std::max(0, _value));
+}
+
+// Scalar kernels, written to match the 16-bit SIMD lanes exactly: sums of two inputs wrap at 16 bits
+// and the column pass saturates to 16 bits before the row pass.
+
+static inline int Rotate(int _a, int _b, Rotation _rotation)
+{
+	return _a * ROTATIONS[_rotation][0] + _b * ROTATIONS[_rotation][1];
+}
+
+static inline void IDCTPass(const short* _s, size_t _step, int _bias, int _shift, int* _out)
+{
+	const int s0 = _s[0], s1 = _s[_step], s2 = _s[_step * 2], s3 = _s[_step * 3],
+		s4 = _s[_step * 4], s5 = _s[_step * 5], s6 = _s[_step * 6], s7 = _s[_step * 7];
+
+	// Even part
+	int t2 = Rotate(s2, s6, EVEN_T2);
+	int t3 = Rotate(s2, s6, EVEN_T3);
+	int t0 = (short)(s0 + s4) * 4096;
+	int t1 = (short)(s0 - s4) * 4096;
+
+	int x0 = t0 + t3 + _bias, x3 = t0 - t3 + _bias;
+	int x1 = t1 + t2 + _bias, x2 = t1 - t2 + _bias;
+
+	// Odd part
+	short sum17 = (short)(s1 + s7), sum35 = (short)(s3 + s5);
+	int y4 = Rotate(sum17, sum35, ODD_Y4), y5 = Rotate(sum17, sum35, ODD_Y5);
+
+	int x4 = Rotate(s7, s3, ODD_Y0) + y4;
+	int x5 = Rotate(s5, s1, ODD_Y1) + y5;
+	int x6 = Rotate(s7, s3, ODD_Y2) + y5;
+	int x7 = Rotate(s5, s1, ODD_Y3) + y4;
+
+	_out[0] = (x0 + x7) >> _shift;	_out[7] = (x0 - x7) >> _shift;
+	_out[1] = (x1 + x6) >> _shift;	_out[6] = (x1 - x6) >> _shift;
+	_out[2] = (x2 + x5) >> _shift;	_out[5] = (x2 - x5) >> _shift;
+	_out[3] = (x3 + x4) >> _shift;	_out[4] = (x3 - x4) >> _shift;
+}
+
+static void IDCTScalar(const short* _block, unsigned char* _out, size_t _stride)
+{
+	short columns[64];
+	int pass[8];
+
+	for (unsigned int c = 0; c < 8; c++)
+	{
+		IDCTPass(_block + c, 8, COLUMN_BIAS, COLUMN_SHIFT, pass);
+
+		for (unsigned int k = 0; k < 8; k++)
+		{
+			columns[k * 8 + c] = (short)std::min(32767, std::max(-32768, pass[k]));
+		}
+	}
+
+	for (unsigned int r = 0; r < 8; r++, _out += _stride)
+	{
+		IDCTPass(columns + r * 8, 1, ROW_BIAS, ROW_SHIFT, pass);
+
+		for (unsigned int k = 0; k < 8; k++)
+		{
+			_out[k] = ClampSample(pass[k]);
+		}
+	}
+}
+
+// Reduced transforms for downscaled decodes, libjpeg's: each output sample approximates the average of the samples
+// the full transform would give in its part of the block. 13 fractional bits with 2 extra kept between passes.
+// Plain C, they're a small part of a downscaled decode, with 64-bit sums so no coefficients can overflow them
+static constexpr int REDUCED_BITS = 13, REDUCED_PASS_BITS = 2;
+
+static constexpr std::int64_t FixReduced(double _x)
+{
+	return (std::int64_t)(_x * (1 << REDUCED_BITS) + 0.5);
+}
+
+static inline int Descale(std::int64_t _x, int _shift)
+{
+	return (int)((_x + ((std::int64_t)1 << (_shift - 1))) >> _shift);
+}
+
+// 4 point pass over coefficients 0-3, 5-7 of a column or row, 4 is never needed
+template <typename T>
+static inline void ReducedPass4(const T* _s, size_t _step, int _shift, int* _out)
+{
+	const std::int64_t dc = (std::int64_t)_s[0] * ((std::int64_t)1 << (REDUCED_BITS + 1));
+	const std::int64_t rotated = _s[_step * 2] * FixReduced(1.847759065) - _s[_step * 6] * FixReduced(0.765366865);
+	const std::int64_t even0 = dc + rotated, even1 = dc - rotated;
+
+	const std::int64_t s1 = _s[_step], s3 = _s[_step * 3], s5 = _s[_step * 5], s7 = _s[_step * 7];
+	const std::int64_t odd0 = -s7 * FixReduced(0.211164243) + s5 * FixReduced(1.451774981) - s3 * FixReduced(2.172734803) + s1 * FixReduced(1.061594337);
+	const std::int64_t odd1 = -s7 * FixReduced(0.509795579) - s5 * FixReduced(0.601344887) + s3 * FixReduced(0.899976223) + s1 * FixReduced(2.562915447);
+
+	_out[0] = Descale(even0 + odd1, _shift);	_out[3] = Descale(even0 - odd1, _shift);
+	_out[1] = Descale(even1 + odd0, _shift);	_out[2] = Descale(even1 - odd0, _shift);
+}
+
+// 2 point pass over coefficients 0, 1, 3, 5 and 7
+template <typename T>
+static inline void ReducedPass2(const T* _s, size_t _step, int _shift, int* _out)
+{
+	const std::int64_t dc = (std::int64_t)_s[0] * ((std::int64_t)1 << (REDUCED_BITS + 2));
+	const std::int64_t odd = -_s[_step * 7] * FixReduced(0.720959822) + _s[_step * 5] * FixReduced(0.850430095)
+		- _s[_step * 3] * FixReduced(1.272758580) + _s[_step] * FixReduced(3.624509785);
+
+	_out[0] = Descale(dc + odd, _shift);
+	_out[1] = Descale(dc - odd, _shift);
+}
+
+static void IDCT4x4Scalar(const short* _block, unsigned char* _out, size_t _stride)
+{
+	int columns[8 * 4], pass[4];
+
+	for (unsigned int c = 0; c < 8; c++)
+	{
+		if (c == 4)
+			continue;
+
+		const short* column = _block + c;
+
+		// Most columns have nothing but their first coefficient, which the pass just scales
+		if ((column[8] | column[16] | column[24] | column[40] | column[48] | column[56]) == 0)
+		{
+			columns[c] = columns[8 + c] = columns[16 + c] = columns[24 + c] = column[0] * (1 << REDUCED_PASS_BITS);
+			continue;
+		}
+
+		ReducedPass4(column, 8, REDUCED_BITS - REDUCED_PASS_BITS + 1, pass);
+
+		for (unsigned int k = 0; k < 4; k++)
+		{
+			columns[k * 8 + c] = pass[k];
+		}
+	}
+
+	for (unsigned int r = 0; r < 4; r++, _out += _stride)
+	{
+		ReducedPass4(columns + r * 8, 1, REDUCED_BITS + REDUCED_PASS_BITS + 3 + 1, pass);
+
+		for (unsigned int k = 0; k < 4; k++)
+		{
+			_out[k] = ClampSample(pass[k] + 128);
+		}
+	}
+}
+
+static void IDCT2x2Scalar(const short* _block, unsigned char* _out, size_t _stride)
+{
+	int columns[8 * 2], pass[2];
+
+	for (unsigned int c = 0; c < 8; c++)
+	{
+		if (c == 2 || c == 4 || c == 6)
+			continue;
+
+		const short* column = _block + c;
+
+		if ((column[8] | column[24] | column[40] | column[56]) == 0)
+		{
+			columns[c] = columns[8 + c] = column[0] * (1 << REDUCED_PASS_BITS);
+			continue;
+		}
+
+		ReducedPass2(column, 8, REDUCED_BITS - REDUCED_PASS_BITS + 2, pass);
+
+		columns[c] = pass[0];
+		columns[8 + c] = pass[1];
+	}
+
+	for (unsigned int r = 0; r < 2; r++, _out += _stride)
+	{
+		ReducedPass2(columns + r * 8, 1, REDUCED_BITS + REDUCED_PASS_BITS + 3 + 2, pass);
+
+		_out[0] = ClampSample(pass[0] + 128);
+		_out[1] = ClampSample(pass[1] + 128);
+	}
+}
+
+// The block's mean, which is all the DC coefficient holds
+static void IDCT1x1Scalar(const short* _block, unsigned char* _out, size_t)
+{
+	_out[0] = ClampSample(Descale(_block[0], 3) + 128);
+}
+
+static void YCbCrToRGBAScalar(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count)
+{
+	for (unsigned int i = 0; i < _count; i++, _dst += 4)
+	{
+		int y = _y[i] * Y_ONE + COLOUR_ROUND, cb = _cb[i] - 128, cr = _cr[i] - 128;
+
+		_dst[0] = ClampSample((y + cr * CR_R) >> COLOUR_BITS);
+		_dst[1] = ClampSample((y + cb * CB_G + cr * CR_G) >> COLOUR_BITS);
+		_dst[2] = ClampSample((y + cb * CB_B) >> COLOUR_BITS);
+		_dst[3] = 255;
+	}
+}
+
+#if defined(R2D_X86)
+
+// Eight 32-bit results of a 16-bit vector, low and high halves
+struct Wide128
+{
+	__m128i lo, hi;
+};
+
+R2D_TARGET("sse2") static inline __m128i LoadRotation128(Rotation _rotation)
+{
+	return _mm_set1_epi32((int)(((unsigned int)(unsigned short)ROTATIONS[_rotation][1] << 16) | (unsigned short)ROTATIONS[_rotation][0]));
+}
+
+R2D_TARGET("sse2") static inline Wide128 Rotate(__m128i _a, __m128i _b, __m128i _rotation)
+{
+	return { _mm_madd_epi16(_mm_unpacklo_epi16(_a, _b), _rotation), _mm_madd_epi16(_mm_unpackhi_epi16(_a, _b), _rotation) };
+}
+
+// _x * 4096
+R2D_TARGET("sse2") static inline Wide128 Widen(__m128i _x)
+{
+	return { _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), _x), 4), _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), _x), 4) };
+}
+
+R2D_TARGET("sse2") static inline Wide128 Add(const Wide128& _a, const Wide128& _b)
+{
+	return { _mm_add_epi32(_a.lo, _b.lo), _mm_add_epi32(_a.hi, _b.hi) };
+}
+
+R2D_TARGET("sse2") static inline Wide128 Sub(const Wide128& _a, const Wide128& _b)
+{
+	return { _mm_sub_epi32(_a.lo, _b.lo), _mm_sub_epi32(_a.hi, _b.hi) };
+}
+
+// (_a + _bias +- _b) >> SHIFT, saturated back to 16 bits
+template <int SHIFT>
+R2D_TARGET("sse2") static inline void Butterfly(const Wide128& _a, const Wide128& _b, __m128i _bias, __m128i& _sum, __m128i& _difference)
+{
+	__m128i lo = _mm_add_epi32(_a.lo, _bias), hi = _mm_add_epi32(_a.hi, _bias);
+
+	_sum = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, _b.lo), SHIFT), _mm_srai_epi32(_mm_add_epi32(hi, _b.hi), SHIFT));
+	_difference = _mm_packs_epi32(_mm_srai_epi32(_mm_sub_epi32(lo, _b.lo), SHIFT), _mm_srai_epi32(_mm_sub_epi32(hi, _b.hi), SHIFT));
+}
+
+// The same pass as IDCTPass, on all eight columns (or rows, once transposed) at once
+template <int SHIFT>
+R2D_TARGET("sse2") static inline void IDCTPassSSE2(__m128i* _rows, __m128i _bias)
+{
+	Wide128 t2 = Rotate(_rows[2], _rows[6], LoadRotation128(EVEN_T2));
+	Wide128 t3 = Rotate(_rows[2], _rows[6], LoadRotation128(EVEN_T3));
+	Wide128 t0 = Widen(_mm_add_epi16(_rows[0], _rows[4]));
+	Wide128 t1 = Widen(_mm_sub_epi16(_rows[0], _rows[4]));
+
+	Wide128 x0 = Add(t0, t3), x3 = Sub(t0, t3), x1 = Add(t1, t2), x2 = Sub(t1, t2);
+
+	__m128i sum17 = _mm_add_epi16(_rows[1], _rows[7]), sum35 = _mm_add_epi16(_rows[3], _rows[5]);
+	Wide128 y4 = Rotate(sum17, sum35, LoadRotation128(ODD_Y4)), y5 = Rotate(sum17, sum35, LoadRotation128(ODD_Y5));
+
+	Wide128 x4 = Add(Rotate(_rows[7], _rows[3], LoadRotation128(ODD_Y0)), y4);
+	Wide128 x5 = Add(Rotate(_rows[5], _rows[1], LoadRotation128(ODD_Y1)), y5);
+	Wide128 x6 = Add(Rotate(_rows[7], _rows[3], LoadRotation128(ODD_Y2)), y5);
+	Wide128 x7 = Add(Rotate(_rows[5], _rows[1], LoadRotation128(ODD_Y3)), y4);
+
+	Butterfly<SHIFT>(x0, x7, _bias, _rows[0], _rows[7]);
+	Butterfly<SHIFT>(x1, x6, _bias, _rows[1], _rows[6]);
+	Butterfly<SHIFT>(x2, x5, _bias, _rows[2], _rows[5]);
+	Butterfly<SHIFT>(x3, x4, _bias, _rows[3], _rows[4]);
+}
+
+R2D_TARGET("sse2") static inline void Interleave16(__m128i& _a, __m128i& _b)
+{
+	__m128i a = _a;
+	_a = _mm_unpacklo_epi16(a, _b);
+	_b = _mm_unpackhi_epi16(a, _b);
+}
+
+R2D_TARGET("sse2") static inline void Interleave8(__m128i& _a, __m128i& _b)
+{
+	__m128i a = _a;
+	_a = _mm_unpacklo_epi8(a, _b);
+	_b = _mm_unpackhi_epi8(a, _b);
+}
+
+R2D_TARGET("sse2") static void IDCTSSE2(const short* _block, unsigned char* _out, size_t _stride)
+{
+	__m128i rows[8];
+
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		rows[i] = _mm_loadu_si128((const __m128i*)(_block + i * 8));
+	}
+
+	IDCTPassSSE2<COLUMN_SHIFT>(rows, _mm_set1_epi32(COLUMN_BIAS));
+
+	// 16-bit transpose, so the row pass works across the rows instead
+	Interleave16(rows[0], rows[4]); Interleave16(rows[1], rows[5]); Interleave16(rows[2], rows[6]); Interleave16(rows[3], rows[7]);
+	Interleave16(rows[0], rows[2]); Interleave16(rows[1], rows[3]); Interleave16(rows[4], rows[6]); Interleave16(rows[5], rows[7]);
+	Interleave16(rows[0], rows[1]); Interleave16(rows[2], rows[3]); Interleave16(rows[4], rows[5]); Interleave16(rows[6], rows[7]);
+
+	IDCTPassSSE2<ROW_SHIFT>(rows, _mm_set1_epi32(ROW_BIAS));
+
+	// rows[] now hold output columns, pack to bytes and transpose back
+	__m128i p0 = _mm_packus_epi16(rows[0], rows[1]), p1 = _mm_packus_epi16(rows[2], rows[3]);
+	__m128i p2 = _mm_packus_epi16(rows[4], rows[5]), p3 = _mm_packus_epi16(rows[6], rows[7]);
+
+	Interleave8(p0, p2); Interleave8(p1, p3);
+	Interleave8(p0, p1); Interleave8(p2, p3);
+	Interleave8(p0, p2); Interleave8(p1, p3);
+
+	// Two output rows in each
+	const __m128i outRows[4] = { p0, p2, p1, p3 };
+
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		_mm_storel_epi64((__m128i*)_out, outRows[i]);					_out += _stride;
+		_mm_storel_epi64((__m128i*)_out, _mm_shuffle_epi32(outRows[i], 0x4e));	_out += _stride;
+	}
+}
+
+R2D_TARGET("sse2") static inline __m128i DescaleColour(__m128i _lo, __m128i _hi, __m128i _round)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_lo, _round), COLOUR_BITS), _mm_srai_epi32(_mm_add_epi32(_hi, _round), COLOUR_BITS));
+}
+
+R2D_TARGET("sse2") static void YCbCrToRGBASSE2(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count)
+{
+	const __m128i zero = _mm_setzero_si128(), centre = _mm_set1_epi16(128), alpha = _mm_set1_epi8(-1);
+	const __m128i round = _mm_set1_epi32(COLOUR_ROUND);
+
+	// (Cr, Y) -> R, (Cb, Cr) -> G less Y, (Cb, Y) -> B
+	const __m128i rotateR = _mm_set1_epi32((Y_ONE << 16) | (unsigned short)CR_R);
+	const __m128i rotateG = _mm_set1_epi32((int)(((unsigned int)(unsigned short)CR_G << 16) | (unsigned short)CB_G));
+	const __m128i rotateB = _mm_set1_epi32((Y_ONE << 16) | (unsigned short)CB_B);
+
+	unsigned int i = 0;
+
+	for (; i + 8 <= _count; i += 8)
+	{
+		__m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(_y + i)), zero);
+		__m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(_cb + i)), zero), centre);
+		__m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(_cr + i)), zero), centre);
+
+		Wide128 r = Rotate(cr, y, rotateR);
+		Wide128 g = Add(Rotate(cb, cr, rotateG), { _mm_slli_epi32(_mm_unpacklo_epi16(y, zero), COLOUR_BITS), _mm_slli_epi32(_mm_unpackhi_epi16(y, zero), COLOUR_BITS) });
+		Wide128 b = Rotate(cb, y, rotateB);
+
+		__m128i r8 = _mm_packus_epi16(DescaleColour(r.lo, r.hi, round), zero);
+		__m128i g8 = _mm_packus_epi16(DescaleColour(g.lo, g.hi, round), zero);
+		__m128i b8 = _mm_packus_epi16(DescaleColour(b.lo, b.hi, round), zero);
+
+		__m128i rg = _mm_unpacklo_epi8(r8, g8), ba = _mm_unpacklo_epi8(b8, alpha);
+
+		_mm_storeu_si128((__m128i*)(_dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(_dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+
+	YCbCrToRGBAScalar(_y + i, _cb + i, _cr + i, _dst + i * 4, _count - i);
+}
+
+// AVX2 runs the SSE2 IDCT on two blocks at once, one per 128-bit lane, every instruction it needs stays within a lane
+
+struct Wide256
+{
+	__m256i lo, hi;
+};
+
+R2D_TARGET("avx2") static inline __m256i LoadRotation256(Rotation _rotation)
+{
+	return _mm256_set1_epi32((int)(((unsigned int)(unsigned short)ROTATIONS[_rotation][1] << 16) | (unsigned short)ROTATIONS[_rotation][0]));
+}
+
+R2D_TARGET("avx2") static inline Wide256 Rotate(__m256i _a, __m256i _b, __m256i _rotation)
+{
+	return { _mm256_madd_epi16(_mm256_unpacklo_epi16(_a, _b), _rotation), _mm256_madd_epi16(_mm256_unpackhi_epi16(_a, _b), _rotation) };
+}
+
+R2D_TARGET("avx2") static inline Wide256 Widen(__m256i _x)
+{
+	return { _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), _x), 4), _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), _x), 4) };
+}
+
+R2D_TARGET("avx2") static inline Wide256 Add(const Wide256& _a, const Wide256& _b)
+{
+	return { _mm256_add_epi32(_a.lo, _b.lo), _mm256_add_epi32(_a.hi, _b.hi) };
+}
+
+R2D_TARGET("avx2") static inline Wide256 Sub(const Wide256& _a, const Wide256& _b)
+{
+	return { _mm256_sub_epi32(_a.lo, _b.lo), _mm256_sub_epi32(_a.hi, _b.hi) };
+}
+
+template <int SHIFT>
+R2D_TARGET("avx2") static inline void Butterfly(const Wide256& _a, const Wide256& _b, __m256i _bias, __m256i& _sum, __m256i& _difference)
+{
+	__m256i lo = _mm256_add_epi32(_a.lo, _bias), hi = _mm256_add_epi32(_a.hi, _bias);
+
+	_sum = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, _b.lo), SHIFT), _mm256_srai_epi32(_mm256_add_epi32(hi, _b.hi), SHIFT));
+	_difference = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_sub_epi32(lo, _b.lo), SHIFT), _mm256_srai_epi32(_mm256_sub_epi32(hi, _b.hi), SHIFT));
+}
+
+template <int SHIFT>
+R2D_TARGET("avx2") static inline void IDCTPassAVX2(__m256i* _rows, __m256i _bias)
+{
+	Wide256 t2 = Rotate(_rows[2], _rows[6], LoadRotation256(EVEN_T2));
+	Wide256 t3 = Rotate(_rows[2], _rows[6], LoadRotation256(EVEN_T3));
+	Wide256 t0 = Widen(_mm256_add_epi16(_rows[0], _rows[4]));
+	Wide256 t1 = Widen(_mm256_sub_epi16(_rows[0], _rows[4]));
+
+	Wide256 x0 = Add(t0, t3), x3 = Sub(t0, t3), x1 = Add(t1, t2), x2 = Sub(t1, t2);
+
+	__m256i sum17 = _mm256_add_epi16(_rows[1], _rows[7]), sum35 = _mm256_add_epi16(_rows[3], _rows[5]);
+	Wide256 y4 = Rotate(sum17, sum35, LoadRotation256(ODD_Y4)), y5 = Rotate(sum17, sum35, LoadRotation256(ODD_Y5));
+
+	Wide256 x4 = Add(Rotate(_rows[7], _rows[3], LoadRotation256(ODD_Y0)), y4);
+	Wide256 x5 = Add(Rotate(_rows[5], _rows[1], LoadRotation256(ODD_Y1)), y5);
+	Wide256 x6 = Add(Rotate(_rows[7], _rows[3], LoadRotation256(ODD_Y2)), y5);
+	Wide256 x7 = Add(Rotate(_rows[5], _rows[1], LoadRotation256(ODD_Y3)), y4);
+
+	Butterfly<SHIFT>(x0, x7, _bias, _rows[0], _rows[7]);
+	Butterfly<SHIFT>(x1, x6, _bias, _rows[1], _rows[6]);
+	Butterfly<SHIFT>(x2, x5, _bias, _rows[2], _rows[5]);
+	Butterfly<SHIFT>(x3, x4, _bias, _rows[3], _rows[4]);
+}
+
+R2D_TARGET("avx2") static inline void Interleave16(__m256i& _a, __m256i& _b)
+{
+	__m256i a = _a;
+	_a = _mm256_unpacklo_epi16(a, _b);
+	_b = _mm256_unpackhi_epi16(a, _b);
+}
+
+R2D_TARGET("avx2") static inline void Interleave8(__m256i& _a, __m256i& _b)
+{
+	__m256i a = _a;
+	_a = _mm256_unpacklo_epi8(a, _b);
+	_b = _mm256_unpackhi_epi8(a, _b);
+}
+
+R2D_TARGET("avx2") static void IDCTPairAVX2(const short* _blockA, unsigned char* _outA, size_t _strideA, const short* _blockB, unsigned char* _outB, size_t _strideB)
+{
+	__m256i rows[8];
+
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		rows[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(_blockA + i * 8))),
+			_mm_loadu_si128((const __m128i*)(_blockB + i * 8)), 1);
+	}
+
+	IDCTPassAVX2<COLUMN_SHIFT>(rows, _mm256_set1_epi32(COLUMN_BIAS));
+
+	Interleave16(rows[0], rows[4]); Interleave16(rows[1], rows[5]); Interleave16(rows[2], rows[6]); Interleave16(rows[3], rows[7]);
+	Interleave16(rows[0], rows[2]); Interleave16(rows[1], rows[3]); Interleave16(rows[4], rows[6]); Interleave16(rows[5], rows[7]);
+	Interleave16(rows[0], rows[1]); Interleave16(rows[2], rows[3]); Interleave16(rows[4], rows[5]); Interleave16(rows[6], rows[7]);
+
+	IDCTPassAVX2<ROW_SHIFT>(rows, _mm256_set1_epi32(ROW_BIAS));
+
+	__m256i p0 = _mm256_packus_epi16(rows[0], rows[1]), p1 = _mm256_packus_epi16(rows[2], rows[3]);
+	__m256i p2 = _mm256_packus_epi16(rows[4], rows[5]), p3 = _mm256_packus_epi16(rows[6], rows[7]);
+
+	Interleave8(p0, p2); Interleave8(p1, p3);
+	Interleave8(p0, p1); Interleave8(p2, p3);
+	Interleave8(p0, p2); Interleave8(p1, p3);
+
+	const __m256i outRows[4] = { p0, p2, p1, p3 };
+
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		__m128i a = _mm256_castsi256_si128(outRows[i]), b = _mm256_extracti128_si256(outRows[i], 1);
+
+		_mm_storel_epi64((__m128i*)_outA, a);							_outA += _strideA;
+		_mm_storel_epi64((__m128i*)_outA, _mm_shuffle_epi32(a, 0x4e));	_outA += _strideA;
+		_mm_storel_epi64((__m128i*)_outB, b);							_outB += _strideB;
+		_mm_storel_epi64((__m128i*)_outB, _mm_shuffle_epi32(b, 0x4e));	_outB += _strideB;
+	}
+}
+
+R2D_TARGET("avx2") static inline __m256i DescaleColour(__m256i _lo, __m256i _hi, __m256i _round)
+{
+	return _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(_lo, _round), COLOUR_BITS), _mm256_srai_epi32(_mm256_add_epi32(_hi, _round), COLOUR_BITS));
+}
+
+// 16 pixels a step, lane 0 holding pixels 0-7 and lane 1 pixels 8-15 until the final stores put them back in order
+R2D_TARGET("avx2") static void YCbCrToRGBAAVX2(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count)
+{
+	const __m256i zero = _mm256_setzero_si256(), centre = _mm256_set1_epi16(128), alpha = _mm256_set1_epi8(-1);
+	const __m256i round = _mm256_set1_epi32(COLOUR_ROUND);
+
+	const __m256i rotateR = _mm256_set1_epi32((Y_ONE << 16) | (unsigned short)CR_R);
+	const __m256i rotateG = _mm256_set1_epi32((int)(((unsigned int)(unsigned short)CR_G << 16) | (unsigned short)CB_G));
+	const __m256i rotateB = _mm256_set1_epi32((Y_ONE << 16) | (unsigned short)CB_B);
+
+	unsigned int i = 0;
+
+	for (; i + 16 <= _count; i += 16)
+	{
+		__m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(_y + i)));
+		__m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(_cb + i))), centre);
+		__m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(_cr + i))), centre);
+
+		Wide256 r = Rotate(cr, y, rotateR);
+		Wide256 g = Add(Rotate(cb, cr, rotateG), { _mm256_slli_epi32(_mm256_unpacklo_epi16(y, zero), COLOUR_BITS), _mm256_slli_epi32(_mm256_unpackhi_epi16(y, zero), COLOUR_BITS) });
+		Wide256 b = Rotate(cb, y, rotateB);
+
+		__m256i r8 = _mm256_packus_epi16(DescaleColour(r.lo, r.hi, round), zero);
+		__m256i g8 = _mm256_packus_epi16(DescaleColour(g.lo, g.hi, round), zero);
+		__m256i b8 = _mm256_packus_epi16(DescaleColour(b.lo, b.hi, round), zero);
+
+		__m256i rg = _mm256_unpacklo_epi8(r8, g8), ba = _mm256_unpacklo_epi8(b8, alpha);
+		__m256i lo = _mm256_unpacklo_epi16(rg, ba), hi = _mm256_unpackhi_epi16(rg, ba);
+
+		_mm256_storeu_si256((__m256i*)(_dst + i * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(_dst + i * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	YCbCrToRGBASSE2(_y + i, _cb + i, _cr + i, _dst + i * 4, _count - i);
+}
+
+#endif
+
+static KernelTable BuildKernelTable(SIMDLevel _level)
+{
+	KernelTable table = { IDCTScalar, nullptr, YCbCrToRGBAScalar };
+
+#if defined(R2D_X86)
+	if (_level >= SIMD_SSE2)
+	{
+		table.idct = IDCTSSE2;
+		table.ycbcr = YCbCrToRGBASSE2;
+	}
+
+	if (_level >= SIMD_AVX2)
+	{
+		table.idctPair = IDCTPairAVX2;
+		table.ycbcr = YCbCrToRGBAAVX2;
+	}
+#endif
+
+	return table;
+}
+
+static const KernelTable& GetKernelTable()
+{
+	static const KernelTable tables[3] = {
+		BuildKernelTable(SIMD_SCALAR),
+		BuildKernelTable(SIMD_SSE2),
+		BuildKernelTable(SIMD_AVX2)
+	};
+
+	return tables[JPEGKernels::GetSIMDLevel()];
+}
+
+void JPEGKernels::InverseDCT(const short* _blocks, unsigned char* const* _outputs, const size_t* _strides, unsigned int _count)
+{
+	const KernelTable& kernels = GetKernelTable();
+
+	unsigned int i = 0;
+
+	if (kernels.idctPair != nullptr)
+	{
+		for (; i + 2 <= _count; i += 2)
+		{
+			kernels.idctPair(_blocks + i * 64, _outputs[i], _strides[i], _blocks + (i + 1) * 64, _outputs[i + 1], _strides[i + 1]);
+		}
+	}
+
+	for (; i < _count; i++)
+	{
+		kernels.idct(_blocks + i * 64, _outputs[i], _strides[i]);
+	}
+}
+
+void JPEGKernels::ReducedInverseDCT(const short* _blocks, unsigned char* const* _outputs, const size_t* _strides, unsigned int _count, unsigned int _size)
+{
+	IDCTKernel kernel = nullptr;
+
+	switch (_size)
+	{
+		case 4:		kernel = IDCT4x4Scalar;	break;
+		case 2:		kernel = IDCT2x2Scalar;	break;
+		case 1:		kernel = IDCT1x1Scalar;	break;
+
+		default:
+		{
+			InverseDCT(_blocks, _outputs, _strides, _count);
+			return;
+		}
+	}
+
+	for (unsigned int i = 0; i < _count; i++)
+	{
+		kernel(_blocks + i * 64, _outputs[i], _strides[i]);
+	}
+}
+
+void JPEGKernels::YCbCrToRGBA(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count)
+{
+	GetKernelTable().ycbcr(_y, _cb, _cr, _dst, _count);
+}
+
+void JPEGKernels::GrayToRGBA(const unsigned char* _gray, unsigned char* _dst, unsigned int _count)
+{
+	for (unsigned int i = 0; i < _count; i++, _dst += 4)
+	{
+		_dst[0] = _dst[1] = _dst[2] = _gray[i];
+		_dst[3] = 255;
+	}
+}
+
+void JPEGKernels::SetSIMDLevel(SIMDLevel _level)
+{
+	SIMDLevel supported = CPUFeatures::GetInstance().GetSIMDLevel();
+
+	gSIMDLevel = (_level < supported) ? _level : supported;
+}
+
+SIMDLevel JPEGKernels::GetSIMDLevel()
+{
+	int level = gSIMDLevel;
+
+	if (level < 0)
+	{
+		level = CPUFeatures::GetInstance().GetSIMDLevel();
+		gSIMDLevel = level;
+	}
+
+	return (SIMDLevel)level;
+}
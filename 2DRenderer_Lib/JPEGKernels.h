@@ -0,0 +1,29 @@
+#pragma once
+#include "DLLCommon.h"
+#include "CPUFeatures.h"
+
+#include <cstddef>
+
+// JPEG inverse DCT and colour conversion. Integer only, with SSE2/AVX2 versions picked at runtime from what
+// the CPU supports. Every version does exactly the same arithmetic, so they all give the same pixels.
+class RENDERER_API JPEGKernels
+{
+public:
+	// Inverse transforms _count dequantised 8x8 blocks of coefficients, stored one after another in natural
+	// (not zigzag) order, writing block i's 8x8 samples to _outputs[i] with _strides[i] bytes between rows.
+	static void InverseDCT(const short* _blocks, unsigned char* const* _outputs, const size_t* _strides, unsigned int _count);
+
+	// The same, but each block's samples come out _size (4, 2 or 1, 8 does the full transform) a side, for decoding at
+	// 1/2, 1/4 or 1/8 size without reconstructing full resolution. Scalar only.
+	static void ReducedInverseDCT(const short* _blocks, unsigned char* const* _outputs, const size_t* _strides, unsigned int _count, unsigned int _size);
+
+	// Converts _count pixels of full resolution Y, Cb and Cr samples into packed RGBA8 with opaque alpha
+	static void YCbCrToRGBA(const unsigned char* _y, const unsigned char* _cb, const unsigned char* _cr, unsigned char* _dst, unsigned int _count);
+
+	// Gray samples into packed RGBA8 with opaque alpha
+	static void GrayToRGBA(const unsigned char* _gray, unsigned char* _dst, unsigned int _count);
+
+	// Caps the kernels used to the given instruction set, mainly for benchmarking against the scalar path.
+	static void SetSIMDLevel(SIMDLevel _level);
+	static SIMDLevel GetSIMDLevel();
+};
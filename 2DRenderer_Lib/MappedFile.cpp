@@ -0,0 +1,109 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	mData = nullptr;
+	mSize = 0;
+
+#ifdef _WIN32
+	mFileHandle = INVALID_HANDLE_VALUE;
+	mMappingHandle = nullptr;
+#else
+	mFileDescriptor = -1;
+#endif
+}
+
+MappedFile::MappedFile(const char* _filePath) : MappedFile()
+{
+	Open(_filePath);
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* _filePath)
+{
+	Close();
+
+#ifdef _WIN32
+	mFileHandle = CreateFileA(_filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(mFileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mMappingHandle)
+	{
+		Close();
+		return false;
+	}
+
+	mData = (const unsigned char*)MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+	mSize = (size_t)fileSize.QuadPart;
+#else
+	mFileDescriptor = open(_filePath, O_RDONLY);
+	if (mFileDescriptor < 0)
+		return false;
+
+	struct stat fileStat = {};
+	if (fstat(mFileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, mFileDescriptor, 0);
+	if (mapping != MAP_FAILED)
+	{
+		mData = (const unsigned char*)mapping;
+		mSize = (size_t)fileStat.st_size;
+	}
+#endif
+
+	if (!mData)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (mData) UnmapViewOfFile(mData);
+	if (mMappingHandle) CloseHandle(mMappingHandle);
+	if (mFileHandle != INVALID_HANDLE_VALUE) CloseHandle(mFileHandle);
+
+	mFileHandle = INVALID_HANDLE_VALUE;
+	mMappingHandle = nullptr;
+#else
+	if (mData) munmap((void*)mData, mSize);
+	if (mFileDescriptor >= 0) close(mFileDescriptor);
+
+	mFileDescriptor = -1;
+#endif
+
+	mData = nullptr;
+	mSize = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "DLLCommon.h"
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file, unmapped when destroyed.
+class RENDERER_API MappedFile
+{
+public:
+	MappedFile();
+	MappedFile(const char* _filePath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const char* _filePath);
+	void Close();
+
+	const bool IsOpen() const					{ return mData != nullptr; }
+
+	const unsigned char* GetData() const		{ return mData; }
+	const size_t GetSize() const				{ return mSize; }
+
+protected:
+	const unsigned char* mData;
+	size_t mSize;
+
+#ifdef _WIN32
+	void* mFileHandle;
+	void* mMappingHandle;
+#else
+	int mFileDescriptor;
+#endif
+};
@@ -1,10 +1,142 @@
 #include "PNG.h"
 
 #include "ByteHelpers.h"
-
-#include <gzguts.h> // TODO - replace with own decompressor?
+#include "CRC32.h"
+#include "Inflater.h"
+#include "MappedFile.h"
+#include "PNGConverters.h"
+#include "PNGFilters.h"
+#include "ThreadPool.h"
+
+#include <gzguts.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <string>
 
+// Adam7 interlace pattern, per pass
+static constexpr unsigned char ADAM7_STARTING_ROWS[7] = { 0, 0, 4, 0, 2, 0, 1 }, ADAM7_STARTING_COLS[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static constexpr unsigned char ADAM7_ROW_INCREMENT[7] = { 8, 8, 8, 4, 4, 2, 2 }, ADAM7_COL_INCREMENT[7] = { 8, 8, 4, 4, 2, 2, 1 };
+
+// Roughly how many pixels each conversion task handles, whole rows at a time
+static constexpr unsigned int CONVERT_TASK_PIXELS = 1u << 16;
+
+// Read buffer handed to std::ifstream when streaming, kept in the decode state so decoders re-use it
+static constexpr size_t STREAM_BUFFER_BYTES = 1u << 16;
+
+// Most bytes inflated per call to inflate, so unfiltering and conversion start before a large IDAT chunk is done
+static constexpr unsigned int INFLATE_SLICE_BYTES = 1u << 18;
+
+static std::atomic<int> gInflateBackend = { INFLATE_BUILTIN };
+static std::atomic<bool> gVerifyChecksums = { true };
+
+// Chunk lengths are at most 2^31 - 1 bytes
+static constexpr unsigned int MAX_CHUNK_LENGTH = 0x7FFFFFFF;
+
+// Bytes in the file behind _reader, leaving it at the start
+static std::streamoff GetStreamSize(std::ifstream& _reader)
+{
+	_reader.seekg(0, std::ios::end);
+	std::streamoff size = _reader.tellg();
+	_reader.seekg(0, std::ios::beg);
+
+	return std::max(size, (std::streamoff)0);
+}
+
+// Everything that carries over from one IDAT chunk to the next while decoding an image.
+// Inflate and unfilter run on the loading thread, converting finished rows is handed out to the thread pool.
+// A PNGDecoder keeps one alive across images, Reset() keeps the inflate state and buffer capacity.
+struct PNGDecodeState
+{
+	z_stream stream = {};
+	bool streamInitialised = false;
+	bool inIDAT = false, foundIDAT = false;
+	size_t inflatedBytes = 0;
+
+	// Built-in inflate only, the IDAT stream up until the last chunk. Chunks are kept as views when they outlive
+	// the call that reads them (memory mapped) and inflated straight out of the mapping, otherwise they're copied into compressed.
+	bool useInflater = false, chunksPersist = false;
+	std::vector<InflateSpan> idatSpans;
+	std::vector<unsigned char> compressed;
+
+	// Set when decoding row by row, rows are then emitted as they're finished instead of kept in pixels
+	const PNGRowCallback* onRow = nullptr;
+	bool streamingRows = false;
+
+	// Inflated scanlines, unfiltered and compacted in place over their filter bytes as soon as they're complete
+	std::vector<unsigned char> data;
+	size_t filteredOffset = 0;		// filter byte of the next scanline to unfilter
+	size_t unfilteredOffset = 0;	// end of the unfiltered scanlines
+	size_t priorOffset = 0;			// previous unfiltered scanline of the current pass
+
+	// Next scanline to unfilter
+	unsigned int pass = 0, row = 0;
+	unsigned int passWidth = 0, passHeight = 0;
+	size_t scanlineBytes = 0;
+
+	// Unfiltered scanlines of the current pass that haven't been handed to a conversion task yet
+	unsigned int pendingRow = 0, rowsPerTask = 1;
+	size_t pendingOffset = 0;
+	bool convertInline = false; // images smaller than one task aren't worth handing to the pool
+	bool pooledConversion = true; // kept across Reset(), see PNGDecoder::SetPooledConversion
+
+	// Streaming only, the scanline being inflated and the one before it (each with its filter byte),
+	// plus the converted output row handed to onRow
+	std::vector<unsigned char> rowBuffers, rowPixels;
+	unsigned int currentRowBuffer = 0;
+	size_t rowFill = 0;
+
+	std::vector<unsigned char> sampleTable, alphaTable, paletteTable;
+	PNGConvertParams params = {};
+	PNGScanlineConverter convert = nullptr;
+
+	// Streamed loading only, chunkBuffer is re-used for every chunk and only grows to the largest chunk
+	std::vector<unsigned char> chunkBuffer;
+	std::vector<char> streamBuffer;
+
+	TaskGroup conversions;
+
+	void Reset()
+	{
+		conversions.Wait();
+
+		inIDAT = foundIDAT = false;
+		inflatedBytes = 0;
+
+		useInflater = chunksPersist = false;
+		idatSpans.clear();
+		compressed.clear();
+
+		onRow = nullptr;
+		streamingRows = false;
+
+		data.clear();
+		filteredOffset = unfilteredOffset = priorOffset = 0;
+		pass = row = passWidth = passHeight = 0;
+		scanlineBytes = 0;
+		pendingRow = 0, rowsPerTask = 1;
+		pendingOffset = 0;
+		convertInline = false;
+
+		currentRowBuffer = 0;
+		rowFill = 0;
+
+		params = {};
+		convert = nullptr;
+	}
+
+	~PNGDecodeState()
+	{
+		// Conversion tasks read the buffers above, they have to finish before anything is freed
+		conversions.Wait();
+
+		if (streamInitialised)
+		{
+			inflateEnd(&stream);
+		}
+	}
+};
+
 PNGProperties::PNGProperties()
 {
 	width = 0;
@@ -15,12 +147,74 @@ PNGProperties::PNGProperties()
 	filterMethod = 0;
 	interlaceMethod = 0;
 	palette = {};
+	pixelFormat = RGBA8;
 	pixels = {};
-	trnsColor = Color(-1, -1, -1, -1, 1, false);
+	hasTRNS = false;
+	trnsSamples[0] = trnsSamples[1] = trnsSamples[2] = 0;
 	gamma = 1.f;
 }
 
-void PNGProperties::LoadPNG(const char* _filePath)
+void PNGProperties::LoadPNG(const char* _filePath, PixelFormat _format, PNGLoadMode _mode)
+{
+	PNGDecodeState state;
+
+	Load(_filePath, _format, _mode, state);
+}
+
+void PNGProperties::LoadPNGRows(const char* _filePath, const PNGRowCallback& _onRow, PixelFormat _format, PNGLoadMode _mode)
+{
+	PNGDecodeState state;
+	state.onRow = &_onRow;
+
+	Load(_filePath, _format, _mode, state);
+}
+
+void PNGProperties::Load(const char* _filePath, PixelFormat _format, PNGLoadMode _mode, PNGDecodeState& _state)
+{
+	// Nothing from a previous image may leak into this one, but buffers keep their capacity
+	width = height = 0;
+	bitDepth = colourType = compressionMethod = filterMethod = interlaceMethod = 0;
+	palette.clear();
+	pixelFormat = _format;
+	pixels.clear();
+	hasTRNS = false;
+	trnsSamples[0] = trnsSamples[1] = trnsSamples[2] = 0;
+	gamma = 1.f;
+
+	switch (_mode)
+	{
+		case STREAMED:		LoadStreamed(_filePath, _state);	break;
+		case MEMORY_MAPPED:	LoadMapped(_filePath, _state);	break;
+	}
+}
+
+void PNGProperties::SetInflateBackend(PNGInflateBackend _backend)
+{
+	gInflateBackend = _backend;
+}
+
+PNGInflateBackend PNGProperties::GetInflateBackend()
+{
+	return (PNGInflateBackend)gInflateBackend.load();
+}
+
+void PNGProperties::SetVerifyChecksums(bool _verify)
+{
+	gVerifyChecksums = _verify;
+}
+
+bool PNGProperties::GetVerifyChecksums()
+{
+	return gVerifyChecksums;
+}
+
+PNGInfo PNGProperties::Probe(const char* _filePath, bool _scanChunks)
+{
+	PNGProperties props = PNGProperties();
+	return props.ProbeStreamed(_filePath, _scanChunks);
+}
+
+PNGInfo PNGProperties::ProbeStreamed(const char* _filePath, bool _scanChunks)
 {
 	std::ifstream reader = std::ifstream();
 	reader.open(_filePath, std::ios::in | std::ios::binary);
@@ -30,92 +224,262 @@ void PNGProperties::LoadPNG(const char* _filePath)
 		throw std::runtime_error(std::string("Could not open file at: \"") + _filePath + std::string("\""));
 	}
 
-	CheckSignature(reader);
+	std::streamoff remaining = GetStreamSize(reader) - 8;
+
+	char signature[8] = {};
+	reader.read(signature, 8);
+	CheckSignature(signature);
+
+	// IHDR is always the first chunk, only 25 bytes need reading to get to the end of it
+	std::vector<unsigned char> chunkBuffer;
+	PNGChunk chunk = ReadChunk(reader, chunkBuffer, remaining);
+
+	if (!IsChunkType(chunk, "IHDR"))
+	{
+		throw std::runtime_error("First chunk in PNG file is not IHDR.");
+	}
+
+	Chunk_IHDR(chunk);
+
+	PNGInfo info = {};
+	info.width = width;
+	info.height = height;
+	info.bitDepth = bitDepth;
+	info.colourType = colourType;
+	info.interlaced = (interlaceMethod != 0);
+
+	// PLTE and tRNS both come before the first IDAT chunk, chunk data is seeked over rather than read
+	while (_scanChunks)
+	{
+		char header[8] = {};
+		reader.read(header, 8);
+
+		if (!reader)
+			break;
+
+		PNGChunk chunkHeader = {};
+		chunkHeader.length = R2D_BH::CharArrToUInt(header, 4);
+		chunkHeader.type = header + 4;
+
+		if (IsChunkType(chunkHeader, "IDAT") || IsChunkType(chunkHeader, "IEND"))
+			break;
+
+		info.hasPalette |= IsChunkType(chunkHeader, "PLTE");
+		info.hasTRNS |= IsChunkType(chunkHeader, "tRNS");
+
+		reader.seekg((std::streamoff)chunkHeader.length + 4, std::ios::cur); // data + CRC
+	}
+
+	return info;
+}
+
+void PNGProperties::LoadStreamed(const char* _filePath, PNGDecodeState& _state)
+{
+	_state.streamBuffer.resize(STREAM_BUFFER_BYTES);
+
+	std::ifstream reader = std::ifstream();
+	reader.rdbuf()->pubsetbuf(_state.streamBuffer.data(), _state.streamBuffer.size());
+	reader.open(_filePath, std::ios::in | std::ios::binary);
+
+	if (!reader.is_open())
+	{
+		throw std::runtime_error(std::string("Could not open file at: \"") + _filePath + std::string("\""));
+	}
+
+	std::streamoff remaining = GetStreamSize(reader) - 8;
+
+	char signature[8] = {};
+	reader.read(signature, 8);
+	CheckSignature(signature);
 
 	bool reading = true;
-	std::vector<unsigned char> rawIDATData;
 
 	while (reading)
 	{
-		unsigned int chunkLength = R2D_BH::ReadBytesIntoUInt(reader, 4);
+		PNGChunk chunk = ReadChunk(reader, _state.chunkBuffer, remaining);
 
-		// Compute the checksum for this chunk, including chunk type + data
-		uLong crc = crc32(0L, Z_NULL, 0);
-		crc = crc32(crc, (Bytef*)R2D_BH::ReadBytesIntoStr(reader, chunkLength + 4), chunkLength + 4);
+		reading = HandleChunk(chunk, _state);
+	}
 
-		// Re-wind the readers' position to correctly read in the chunk type + data
-		reader.seekg(-(int)(chunkLength + 4), std::ios_base::cur);
-		char* chunkType = R2D_BH::ReadBytesIntoStr(reader, 4);
+	reader.close();
+}
 
-		// We've read all IDAT chunks, now we need to decode the data
-		if (rawIDATData.size() != 0 && !R2D_BH::CompCharArrToStr(chunkType, "IDAT", 4))
-		{
-			std::vector<unsigned char> decodedIDATData;
+void PNGProperties::LoadMapped(const char* _filePath, PNGDecodeState& _state)
+{
+	MappedFile file;
 
-			DecompressIDATData(rawIDATData, decodedIDATData);
-			UnfilterIDATData(decodedIDATData);
-			ReadIDATData(decodedIDATData);
-		}
+	if (!file.Open(_filePath))
+	{
+		throw std::runtime_error(std::string("Could not map file at: \"") + _filePath + std::string("\""));
+	}
 
-		if (R2D_BH::CompCharArrToStr(chunkType, "IHDR", 4))
-		{
-			Chunk_IHDR(reader);
-		}
-		else if (R2D_BH::CompCharArrToStr(chunkType, "PLTE", 4))
-		{
-			Chunk_PLTE(reader, chunkLength);
-		}
-		else if (R2D_BH::CompCharArrToStr(chunkType, "IDAT", 4))
-		{
-			Chunk_IDAT(reader, chunkLength, rawIDATData);
-		}
-		else if (R2D_BH::CompCharArrToStr(chunkType, "IEND", 4))
-		{
-			reading = false;
+	const unsigned char* data = file.GetData();
+	size_t size = file.GetSize();
 
-			if (rawIDATData.size() == 0)
-			{
-				throw std::runtime_error("No IDAT chunk present in PNG file.");
-			}
-		}
-		else if (IsAncillaryChunk(chunkType))
-		{
-			Chunk_Ancillary(reader, chunkLength, chunkType);
-		}
-		else // found unknown critical chunk type, early exit reading
-		{
-			reading = false;
-		}
+	if (size < 8)
+	{
+		throw std::runtime_error("PNG file is too small to contain a signature.");
+	}
+
+	CheckSignature((const char*)data);
+
+	bool reading = true;
+	size_t offset = 8;
+
+	// Chunks are views into the mapping, so IDAT data goes to inflate without being copied
+	_state.chunksPersist = true;
+
+	while (reading)
+	{
+		PNGChunk chunk = ReadChunk(data, size, offset);
+
+		reading = HandleChunk(chunk, _state);
+	}
+}
+
+PNGChunk PNGProperties::ReadChunk(std::ifstream& _reader, std::vector<unsigned char>& _chunkBuffer, std::streamoff& _remaining)
+{
+	// Chunk length (4) + type (4) + CRC (4), with the data in-between
+	if (_remaining < 12)
+	{
+		throw std::runtime_error("Unexpected end of PNG file while reading chunk.");
+	}
+
+	unsigned int chunkLength = R2D_BH::ReadBytesIntoUInt(_reader, 4);
+
+	// Checked before the buffer grows, a corrupt length would otherwise allocate up to 4 GB
+	if (chunkLength > MAX_CHUNK_LENGTH)
+	{
+		throw std::runtime_error("PNG chunk length is out of range.");
+	}
+
+	if (_remaining - 12 < (std::streamoff)chunkLength)
+	{
+		throw std::runtime_error("Unexpected end of PNG file while reading chunk.");
+	}
+
+	_remaining -= (std::streamoff)chunkLength + 12;
+
+	// Read chunk type + data + CRC in one go
+	if (_chunkBuffer.size() < (size_t)chunkLength + 8)
+	{
+		_chunkBuffer.resize((size_t)chunkLength + 8);
+	}
+
+	_reader.read((char*)_chunkBuffer.data(), (std::streamsize)chunkLength + 8);
 
-		// CRC is present at the end of every chunk, even empty ones
-		// Check the stored checksum against the pre-computed one
-		uLong storedCRC;
-		reader.read((char*)&storedCRC, 4);
+	if (!_reader)
+	{
+		throw std::runtime_error("Unexpected end of PNG file while reading chunk.");
+	}
+
+	PNGChunk chunk = {};
+	chunk.length = chunkLength;
+	chunk.type = (const char*)_chunkBuffer.data();
+	chunk.data = _chunkBuffer.data() + 4;
+
+	CheckCRC(chunk);
+
+	return chunk;
+}
+
+PNGChunk PNGProperties::ReadChunk(const unsigned char* _data, size_t _size, size_t& _offset)
+{
+	// Chunk length (4) + type (4) + CRC (4), with the data in-between
+	if (_size - _offset < 12)
+	{
+		throw std::runtime_error("Unexpected end of PNG file while reading chunk.");
+	}
+
+	unsigned int chunkLength = R2D_BH::CharArrToUInt((const char*)_data + _offset, 4);
+
+	if (chunkLength > MAX_CHUNK_LENGTH)
+	{
+		throw std::runtime_error("PNG chunk length is out of range.");
+	}
+
+	if (_size - _offset - 12 < chunkLength)
+	{
+		throw std::runtime_error("Unexpected end of PNG file while reading chunk.");
+	}
+
+	PNGChunk chunk = {};
+	chunk.length = chunkLength;
+	chunk.type = (const char*)_data + _offset + 4;
+	chunk.data = _data + _offset + 8;
+
+	CheckCRC(chunk);
+
+	_offset += (size_t)chunkLength + 12;
+
+	return chunk;
+}
+
+bool PNGProperties::HandleChunk(const PNGChunk& _chunk, PNGDecodeState& _state)
+{
+	bool isIDAT = IsChunkType(_chunk, "IDAT");
+
+	// We've read all IDAT chunks, finish decoding whatever is left of the data
+	if (!isIDAT && _state.inIDAT)
+	{
+		EndIDATData(_state);
+	}
 
-		if (crc != R2D_BH::ToBigEndian(storedCRC))
+	if (IsChunkType(_chunk, "IHDR"))
+	{
+		Chunk_IHDR(_chunk);
+	}
+	else if (IsChunkType(_chunk, "PLTE"))
+	{
+		Chunk_PLTE(_chunk);
+	}
+	else if (isIDAT)
+	{
+		Chunk_IDAT(_chunk, _state);
+	}
+	else if (IsChunkType(_chunk, "IEND"))
+	{
+		if (!_state.foundIDAT)
 		{
-			throw std::runtime_error("Stored checksum for " + std::string(chunkType, 4)+" chunk does not match pre-computed checksum.");
+			throw std::runtime_error("No IDAT chunk present in PNG file.");
 		}
+
+		return false;
+	}
+	else if (IsAncillaryChunk(_chunk.type))
+	{
+		Chunk_Ancillary(_chunk);
+	}
+	else // found unknown critical chunk type, early exit reading
+	{
+		return false;
 	}
 
-	reader.close();
+	return true;
 }
 
-void PNGProperties::Chunk_IHDR(std::ifstream& _reader)
+void PNGProperties::Chunk_IHDR(const PNGChunk& _chunk)
 {
-	width = R2D_BH::ReadBytesIntoUInt(_reader, 4);
-	height = R2D_BH::ReadBytesIntoUInt(_reader, 4);
+	if (_chunk.length < 13)
+	{
+		throw std::runtime_error("IHDR chunk is too short.");
+	}
+
+	const char* data = (const char*)_chunk.data;
 
-	_reader.read(&bitDepth, 1);
-	_reader.read(&colourType, 1);
-	_reader.read(&compressionMethod, 1);
-	_reader.read(&filterMethod, 1);
-	_reader.read(&interlaceMethod, 1);
+	width = R2D_BH::CharArrToUInt(data, 4);
+	height = R2D_BH::CharArrToUInt(data + 4, 4);
+
+	bitDepth = data[8];
+	colourType = data[9];
+	compressionMethod = data[10];
+	filterMethod = data[11];
+	interlaceMethod = data[12];
 
 	CheckIHDRData();
 }
 
-void PNGProperties::Chunk_PLTE(std::ifstream& _reader, unsigned int _chunkLength)
+void PNGProperties::Chunk_PLTE(const PNGChunk& _chunk)
 {
 	// Check for grayscale colour types
 	if (colourType == 0 || colourType == 4)
@@ -125,77 +489,124 @@ void PNGProperties::Chunk_PLTE(std::ifstream& _reader, unsigned int _chunkLength
 	}
 
 	// Check that the palette is a valid byte-length (3-bytes divisible)
-	if (_chunkLength % 3 != 0)
+	if (_chunk.length % 3 != 0)
 	{
 		perror("Palette PNG chunk is not a valid byte-size!");
 		return;
 	}
 
-	for (unsigned int i = 0; i < _chunkLength / 3; i++)
-	{
-		unsigned char r = 0, g = 0, b = 0;
+	palette.clear();
+	palette.reserve(_chunk.length / 3);
 
-		_reader.read((char*)&r, 1);
-		_reader.read((char*)&g, 1);
-		_reader.read((char*)&b, 1);
+	for (unsigned int i = 0; i < _chunk.length; i += 3)
+	{
+		unsigned char r = _chunk.data[i], g = _chunk.data[i + 1], b = _chunk.data[i + 2];
 
 		palette.push_back(Color(r, g, b, 255, 255));
 	}
 }
 
-void PNGProperties::Chunk_IDAT(std::ifstream& _reader, unsigned int _chunkLength, std::vector<unsigned char>& _data)
+void PNGProperties::Chunk_IDAT(const PNGChunk& _chunk, PNGDecodeState& _state)
 {
-	unsigned char* data = new unsigned char[_chunkLength];
-	_reader.read((char*)data, _chunkLength);
+	// First IDAT chunk, set up the output buffer at its final size
+	if (!_state.inIDAT)
+	{
+		BeginIDATData(_state);
+	}
 
-	_data.insert(_data.end(), data, data + _chunkLength);
-}
+	if (_state.streamingRows)
+	{
+		InflateRows(_chunk, _state);
+		return;
+	}
 
-void PNGProperties::Chunk_Ancillary(std::ifstream& _reader, unsigned int _chunkLength, char* _chunkType)
-{
-	if (R2D_BH::CompCharArrToStr(_chunkType, "gAMA", 4))
+	if (_state.useInflater)
 	{
-		std::uint32_t gammaRaw = 0;
-		_reader.read((char*)&gammaRaw, 4);
+		// Nothing is inflated until the last chunk has been read, see InflateIDATData
+		if (_state.chunksPersist)
+		{
+			_state.idatSpans.push_back({ _chunk.data, _chunk.length });
+		}
+		else _state.compressed.insert(_state.compressed.end(), _chunk.data, _chunk.data + _chunk.length);
 
-		gamma = (float)R2D_BH::ToBigEndian(gammaRaw) / 100000.f;
+		return;
 	}
-	else if (R2D_BH::CompCharArrToStr(_chunkType, "tRNS", 4))
+
+	z_stream& stream = _state.stream;
+
+	// The zlib stream is split across the IDAT chunks, inflate each one straight into the output as it is read
+	stream.next_in = (Bytef*)_chunk.data;
+	stream.avail_in = _chunk.length;
+
+	// Keep going after the input runs out while inflate fills all the space it's given, it may still hold output back
+	while (true)
 	{
-		float sampleMax = powf(2.f, (float)bitDepth) - 1.f;
+		size_t remaining = _state.data.size() - stream.total_out;
+		stream.avail_out = (uInt)std::min(remaining, (size_t)INFLATE_SLICE_BYTES);
+
+		int result = inflate(&stream, Z_NO_FLUSH);
+
+		// No progress without more input, the rest of the stream is in the next IDAT chunk
+		if (result == Z_BUF_ERROR && stream.avail_in == 0)
+			break;
+
+		if (result == Z_BUF_ERROR && remaining == 0)
+		{
+			throw std::runtime_error("IDAT PNG data inflates to more than the image size!");
+		}
+
+		if (result != Z_OK && result != Z_STREAM_END)
+		{
+			throw std::runtime_error("ZLib stream error during inflation of IDAT PNG data!");
+		}
+
+		_state.inflatedBytes = stream.total_out;
+		UnfilterIDATData(_state, _state.inflatedBytes);
 
+		if (result == Z_STREAM_END || (stream.avail_in == 0 && stream.avail_out != 0))
+			break;
+	}
+}
+
+void PNGProperties::Chunk_Ancillary(const PNGChunk& _chunk)
+{
+	const char* data = (const char*)_chunk.data;
+
+	if (IsChunkType(_chunk, "gAMA") && _chunk.length >= 4)
+	{
+		gamma = (float)R2D_BH::CharArrToUInt(data, 4) / 100000.f;
+	}
+	else if (IsChunkType(_chunk, "tRNS"))
+	{
 		switch (colourType)
 		{
 			case 0: // grayscale
 			{
-				unsigned short g;
-				_reader.read((char*)&g, 2);
+				if (_chunk.length < 2) break;
 
-				trnsColor = Color(g, g, g, -sampleMax, sampleMax);
+				trnsSamples[0] = (unsigned short)R2D_BH::CharArrToUInt(data, 2);
+				hasTRNS = true;
 
 				break;
 			}
 
 			case 2: // rgb
 			{
-				unsigned short r, g, b;
-				_reader.read((char*)&r, 2);
-				_reader.read((char*)&g, 2);
-				_reader.read((char*)&b, 2);
+				if (_chunk.length < 6) break;
 
-				trnsColor = Color(r, g, b, -sampleMax, sampleMax);
+				trnsSamples[0] = (unsigned short)R2D_BH::CharArrToUInt(data, 2);
+				trnsSamples[1] = (unsigned short)R2D_BH::CharArrToUInt(data + 2, 2);
+				trnsSamples[2] = (unsigned short)R2D_BH::CharArrToUInt(data + 4, 2);
+				hasTRNS = true;
 
 				break;
 			}
 
 			case 3: // indexed
 			{
-				for (unsigned int i = 0; i < _chunkLength; i++)
+				for (unsigned int i = 0; i < _chunk.length && i < palette.size(); i++)
 				{
-					unsigned char alpha;
-					_reader.read((char*)&alpha, 1);
-
-					palette[i].a = (float)alpha / 255.f;
+					palette[i].a = (float)_chunk.data[i] / 255.f;
 				}
 
 				break;
@@ -210,193 +621,378 @@ void PNGProperties::Chunk_Ancillary(std::ifstream& _reader, unsigned int _chunkL
 			}
 		}
 	}
+}
+
+void PNGProperties::BeginIDATData(PNGDecodeState& _state)
+{
+	if (width == 0 || height == 0)
+	{
+		throw std::runtime_error("IDAT chunk found before a valid IHDR chunk.");
+	}
+
+	_state.inIDAT = true;
+	_state.foundIDAT = true;
+
+	// Interlaced rows aren't final until the last pass, so those are decoded whole and emitted at the end
+	_state.streamingRows = (_state.onRow != nullptr && interlaceMethod == 0);
+
+	// Otherwise the inflated size is known up front from IHDR, so the output is allocated once
+	if (!_state.streamingRows)
+	{
+		_state.data.resize(GetDecompressedSize());
+	}
+
+	_state.useInflater = (!_state.streamingRows && GetInflateBackend() == INFLATE_BUILTIN);
+
+	// PLTE, tRNS and gAMA all come before the first IDAT chunk, so the converter can be set up now
+	BeginConversion(_state);
+	BeginPass(_state, 0);
+
+	if (_state.streamingRows)
+	{
+		_state.rowBuffers.assign(2 * (1 + _state.scanlineBytes), 0);
+		_state.rowPixels.resize((size_t)width * PixelFormatInfo::GetBytesPerPixel(pixelFormat));
+	}
+
+	if (_state.useInflater)
+		return;
+
+	z_stream& stream = _state.stream;
+
+	// A stream left over from a previous image keeps its window allocation
+	if (_state.streamInitialised)
+	{
+		if (inflateReset(&stream) != Z_OK) {
+			throw std::runtime_error("Failed to reset inflate");
+		}
+	}
 	else
 	{
-		_reader.seekg(_reader.tellg() + (std::streampos)_chunkLength);
+		stream = {};
+		stream.zalloc = Z_NULL;
+		stream.zfree = Z_NULL;
+		stream.opaque = Z_NULL;
+
+		if (inflateInit(&stream) != Z_OK) {
+			throw std::runtime_error("Failed to initialize inflate");
+		}
+
+		_state.streamInitialised = true;
 	}
+
+	stream.next_out = (Bytef*)_state.data.data();
+	stream.avail_out = 0;
+
+	inflateValidate(&stream, GetVerifyChecksums() ? 1 : 0);
 }
 
-void PNGProperties::DecompressIDATData(std::vector<unsigned char>& _compressedData, std::vector<unsigned char>& _decompressedData)
+void PNGProperties::EndIDATData(PNGDecodeState& _state)
 {
-	const size_t CHUNK_SIZE = 4096;
-	unsigned char out[CHUNK_SIZE] = {};
+	_state.inIDAT = false;
 
-	z_stream strm = {};
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = (unsigned int)_compressedData.size();
-	strm.next_in = (Bytef*)_compressedData.data();
+	if (_state.useInflater)
+	{
+		InflateIDATData(_state);
+	}
 
-	if (inflateInit(&strm) != Z_OK) {
-		throw std::runtime_error("Failed to initialize inflate");
+	if ((_state.streamingRows && _state.row != height) || (!_state.streamingRows && _state.inflatedBytes != _state.data.size()))
+	{
+		perror("Failed to decompress all IDAT PNG data!");
 	}
 
-	int result;
-	do 
+	// Anything not inflated is left zeroed, same as a complete image of filter type none
+	if (_state.streamingRows)
 	{
-		strm.avail_out = CHUNK_SIZE;
-		strm.next_out = (Bytef*)out;
-		result = inflate(&strm, Z_NO_FLUSH);
+		while (_state.row < height)
+		{
+			unsigned char* current = _state.rowBuffers.data() + _state.currentRowBuffer * (1 + _state.scanlineBytes);
+			memset(current + _state.rowFill, 0, 1 + _state.scanlineBytes - _state.rowFill);
+
+			EmitRow(_state);
+		}
+
+		return;
+	}
+
+	UnfilterIDATData(_state, _state.data.size());
 
-		if (result == Z_STREAM_ERROR) 
+	_state.conversions.Wait();
+	_state.data.clear();
+
+	// Row by row decode of an interlaced image, every row is only complete now
+	if (_state.onRow != nullptr)
+	{
+		const size_t rowBytes = (size_t)width * PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+
+		for (unsigned int row = 0; row < height; row++)
 		{
-			inflateEnd(&strm);
-			perror("ZLib stream error during inflation of IDAT PNG data!");
-			return;
+			(*_state.onRow)(row, pixels.data() + row * rowBytes);
 		}
 
-		size_t have = CHUNK_SIZE - strm.avail_out;
-		_decompressedData.insert(_decompressedData.end(), out, out + have);
+		pixels.clear();
+	}
+}
 
-	} while (result != Z_STREAM_END);
+void PNGProperties::InflateIDATData(PNGDecodeState& _state)
+{
+	// Streamed chunks were gathered into one span
+	if (!_state.chunksPersist)
+	{
+		_state.idatSpans.assign(1, { _state.compressed.data(), _state.compressed.size() });
+	}
 
-	inflateEnd(&strm);
+	struct Progress
+	{
+		PNGProperties* png;
+		PNGDecodeState* state;
+	} progress = { this, &_state };
 
-	if (result != Z_STREAM_END)
+	// Scanlines are unfiltered and handed off to conversion as soon as the window has moved past them
+	InflateProgressCallback onProgress = [](size_t _settledBytes, void* _context)
 	{
-		perror("Failed to decompress all IDAT PNG data!");
-		return;
+		Progress* progress = (Progress*)_context;
+		progress->png->UnfilterIDATData(*progress->state, _settledBytes);
+	};
+
+	try
+	{
+		_state.inflatedBytes = Inflater::InflateZlib(_state.idatSpans.data(), _state.idatSpans.size(), _state.data.data(), _state.data.size(),
+			onProgress, &progress, GetVerifyChecksums());
 	}
+	catch (const std::exception& _e)
+	{
+		throw std::runtime_error(std::string("Failed to inflate IDAT PNG data: ") + _e.what());
+	}
+
+	_state.idatSpans.clear();
+	_state.compressed.clear();
 }
 
-void PNGProperties::UnfilterIDATData(std::vector<unsigned char>& _decompressedData)
+void PNGProperties::InflateRows(const PNGChunk& _chunk, PNGDecodeState& _state)
 {
-	constexpr char channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
-	const double bytesPerPixel = (double)(bitDepth * channels[colourType]) / 8.0;
+	z_stream& stream = _state.stream;
+	const size_t rowBytes = 1 + _state.scanlineBytes;
 
-	unsigned int offsetBytesPerPixel = (unsigned int)std::fmax(bytesPerPixel, 1); // minimum 1 byte offset
+	stream.next_in = (Bytef*)_chunk.data;
+	stream.avail_in = _chunk.length;
 
-	std::vector<unsigned short> scanlineLengths, startingRows;
-	unsigned int totalScanlines;
+	// Inflate one scanline at a time into the current row buffer, zlib keeps its own window so nothing else is held
+	// Keep going after the input runs out while inflate fills all the space it's given, it may still hold output back
+	while (true)
+	{
+		unsigned char* current = _state.rowBuffers.data() + _state.currentRowBuffer * rowBytes;
+		size_t remaining = (_state.row < height) ? rowBytes - _state.rowFill : 0;
 
-	GetScanlineVars(scanlineLengths, startingRows, totalScanlines);
+		stream.next_out = (Bytef*)current + _state.rowFill;
+		stream.avail_out = (uInt)remaining;
 
-	// Return previous byte in scanline
-	auto previous = [&](unsigned int _byteIndex, unsigned int _posInScanline)
-		{
-			if (_posInScanline >= offsetBytesPerPixel)
-				return _decompressedData[_byteIndex - offsetBytesPerPixel];
+		int result = inflate(&stream, Z_NO_FLUSH);
+
+		// No progress without more input, the rest of the stream is in the next IDAT chunk
+		if (result == Z_BUF_ERROR && stream.avail_in == 0)
+			break;
 
-			return (unsigned char)0;
-		};
+		if (result == Z_BUF_ERROR && remaining == 0)
+		{
+			throw std::runtime_error("IDAT PNG data inflates to more than the image size!");
+		}
 
-	// Return corresponding byte of prior scanline
-	auto prior = [&](unsigned int _byteIndex, unsigned int _scanlineNum, double _stride)
+		if (result != Z_OK && result != Z_STREAM_END)
 		{
-			if (_scanlineNum > startingRows[_scanlineNum])
-				return _decompressedData[_byteIndex - (unsigned int)std::fmax(_stride, 1.0)];
+			throw std::runtime_error("ZLib stream error during inflation of IDAT PNG data!");
+		}
 
-			return (unsigned char)0;
-		};
+		_state.rowFill += remaining - stream.avail_out;
 
-	// Return corresponding previous byte of prior scanline
-	auto prevPrior = [&](unsigned int _byteIndex, unsigned int _posInScanline, unsigned int _scanlineNum, double _stride)
+		if (remaining != 0 && _state.rowFill == rowBytes)
 		{
-			if (_scanlineNum > 0 && _posInScanline >= offsetBytesPerPixel)
-				return _decompressedData[_byteIndex - (unsigned int)std::fmax(_stride, 1.0) - offsetBytesPerPixel];
+			EmitRow(_state);
+		}
 
-			return (unsigned char)0;
-		};
+		if (result == Z_STREAM_END || (stream.avail_in == 0 && stream.avail_out != 0))
+			break;
+	}
+}
 
-	auto paethPredictor = [](unsigned char _left, unsigned char _up, unsigned char _upLeft)
-		{
-			unsigned short p = (unsigned short)std::fmax(_left + _up - _upLeft, 0);		// initial estimate
-			unsigned short pa = abs(p - _left);				// distances to a, b, c
-			unsigned short pb = abs(p - _up);
-			unsigned short pc = abs(p - _upLeft);
+void PNGProperties::EmitRow(PNGDecodeState& _state)
+{
+	const size_t rowBytes = 1 + _state.scanlineBytes;
+	const size_t bytesPerPixel = std::max(1u, GetBitsPerPixel() / 8);
 
-			// Return minimum distance
-			if (pa <= pb && pa <= pc) return _left;
-			else if (pb <= pc) return _up;
-			return _upLeft;
-		};
+	unsigned char* current = _state.rowBuffers.data() + _state.currentRowBuffer * rowBytes;
+	const unsigned char* prior = (_state.row == 0) ? nullptr : _state.rowBuffers.data() + (1 - _state.currentRowBuffer) * rowBytes + 1;
 
-	for (unsigned int scanlineNum = 0, i = 0; scanlineNum < totalScanlines; scanlineNum++)
-	{
-		char filterMethod = _decompressedData[i];
-		_decompressedData.erase(_decompressedData.begin() + i); // remove filter byte from data, not needed after this point
+	PNGFilters::UnfilterScanline(current[0], current + 1, current + 1, prior, _state.scanlineBytes, bytesPerPixel);
 
-		double stride = (double)((interlaceMethod == 0) ? width : scanlineLengths[scanlineNum]) * bytesPerPixel;
+	_state.convert(current + 1, width, _state.rowPixels.data(), PixelFormatInfo::GetBytesPerPixel(pixelFormat), _state.params);
 
-		for (unsigned int posInScanline = 0; posInScanline < stride; posInScanline++)
-		{
-			unsigned short byte = (unsigned short)_decompressedData[i];
+	(*_state.onRow)(_state.row, _state.rowPixels.data());
 
-			switch (filterMethod) // NONE, SUB, UP, AVG, PAETH
-			{
-				case 0: break;
-				case 1: byte += previous(i, posInScanline); break;
-				case 2: byte += prior(i, scanlineNum, stride); break;
-				case 3:
-				{
-					unsigned char left = previous(i, posInScanline);
-					unsigned char up = prior(i, scanlineNum, stride);
+	// This scanline becomes the prior one for the next
+	_state.currentRowBuffer = 1 - _state.currentRowBuffer;
+	_state.rowFill = 0;
+	_state.row++;
+}
 
-					byte += (unsigned char)floor((left + up) / 2.0);
+void PNGProperties::UnfilterIDATData(PNGDecodeState& _state, size_t _inflatedBytes)
+{
+	// Filters work on bytes, sub-byte pixels use the previous byte
+	const size_t bytesPerPixel = std::max(1u, GetBitsPerPixel() / 8);
 
-					break;
-				}
-				case 4:
-				{
-					unsigned char left = previous(i, posInScanline);
-					unsigned char up = prior(i, scanlineNum, stride);
-					unsigned char upLeft = prevPrior(i, posInScanline, scanlineNum, stride);
+	// Unfilter every complete scanline inflated so far, compacting them in place over their filter bytes.
+	// Inflate only ever writes past the filter byte of the next scanline, so this can trail right behind it.
+	while (_state.pass < GetPassCount() && _state.filteredOffset + 1 + _state.scanlineBytes <= _inflatedBytes)
+	{
+		unsigned char* data = _state.data.data();
+		const unsigned char* prior = (_state.row == 0) ? nullptr : data + _state.priorOffset; // the first scanline of each pass has no prior scanline
 
-					byte += paethPredictor(left, up, upLeft);
+		PNGFilters::UnfilterScanline(data[_state.filteredOffset], data + _state.filteredOffset + 1, data + _state.unfilteredOffset,
+			prior, _state.scanlineBytes, bytesPerPixel);
 
-					break;
-				}
-			}
+		_state.priorOffset = _state.unfilteredOffset;
+		_state.filteredOffset += 1 + _state.scanlineBytes;
+		_state.unfilteredOffset += _state.scanlineBytes;
+		_state.row++;
 
-			_decompressedData[i++] = byte % 256; // keep in byte format
+		if (_state.row == _state.passHeight)
+		{
+			DispatchConversion(_state);
+			BeginPass(_state, _state.pass + 1);
+		}
+		else if (_state.row - _state.pendingRow >= _state.rowsPerTask)
+		{
+			DispatchConversion(_state);
 		}
 	}
 }
 
-void PNGProperties::ReadIDATData(std::vector<unsigned char>& _unfiltered)
+void PNGProperties::BeginPass(PNGDecodeState& _state, unsigned int _pass)
 {
-	BitReader br = BitReader(_unfiltered.data());
-	pixels.resize((size_t)(width * height), Color(1, 0, 1, 1));
+	// Skip passes with no pixels, they contain no scanlines at all
+	for (; _pass < GetPassCount(); _pass++)
+	{
+		GetPassSize(_pass, _state.passWidth, _state.passHeight);
 
-	if (interlaceMethod == 0)
+		if (_state.passWidth != 0)
+			break;
+	}
+
+	_state.pass = _pass;
+	_state.row = 0;
+	_state.scanlineBytes = GetScanlineBytes(_state.passWidth);
+
+	_state.pendingRow = 0;
+	_state.pendingOffset = _state.unfilteredOffset;
+	_state.rowsPerTask = std::max(1u, CONVERT_TASK_PIXELS / std::max(1u, _state.passWidth));
+}
+
+void PNGProperties::BeginConversion(PNGDecodeState& _state)
+{
+	const float gammaPower = GetGammaPower();
+	const bool hasGamma = (gammaPower != 1.f);
+
+	// Pick the converter for this colour type / bit depth / output format once, it unpacks a whole scanline per call
+	_state.convert = PNGConverters::GetConverter(colourType, bitDepth, pixelFormat, !hasGamma);
+
+	if (_state.convert == nullptr)
 	{
-		for (unsigned int i = 0; i < width * height; i++)
-		{
-			if (i != 0 && i % width == 0) // if a scanline doesn't end on a byte boundary, skip to next byte
-			{
-				br.NextByte();
-			}
+		throw std::runtime_error("No converter for colour type " + std::to_string((unsigned int)(unsigned char)colourType) + " at bit depth " +
+			std::to_string((unsigned int)(unsigned char)bitDepth) + ".");
+	}
 
-			pixels[i] = GetNextPixel(br);
-		}
+	// Raw sample -> output channel tables, built once per image. Gamma only applies to the colour channels,
+	// so converters never call powf and gamma tagged images convert as fast as untagged ones.
+	_state.sampleTable.resize(PNGConverters::GetSampleTableSize(bitDepth, pixelFormat));
+	_state.alphaTable.resize(_state.sampleTable.size());
+
+	PNGConverters::BuildSampleTable(bitDepth, pixelFormat, _state.alphaTable.data());
+
+	if (hasGamma)
+	{
+		PNGConverters::BuildGammaTable(bitDepth, pixelFormat, gammaPower, _state.sampleTable.data());
 	}
-	else
+	else _state.sampleTable = _state.alphaTable;
+
+	if (colourType == 3)
 	{
-		unsigned char startingRows[7] = { 0, 0, 4, 0, 2, 0, 1 }, startingCols[7] = { 0, 4, 0, 2, 0, 1, 0 };
-		unsigned char rowIncrement[7] = { 8, 8, 8, 4, 4, 2, 2 }, colIncrement[7] = { 8, 8, 4, 4, 2, 2, 1 };
+		BuildPaletteTable(_state.paletteTable);
+	}
 
-		for (unsigned int pass = 0; pass < 7; pass++)
+	PNGConvertParams& params = _state.params;
+	params.sampleTable = _state.sampleTable.data();
+	params.alphaTable = _state.alphaTable.data();
+	params.palette = _state.paletteTable.data();
+	params.paletteSize = (unsigned int)palette.size();
+	params.hasTRNS = hasTRNS && (colourType == 0 || colourType == 2);
+	std::copy(trnsSamples, trnsSamples + 3, params.trnsSamples);
+
+	_state.convertInline = (!_state.pooledConversion || (size_t)width * height <= CONVERT_TASK_PIXELS);
+
+	if (!_state.streamingRows)
+	{
+		pixels.assign((size_t)width * height * PixelFormatInfo::GetBytesPerPixel(pixelFormat), 0);
+	}
+}
+
+void PNGProperties::DispatchConversion(PNGDecodeState& _state)
+{
+	unsigned int firstRow = _state.pendingRow, rowCount = _state.row - _state.pendingRow;
+
+	if (rowCount == 0)
+		return;
+
+	// Unfiltered scanlines are never written again, so they can be converted while later ones are still being inflated.
+	// Each task writes its own rows (or its own pixels of them when interlaced), so tasks never touch the same bytes.
+	const unsigned char* scanlines = _state.data.data() + _state.pendingOffset;
+	unsigned int pass = _state.pass;
+
+	// The last rows of the image leave the loading thread nothing to do but wait, so they're converted right here
+	if (_state.convertInline || (_state.row == _state.passHeight && IsLastPass(pass)))
+	{
+		ConvertRows(_state, pass, firstRow, rowCount, scanlines);
+	}
+	else
+	{
+		_state.conversions.Run([this, &_state, pass, firstRow, rowCount, scanlines]()
 		{
-			for (unsigned int row = startingRows[pass]; row < height; row += rowIncrement[pass])
-			{
-				for (unsigned int col = startingCols[pass]; col < width; col += colIncrement[pass])
-				{
-					unsigned int index = (row * width) + col;
-					pixels[index] = GetNextPixel(br);
-				}
+			ConvertRows(_state, pass, firstRow, rowCount, scanlines);
+		});
+	}
 
-				// if a scanline doesn't end on a byte boundary, skip to next byte
-				br.NextByte();
-			}
-		}
+	_state.pendingRow = _state.row;
+	_state.pendingOffset = _state.unfilteredOffset;
+}
+
+void PNGProperties::ConvertRows(const PNGDecodeState& _state, unsigned int _pass, unsigned int _firstRow, unsigned int _rowCount, const unsigned char* _scanlines)
+{
+	const size_t bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+
+	unsigned int passWidth, passHeight;
+	GetPassSize(_pass, passWidth, passHeight);
+
+	const size_t scanlineBytes = GetScanlineBytes(passWidth);
+
+	// Interlaced passes write every n'th pixel of every n'th row
+	unsigned int startingRow = 0, startingCol = 0, rowIncrement = 1, colIncrement = 1;
+
+	if (interlaceMethod != 0)
+	{
+		startingRow = ADAM7_STARTING_ROWS[_pass], startingCol = ADAM7_STARTING_COLS[_pass];
+		rowIncrement = ADAM7_ROW_INCREMENT[_pass], colIncrement = ADAM7_COL_INCREMENT[_pass];
+	}
+
+	for (unsigned int row = _firstRow; row < _firstRow + _rowCount; row++, _scanlines += scanlineBytes)
+	{
+		size_t index = (size_t)(startingRow + row * rowIncrement) * width + startingCol;
+
+		_state.convert(_scanlines, passWidth, pixels.GetWritableData() + index * bytesPerPixel, colIncrement * bytesPerPixel, _state.params);
 	}
 }
 
-void PNGProperties::CheckSignature(std::ifstream& _reader)
+void PNGProperties::CheckSignature(const char* _signature)
 {
 	constexpr char pngSignature[8] = { -119, 80, 78, 71, 13, 10, 26, 10 };
-	const char* pngSig = R2D_BH::ReadBytesIntoStr(_reader, 8);
+	const char* pngSig = _signature;
 
 	if (!R2D_BH::CompCharArrToStr(pngSig, pngSignature, 8))
 	{
@@ -407,35 +1003,61 @@ void PNGProperties::CheckSignature(std::ifstream& _reader)
 	}
 }
 
+void PNGProperties::CheckCRC(const PNGChunk& _chunk)
+{
+	// CRC is present at the end of every chunk, even empty ones
+	// Check the stored checksum against the one computed over chunk type + data
+	if (!GetVerifyChecksums())
+		return;
+
+	unsigned int crc = CRC32::Compute((const unsigned char*)_chunk.type, _chunk.length + 4);
+	unsigned int storedCRC = R2D_BH::CharArrToUInt((const char*)_chunk.data + _chunk.length, 4);
+
+	if (crc != storedCRC)
+	{
+		throw std::runtime_error("Stored checksum for " + std::string(_chunk.type, 4) + " chunk does not match pre-computed checksum.");
+	}
+}
+
 void PNGProperties::CheckIHDRData()
 {
 	std::string errorType = "", errorData = "";
 
-	const std::vector<unsigned char> allowedColourTypes = { 0, 2, 3, 4, 6 };
-	if (std::find(allowedColourTypes.begin(), allowedColourTypes.end(), colourType) == allowedColourTypes.end())
+	constexpr unsigned char allowedColourTypes[5] = { 0, 2, 3, 4, 6 };
+	if (std::find(allowedColourTypes, allowedColourTypes + 5, colourType) == allowedColourTypes + 5)
+	{
+		errorType = "colour type", errorData = std::to_string((unsigned int)(unsigned char)colourType);
+	}
+
+	// Gray takes every depth, indexed up to 8 and the rest only 8 or 16
+	bool validBitDepth = false;
+	switch (colourType)
 	{
-		errorType = "colour type", errorData = std::to_string((unsigned int)colourType);
+		case 0:	validBitDepth = (bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16);	break;
+		case 3:	validBitDepth = (bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8);					break;
+		case 2:
+		case 4:
+		case 6:	validBitDepth = (bitDepth == 8 || bitDepth == 16);													break;
 	}
 
-	constexpr unsigned short allowedBitDepths[7] = { 0b11111, 0b0, 0b11000, 0b1111, 0b11000, 0b0, 0b11000 };
-	if (!(bitDepth & allowedBitDepths[colourType]))
+	if (errorType == "" && !validBitDepth)
 	{
-		errorType = "bit depth", errorData = std::to_string((unsigned int)bitDepth);
+		errorType = "bit depth", errorData = std::to_string((unsigned int)(unsigned char)bitDepth);
 	}
 
 	if (compressionMethod != 0)
 	{
-		errorType = "compression method", errorData = std::to_string((unsigned int)compressionMethod);
+		errorType = "compression method", errorData = std::to_string((unsigned int)(unsigned char)compressionMethod);
 	}
 
 	if (filterMethod != 0)
 	{
-		errorType = "filter method", errorData = std::to_string((unsigned int)filterMethod);
+		errorType = "filter method", errorData = std::to_string((unsigned int)(unsigned char)filterMethod);
 	}
 
 	if (interlaceMethod != 0 && interlaceMethod != 1)
 	{
-		errorType = "interlace method", errorData = std::to_string((unsigned int)interlaceMethod);
+		errorType = "interlace method", errorData = std::to_string((unsigned int)(unsigned char)interlaceMethod);
 	}
 
 	if (errorType != "" && errorData != "")
@@ -450,129 +1072,171 @@ bool PNGProperties::IsAncillaryChunk(const char* _chunkType)
 	return (_chunkType[0] & 0b100000) != 0;
 }
 
-void PNGProperties::GetScanlineVars(std::vector<unsigned short>& _scanlineLengths, std::vector<unsigned short>& _startingRows, unsigned int& _totalScanlines)
+bool PNGProperties::IsChunkType(const PNGChunk& _chunk, const char* _chunkType)
 {
-	if (interlaceMethod == 0)
-	{
-		_scanlineLengths = std::vector<unsigned short>(height, width);
-		_startingRows = std::vector<unsigned short>(height, 0);
-		_totalScanlines = height;
+	return R2D_BH::CompCharArrToStr(_chunk.type, _chunkType, 4);
+}
 
-		return;
-	}
+unsigned int PNGProperties::GetBitsPerPixel()
+{
+	constexpr char channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+
+	return (unsigned int)bitDepth * channels[colourType];
+}
 
-	constexpr unsigned char offset[8] = { 0, 0, 4, 0, 2, 0, 1, 0 }, divisor[8] = { 8, 8, 8, 4, 4, 2, 2, 1 };
-	double passes[7] = { 0, 0, 0, 0, 0, 0, 0 }, lengths[7] = { 0, 0, 0, 0, 0, 0, 0 };
-	_totalScanlines = 0;
+size_t PNGProperties::GetScanlineBytes(unsigned int _pixelCount)
+{
+	// Scanlines always end on a byte boundary
+	return ((size_t)_pixelCount * GetBitsPerPixel() + 7) / 8;
+}
+
+size_t PNGProperties::GetDecompressedSize()
+{
+	size_t size = 0;
 
-	for (unsigned int i = 0; i < 7; i++)
+	// Every scanline is prefixed with its filter type byte, empty passes contain no scanlines at all
+	for (unsigned int pass = 0; pass < GetPassCount(); pass++)
 	{
-		if (height > offset[i] && width > offset[i + 1])
-		{
-			passes[i] = ceil((double)(width - offset[i]) / divisor[i]);
-			lengths[i] = ceil((double)(width - offset[i + 1]) / divisor[i + 1]);
+		unsigned int passWidth, passHeight;
+		GetPassSize(pass, passWidth, passHeight);
 
-			_totalScanlines += (unsigned int)passes[i];
+		if (passWidth != 0)
+		{
+			size += (size_t)passHeight * (1 + GetScanlineBytes(passWidth));
 		}
 	}
 
-	_scanlineLengths = std::vector<unsigned short>(_totalScanlines, 0);
-	_startingRows = std::vector<unsigned short>(_totalScanlines, 0);
+	return size;
+}
 
-	for (unsigned int i = 0, index = 0, row = 0; i < 7; i++)
-	{
-		double scanlinesInPass = passes[i];
+unsigned int PNGProperties::GetPassCount()
+{
+	return (interlaceMethod == 0) ? 1 : 7;
+}
 
-		for (unsigned int j = 0; j < scanlinesInPass; j++)
-		{
-			if (index < _startingRows.size())
-			{
-				_startingRows[index] = row;
-				_scanlineLengths[index] = (unsigned short)ceil(lengths[i]);
-				index++;
-			}
-		}
+bool PNGProperties::IsLastPass(unsigned int _pass)
+{
+	for (unsigned int pass = _pass + 1; pass < GetPassCount(); pass++)
+	{
+		unsigned int passWidth, passHeight;
+		GetPassSize(pass, passWidth, passHeight);
 
-		row += (unsigned int)scanlinesInPass;
+		if (passWidth != 0)
+			return false;
 	}
+
+	return true;
 }
 
-Color PNGProperties::GetNextPixel(BitReader& _br)
+void PNGProperties::GetPassSize(unsigned int _pass, unsigned int& _passWidth, unsigned int& _passHeight)
 {
-	Color output = Color();
+	if (interlaceMethod == 0)
+	{
+		_passWidth = width;
+		_passHeight = height;
 
-	float sampleMax = powf(2.f, (float)bitDepth) - 1.f;
+		return;
+	}
 
-	switch (colourType)
+	_passWidth = 0, _passHeight = 0;
+
+	if (width > ADAM7_STARTING_COLS[_pass] && height > ADAM7_STARTING_ROWS[_pass])
 	{
-		case 0: // grayscale
-		{
-			float g = (float)_br.ReadBits(bitDepth);
+		_passWidth = (width - ADAM7_STARTING_COLS[_pass] + ADAM7_COL_INCREMENT[_pass] - 1) / ADAM7_COL_INCREMENT[_pass];
+		_passHeight = (height - ADAM7_STARTING_ROWS[_pass] + ADAM7_ROW_INCREMENT[_pass] - 1) / ADAM7_ROW_INCREMENT[_pass];
+	}
+}
 
-			output = Color(g, g, g, sampleMax, sampleMax);
-			break;
-		}
+void PNGProperties::BuildPaletteTable(std::vector<unsigned char>& _table)
+{
+	const float gammaPower = GetGammaPower();
+	const size_t channelBytes = PixelFormatInfo::GetBytesPerChannel(pixelFormat);
 
-		case 2: // RGB
-		{
-			float r = (float)_br.ReadBits(bitDepth);
-			float g = (float)_br.ReadBits(bitDepth);
-			float b = (float)_br.ReadBits(bitDepth);
+	// 256 entries for every possible index, plus opaque black for indices past the end of the palette
+	_table.resize(257 * 4 * channelBytes);
 
-			output = Color(r, g, b, sampleMax, sampleMax);
-			break;
-		}
+	for (unsigned int i = 0; i < 257; i++)
+	{
+		Color entry = (i < palette.size()) ? palette[i] : Color(0, 0, 0, 1);
 
-		case 3: // indexed
+		if (i < palette.size() && gammaPower != 1.f)
 		{
-			unsigned int paletteIndex = (unsigned int)_br.ReadBits(bitDepth);
-
-			output = palette[paletteIndex];
-			break;
+			entry.r = powf(entry.r, gammaPower);
+			entry.g = powf(entry.g, gammaPower);
+			entry.b = powf(entry.b, gammaPower);
 		}
 
-		case 4: // grayscale + alpha
-		{
-			float g = (float)_br.ReadBits(bitDepth);
-			float a = (float)_br.ReadBits(bitDepth);
+		PNGConverters::WriteChannel(entry.r, pixelFormat, _table.data(), i * 4);
+		PNGConverters::WriteChannel(entry.g, pixelFormat, _table.data(), i * 4 + 1);
+		PNGConverters::WriteChannel(entry.b, pixelFormat, _table.data(), i * 4 + 2);
+		PNGConverters::WriteChannel(entry.a, pixelFormat, _table.data(), i * 4 + 3);
+	}
+}
 
-			output = Color(g, g, g, a, sampleMax);
-			break;
-		}
+float PNGProperties::GetGammaPower()
+{
+	// gAMA of 0 is invalid, treat it as untagged
+	if (gamma <= 0.f || gamma == 1.f)
+		return 1.f;
 
-		case 6: // RGB + alpha
-		{
-			float r = (float)_br.ReadBits(bitDepth);
-			float g = (float)_br.ReadBits(bitDepth);
-			float b = (float)_br.ReadBits(bitDepth);
-			float a = (float)_br.ReadBits(bitDepth);
+	return 1.f / gamma;
+}
 
-			output = Color(r, g, b, a, sampleMax);
-			break;
-		}
-	}
+PNGDecoder::PNGDecoder()
+{
+	mState = new PNGDecodeState();
+}
 
-	ApplyGamma(output);
-	CheckTRNS(output);
+PNGDecoder::~PNGDecoder()
+{
+	delete mState;
+}
 
-	return output;
+void PNGDecoder::Decode(const char* _filePath, PNGProperties& _props, PixelFormat _format, PNGLoadMode _mode)
+{
+	mState->Reset();
+
+	LoadWaitingOnError(_filePath, _props, _format, _mode);
 }
 
-void PNGProperties::ApplyGamma(Color& _color)
+void PNGDecoder::DecodeRows(const char* _filePath, PNGProperties& _props, const PNGRowCallback& _onRow, PixelFormat _format, PNGLoadMode _mode)
 {
-	float gammaPower = 1.f / gamma;
+	mState->Reset();
+	mState->onRow = &_onRow;
 
-	_color.r = powf(_color.r, gammaPower);
-	_color.g = powf(_color.g, gammaPower);
-	_color.b = powf(_color.b, gammaPower);
+	LoadWaitingOnError(_filePath, _props, _format, _mode);
 }
 
-void PNGProperties::CheckTRNS(Color& _color)
+void PNGDecoder::LoadWaitingOnError(const char* _filePath, PNGProperties& _props, PixelFormat _format, PNGLoadMode _mode)
 {
-	// Any pixel that matches the TRNS color should be treated as fully transparent.
-	if ((colourType == 0 && _color.r == trnsColor.r) ||
-		(colourType == 2 && Color::EqualRGB(_color, trnsColor)))
+	try
+	{
+		_props.Load(_filePath, _format, _mode, *mState);
+	}
+	catch (...)
 	{
-		_color.a = 0;
+		// Conversions already queued write to _props and call the row callback, neither may outlive this call.
+		// mState isn't destroyed here the way LoadPNG's state is, so wait for them before the exception goes on
+		mState->conversions.Wait();
+		throw;
 	}
 }
+
+void PNGDecoder::Release()
+{
+	bool pooledConversion = mState->pooledConversion;
+
+	delete mState;
+	mState = new PNGDecodeState();
+	mState->pooledConversion = pooledConversion;
+}
+
+void PNGDecoder::SetPooledConversion(bool _pooled)
+{
+	mState->pooledConversion = _pooled;
+}
+
+bool PNGDecoder::IsPooledConversion() const
+{
+	return mState->pooledConversion;
+}
@@ -1,45 +1,137 @@
 #pragma once
 #include "DLLCommon.h"
 #include "Color.h"
-#include "BitReader.h"
+#include "PixelBuffer.h"
+#include "PixelFormat.h"
 
 #pragma warning(disable : 4251)
+#include <functional>
 #include <vector>
 
+struct PNGDecodeState;
+
+enum RENDERER_API PNGLoadMode
+{
+	STREAMED,		// read chunk by chunk through std::ifstream
+	MEMORY_MAPPED	// map the whole file and parse chunks straight out of the mapping
+};
+
+enum RENDERER_API PNGInflateBackend
+{
+	INFLATE_BUILTIN,	// Inflater, decodes the whole IDAT stream in one go once every chunk has been read
+	INFLATE_ZLIB		// zlib, inflated chunk by chunk as they're read
+};
+
+// View of a single chunk, the type and data point into the buffer the chunk was read into.
+struct RENDERER_API PNGChunk
+{
+	unsigned int length;
+	const char* type;
+	const unsigned char* data;
+};
+
+// Header fields of a PNG file, read without decoding any image data.
+struct RENDERER_API PNGInfo
+{
+	unsigned int width, height;
+	char bitDepth, colourType;
+	bool interlaced;
+
+	// Only filled in when probing scans the chunks between IHDR and the first IDAT
+	bool hasPalette, hasTRNS;
+};
+
+// Receives each decoded row in order, _pixels holds width pixels laid out as the requested PixelFormat
+// and is only valid for the duration of the call.
+typedef std::function<void(unsigned int _row, const unsigned char* _pixels)> PNGRowCallback;
+
 class RENDERER_API PNGProperties
 {
 public:
 	PNGProperties();
 
-	void LoadPNG(const char* _filePath);
+	void LoadPNG(const char* _filePath, PixelFormat _format = RGBA8, PNGLoadMode _mode = MEMORY_MAPPED);
+
+	// Decodes row by row into _onRow instead of pixels, holding about two scanlines plus the inflate window at a time.
+	// Interlaced images can't be finished a row at a time, so those are decoded whole before their rows are emitted.
+	void LoadPNGRows(const char* _filePath, const PNGRowCallback& _onRow, PixelFormat _format = RGBA8, PNGLoadMode _mode = MEMORY_MAPPED);
+
+	// Reads the signature and IHDR only, no IDAT data is read and no pixel storage is allocated.
+	// _scanChunks also walks the chunk headers up to the first IDAT to report PLTE / tRNS, skipping over their data.
+	static PNGInfo Probe(const char* _filePath, bool _scanChunks = false);
+
+	// Picks the decompressor used by LoadPNG, mainly for benchmarking against zlib. LoadPNGRows always uses zlib,
+	// the built-in one needs the whole output buffer as its window.
+	static void SetInflateBackend(PNGInflateBackend _backend);
+	static PNGInflateBackend GetInflateBackend();
+
+	// Trusted assets mode, for files already verified when they were built. Turning this off skips the chunk CRCs
+	// and the zlib Adler-32, so a corrupt file may decode to garbage pixels instead of throwing.
+	static void SetVerifyChecksums(bool _verify);
+	static bool GetVerifyChecksums();
 
 protected:
+	friend class PNGDecoder;
+
+	void Load(const char* _filePath, PixelFormat _format, PNGLoadMode _mode, PNGDecodeState& _state);
+
+	PNGInfo ProbeStreamed(const char* _filePath, bool _scanChunks);
+
+	void LoadStreamed(const char* _filePath, PNGDecodeState& _state);
+	void LoadMapped(const char* _filePath, PNGDecodeState& _state);
+
+	// Chunk reading
+
+	PNGChunk ReadChunk(std::ifstream& _reader, std::vector<unsigned char>& _chunkBuffer, std::streamoff& _remaining);
+	PNGChunk ReadChunk(const unsigned char* _data, size_t _size, size_t& _offset);
+
+	bool HandleChunk(const PNGChunk& _chunk, PNGDecodeState& _state);
+
 	// Chunk handlers
 
-	void Chunk_IHDR(std::ifstream& _reader);
-	void Chunk_PLTE(std::ifstream& _reader, unsigned int _chunkLength);
-	void Chunk_IDAT(std::ifstream& _reader, unsigned int _chunkLength, std::vector<unsigned char>& _data);
-	void Chunk_Ancillary(std::ifstream& _reader, unsigned int _chunkLength, char* _chunkType);
+	void Chunk_IHDR(const PNGChunk& _chunk);
+	void Chunk_PLTE(const PNGChunk& _chunk);
+	void Chunk_IDAT(const PNGChunk& _chunk, PNGDecodeState& _state);
+	void Chunk_Ancillary(const PNGChunk& _chunk);
 
 	// IDAT Flow
 
-	void DecompressIDATData(std::vector<unsigned char>& _compressedData, std::vector<unsigned char>& _decompressedData);
-	void UnfilterIDATData(std::vector<unsigned char>& _decompressedData);
-	void ReadIDATData(std::vector<unsigned char>& _unfiltered);
+	void BeginIDATData(PNGDecodeState& _state);
+	void EndIDATData(PNGDecodeState& _state);
+	void InflateIDATData(PNGDecodeState& _state);
+	void UnfilterIDATData(PNGDecodeState& _state, size_t _inflatedBytes);
+	void BeginPass(PNGDecodeState& _state, unsigned int _pass);
+
+	// Row Streaming Flow
+
+	void InflateRows(const PNGChunk& _chunk, PNGDecodeState& _state);
+	void EmitRow(PNGDecodeState& _state);
+
+	// Conversion Flow
+
+	void BeginConversion(PNGDecodeState& _state);
+	void DispatchConversion(PNGDecodeState& _state);
+	void ConvertRows(const PNGDecodeState& _state, unsigned int _pass, unsigned int _firstRow, unsigned int _rowCount, const unsigned char* _scanlines);
 
 	// Helpers
 
-	void CheckSignature(std::ifstream& _reader);
+	void CheckSignature(const char* _signature);
+	void CheckCRC(const PNGChunk& _chunk);
 	void CheckIHDRData();
 
 	bool IsAncillaryChunk(const char* _chunkType);
+	bool IsChunkType(const PNGChunk& _chunk, const char* _chunkType);
 
-	void GetScanlineVars(std::vector<unsigned short>& _scanlineLengths, std::vector<unsigned short>& _startingRows, unsigned int& _totalScanlines);
+	unsigned int GetBitsPerPixel();
+	size_t GetScanlineBytes(unsigned int _pixelCount);
+	size_t GetDecompressedSize();
 
-	Color GetNextPixel(BitReader& _br);
+	unsigned int GetPassCount();
+	bool IsLastPass(unsigned int _pass); // no pass after _pass has any pixels
+	void GetPassSize(unsigned int _pass, unsigned int& _passWidth, unsigned int& _passHeight);
 
-	void ApplyGamma(Color& _color);
-	void CheckTRNS(Color& _color);
+	void BuildPaletteTable(std::vector<unsigned char>& _table);
+	float GetGammaPower();
 
 public:
 	unsigned int width, height;
@@ -48,8 +140,42 @@ public:
 		filterMethod, interlaceMethod;
 
 	std::vector<Color> palette;
-	std::vector<Color> pixels;
 
-	Color trnsColor;
-	float gamma;
-};
\ No newline at end of file
+	PixelFormat pixelFormat;
+	PixelBuffer pixels; // width * height pixels laid out as pixelFormat, shared between copies
+
+	bool hasTRNS;
+	unsigned short trnsSamples[3]; // raw gray or RGB samples that tRNS marks as fully transparent
+	float gamma; // file gamma as stored in gAMA
+};
+
+// Decodes any number of images through one set of inflate state, scanline, table and chunk buffers,
+// which grow to the largest image seen and are then re-used, so batches of small images barely touch the heap.
+// Not thread safe, use one decoder per thread.
+class RENDERER_API PNGDecoder
+{
+public:
+	PNGDecoder();
+	~PNGDecoder();
+
+	PNGDecoder(const PNGDecoder&) = delete;
+	PNGDecoder& operator=(const PNGDecoder&) = delete;
+
+	// Same as PNGProperties::LoadPNG / LoadPNGRows. Re-using _props also re-uses its pixel and palette storage.
+	void Decode(const char* _filePath, PNGProperties& _props, PixelFormat _format = RGBA8, PNGLoadMode _mode = MEMORY_MAPPED);
+	void DecodeRows(const char* _filePath, PNGProperties& _props, const PNGRowCallback& _onRow, PixelFormat _format = RGBA8, PNGLoadMode _mode = MEMORY_MAPPED);
+
+	// Frees everything held on to between decodes
+	void Release();
+
+	// Off converts rows on the calling thread only. Decoders running on pool workers must turn this off,
+	// waiting on conversion tasks queued behind other decodes on the same pool could deadlock it.
+	void SetPooledConversion(bool _pooled);
+	bool IsPooledConversion() const;
+
+protected:
+	// _props.Load through mState, waiting for its queued conversions if it throws
+	void LoadWaitingOnError(const char* _filePath, PNGProperties& _props, PixelFormat _format, PNGLoadMode _mode);
+
+	PNGDecodeState* mState;
+};
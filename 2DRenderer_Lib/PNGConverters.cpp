@@ -0,0 +1,359 @@
+#include "PNGConverters.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Channel type and count of each output format
+template <PixelFormat FORMAT> struct FormatTraits;
+template <> struct FormatTraits<R8>			{ typedef unsigned char Channel;	static constexpr unsigned int CHANNELS = 1; };
+template <> struct FormatTraits<RG8>		{ typedef unsigned char Channel;	static constexpr unsigned int CHANNELS = 2; };
+template <> struct FormatTraits<RGBA8>		{ typedef unsigned char Channel;	static constexpr unsigned int CHANNELS = 4; };
+template <> struct FormatTraits<RGBA16>		{ typedef unsigned short Channel;	static constexpr unsigned int CHANNELS = 4; };
+template <> struct FormatTraits<RGBA32F>	{ typedef float Channel;			static constexpr unsigned int CHANNELS = 4; };
+template <> struct FormatTraits<BGRA8>		{ typedef unsigned char Channel;	static constexpr unsigned int CHANNELS = 4; };
+
+// Writes one pixel, R8 keeps the first channel, RG8 the first channel + alpha and BGRA8 swaps red and blue
+template <PixelFormat FORMAT, typename T>
+static inline void StorePixel(unsigned char* _dst, T _r, T _g, T _b, T _a)
+{
+	T* dst = (T*)_dst;
+
+	switch (FormatTraits<FORMAT>::CHANNELS)
+	{
+		case 1: dst[0] = _r; break;
+		case 2: dst[0] = _r; dst[1] = _a; break;
+		case 4:
+		{
+			if (FORMAT == BGRA8)
+			{
+				dst[0] = _b; dst[1] = _g; dst[2] = _r; dst[3] = _a;
+			}
+			else
+			{
+				dst[0] = _r; dst[1] = _g; dst[2] = _b; dst[3] = _a;
+			}
+			break;
+		}
+	}
+}
+
+// Packed byte -> its 1, 2 or 4-bit samples, most significant first
+template <unsigned int BIT_DEPTH>
+struct UnpackTable
+{
+	static constexpr unsigned int SAMPLES_PER_BYTE = 8 / BIT_DEPTH;
+
+	UnpackTable()
+	{
+		constexpr unsigned int sampleMask = (1u << BIT_DEPTH) - 1;
+
+		for (unsigned int byte = 0; byte < 256; byte++)
+		{
+			for (unsigned int s = 0; s < SAMPLES_PER_BYTE; s++)
+			{
+				samples[byte][s] = (unsigned char)((byte >> (8 - BIT_DEPTH * (s + 1))) & sampleMask);
+			}
+		}
+	}
+
+	static const UnpackTable& Get()
+	{
+		static const UnpackTable table = UnpackTable();
+		return table;
+	}
+
+	unsigned char samples[256][SAMPLES_PER_BYTE];
+};
+
+// Raw 8 and 16-bit samples, 16-bit samples are stored big-endian
+template <unsigned int BIT_DEPTH>
+static inline unsigned int ReadSample(const unsigned char* _src, unsigned int _index);
+
+template <>
+inline unsigned int ReadSample<8>(const unsigned char* _src, unsigned int _index)
+{
+	return _src[_index];
+}
+
+template <>
+inline unsigned int ReadSample<16>(const unsigned char* _src, unsigned int _index)
+{
+	return ((unsigned int)_src[_index * 2] << 8) | _src[_index * 2 + 1];
+}
+
+// Converters
+
+template <PixelFormat FORMAT>
+static inline void StoreGray(unsigned char* _dst, unsigned int _sample, const PNGConvertParams& _params,
+	const typename FormatTraits<FORMAT>::Channel* _samples, const typename FormatTraits<FORMAT>::Channel* _alphas, unsigned int _sampleMax)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+
+	T g = _samples[_sample];
+	T a = (_params.hasTRNS && _sample == _params.trnsSamples[0]) ? _alphas[0] : _alphas[_sampleMax];
+
+	StorePixel<FORMAT>(_dst, g, g, g, a);
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertGray(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+	const T* samples = (const T*)_params.sampleTable;
+	const T* alphas = (const T*)_params.alphaTable;
+
+	for (unsigned int i = 0; i < _count; i++, _dst += _dstStride)
+	{
+		StoreGray<FORMAT>(_dst, ReadSample<BIT_DEPTH>(_src, i), _params, samples, alphas, (1u << BIT_DEPTH) - 1);
+	}
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertGraySubByte(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+	const T* samples = (const T*)_params.sampleTable;
+	const T* alphas = (const T*)_params.alphaTable;
+
+	const UnpackTable<BIT_DEPTH>& unpack = UnpackTable<BIT_DEPTH>::Get();
+
+	for (unsigned int i = 0; i < _count; _src++)
+	{
+		const unsigned char* unpacked = unpack.samples[*_src];
+
+		for (unsigned int s = 0; s < UnpackTable<BIT_DEPTH>::SAMPLES_PER_BYTE && i < _count; s++, i++, _dst += _dstStride)
+		{
+			StoreGray<FORMAT>(_dst, unpacked[s], _params, samples, alphas, (1u << BIT_DEPTH) - 1);
+		}
+	}
+}
+
+template <PixelFormat FORMAT>
+static inline void StorePaletteEntry(unsigned char* _dst, unsigned int _index, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+
+	// Out of range indices are opaque black, entry 256 is reserved for that
+	const T* entry = (const T*)_params.palette + ((_index < _params.paletteSize) ? _index : 256) * 4;
+
+	StorePixel<FORMAT>(_dst, entry[0], entry[1], entry[2], entry[3]);
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertPaletteSubByte(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	const UnpackTable<BIT_DEPTH>& unpack = UnpackTable<BIT_DEPTH>::Get();
+
+	for (unsigned int i = 0; i < _count; _src++)
+	{
+		const unsigned char* unpacked = unpack.samples[*_src];
+
+		for (unsigned int s = 0; s < UnpackTable<BIT_DEPTH>::SAMPLES_PER_BYTE && i < _count; s++, i++, _dst += _dstStride)
+		{
+			StorePaletteEntry<FORMAT>(_dst, unpacked[s], _params);
+		}
+	}
+}
+
+template <PixelFormat FORMAT>
+static void ConvertPalette8(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	for (unsigned int i = 0; i < _count; i++, _dst += _dstStride)
+	{
+		StorePaletteEntry<FORMAT>(_dst, _src[i], _params);
+	}
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertRGB(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+	const T* samples = (const T*)_params.sampleTable;
+	const T* alphas = (const T*)_params.alphaTable;
+
+	const T opaque = alphas[(1u << BIT_DEPTH) - 1], transparent = alphas[0];
+
+	for (unsigned int i = 0; i < _count; i++, _dst += _dstStride)
+	{
+		unsigned int r = ReadSample<BIT_DEPTH>(_src, i * 3);
+		unsigned int g = ReadSample<BIT_DEPTH>(_src, i * 3 + 1);
+		unsigned int b = ReadSample<BIT_DEPTH>(_src, i * 3 + 2);
+
+		bool isTransparent = _params.hasTRNS && r == _params.trnsSamples[0] && g == _params.trnsSamples[1] && b == _params.trnsSamples[2];
+
+		StorePixel<FORMAT>(_dst, samples[r], samples[g], samples[b], isTransparent ? transparent : opaque);
+	}
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertGrayAlpha(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+	const T* samples = (const T*)_params.sampleTable;
+	const T* alphas = (const T*)_params.alphaTable;
+
+	for (unsigned int i = 0; i < _count; i++, _dst += _dstStride)
+	{
+		T g = samples[ReadSample<BIT_DEPTH>(_src, i * 2)];
+		StorePixel<FORMAT>(_dst, g, g, g, alphas[ReadSample<BIT_DEPTH>(_src, i * 2 + 1)]);
+	}
+}
+
+template <PixelFormat FORMAT, unsigned int BIT_DEPTH>
+static void ConvertRGBA(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params)
+{
+	typedef typename FormatTraits<FORMAT>::Channel T;
+	const T* samples = (const T*)_params.sampleTable;
+	const T* alphas = (const T*)_params.alphaTable;
+
+	for (unsigned int i = 0; i < _count; i++, _dst += _dstStride)
+	{
+		StorePixel<FORMAT>(_dst, samples[ReadSample<BIT_DEPTH>(_src, i * 4)], samples[ReadSample<BIT_DEPTH>(_src, i * 4 + 1)],
+			samples[ReadSample<BIT_DEPTH>(_src, i * 4 + 2)], alphas[ReadSample<BIT_DEPTH>(_src, i * 4 + 3)]);
+	}
+}
+
+// Source samples that already match the output byte for byte, 8-bit RGBA -> RGBA8 and friends
+template <unsigned int BYTES_PER_PIXEL>
+static void CopyScanline(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams&)
+{
+	if (_dstStride == BYTES_PER_PIXEL)
+	{
+		memcpy(_dst, _src, (size_t)_count * BYTES_PER_PIXEL);
+		return;
+	}
+
+	for (unsigned int i = 0; i < _count; i++, _src += BYTES_PER_PIXEL, _dst += _dstStride)
+	{
+		memcpy(_dst, _src, BYTES_PER_PIXEL);
+	}
+}
+
+template <PixelFormat FORMAT>
+static PNGScanlineConverter GetFormatConverter(unsigned int _colourType, unsigned int _bitDepth)
+{
+	switch (_colourType)
+	{
+		case 0: // grayscale
+		{
+			switch (_bitDepth)
+			{
+				case 1:		return ConvertGraySubByte<FORMAT, 1>;
+				case 2:		return ConvertGraySubByte<FORMAT, 2>;
+				case 4:		return ConvertGraySubByte<FORMAT, 4>;
+				case 8:		return ConvertGray<FORMAT, 8>;
+				case 16:	return ConvertGray<FORMAT, 16>;
+			}
+			break;
+		}
+
+		case 2: // RGB
+		{
+			if (_bitDepth == 8) return ConvertRGB<FORMAT, 8>;
+			if (_bitDepth == 16) return ConvertRGB<FORMAT, 16>;
+			break;
+		}
+
+		case 3: // indexed
+		{
+			switch (_bitDepth)
+			{
+				case 1:		return ConvertPaletteSubByte<FORMAT, 1>;
+				case 2:		return ConvertPaletteSubByte<FORMAT, 2>;
+				case 4:		return ConvertPaletteSubByte<FORMAT, 4>;
+				case 8:		return ConvertPalette8<FORMAT>;
+			}
+			break;
+		}
+
+		case 4: // grayscale + alpha
+		{
+			if (_bitDepth == 8) return ConvertGrayAlpha<FORMAT, 8>;
+			if (_bitDepth == 16) return ConvertGrayAlpha<FORMAT, 16>;
+			break;
+		}
+
+		case 6: // RGB + alpha
+		{
+			if (_bitDepth == 8) return ConvertRGBA<FORMAT, 8>;
+			if (_bitDepth == 16) return ConvertRGBA<FORMAT, 16>;
+			break;
+		}
+	}
+
+	return nullptr;
+}
+
+PNGScanlineConverter PNGConverters::GetConverter(unsigned int _colourType, unsigned int _bitDepth, PixelFormat _format, bool _identity)
+{
+	if (_identity && _bitDepth == 8)
+	{
+		if (_colourType == 6 && _format == RGBA8) return CopyScanline<4>;
+		if (_colourType == 4 && _format == RG8) return CopyScanline<2>;
+	}
+
+	switch (_format)
+	{
+		case R8:		return GetFormatConverter<R8>(_colourType, _bitDepth);
+		case RG8:		return GetFormatConverter<RG8>(_colourType, _bitDepth);
+		case RGBA8:		return GetFormatConverter<RGBA8>(_colourType, _bitDepth);
+		case RGBA16:	return GetFormatConverter<RGBA16>(_colourType, _bitDepth);
+		case RGBA32F:	return GetFormatConverter<RGBA32F>(_colourType, _bitDepth);
+		case BGRA8:		return GetFormatConverter<BGRA8>(_colourType, _bitDepth);
+		default:		return nullptr;
+	}
+}
+
+void PNGConverters::BuildSampleTable(unsigned int _bitDepth, PixelFormat _format, void* _table)
+{
+	const unsigned int sampleMax = (1u << _bitDepth) - 1;
+
+	// Integer formats round to the nearest value, which keeps 8-bit -> 8-bit and 16-bit -> 16-bit exact
+	for (unsigned int i = 0; i <= sampleMax; i++)
+	{
+		switch (_format)
+		{
+			case R8:
+			case RG8:
+			case RGBA8:
+			case BGRA8:		((unsigned char*)_table)[i] = (unsigned char)((i * 255u + sampleMax / 2) / sampleMax);				break;
+			case RGBA16:	((unsigned short*)_table)[i] = (unsigned short)(((unsigned long long)i * 65535u + sampleMax / 2) / sampleMax);	break;
+			case RGBA32F:	((float*)_table)[i] = (float)i / (float)sampleMax;													break;
+			default:		throw std::runtime_error("No sample table for pixel format " + std::to_string((int)_format) + ".");
+		}
+	}
+}
+
+void PNGConverters::BuildGammaTable(unsigned int _bitDepth, PixelFormat _format, float _gammaPower, void* _table)
+{
+	const unsigned int sampleMax = (1u << _bitDepth) - 1;
+	const float invSampleMax = 1.f / (float)sampleMax;
+
+	for (unsigned int i = 0; i <= sampleMax; i++)
+	{
+		WriteChannel(powf((float)i * invSampleMax, _gammaPower), _format, _table, i);
+	}
+}
+
+void PNGConverters::WriteChannel(float _value, PixelFormat _format, void* _table, size_t _index)
+{
+	float clamped = std::fmax(std::fmin(_value, 1.f), 0.f);
+
+	switch (_format)
+	{
+		case R8:
+		case RG8:
+		case RGBA8:
+		case BGRA8:		((unsigned char*)_table)[_index] = (unsigned char)(clamped * 255.f + 0.5f);		break;
+		case RGBA16:	((unsigned short*)_table)[_index] = (unsigned short)(clamped * 65535.f + 0.5f);	break;
+		case RGBA32F:	((float*)_table)[_index] = _value;												break;
+		default:		throw std::runtime_error("No sample table for pixel format " + std::to_string((int)_format) + ".");
+	}
+}
+
+size_t PNGConverters::GetSampleTableSize(unsigned int _bitDepth, PixelFormat _format)
+{
+	return ((size_t)1 << _bitDepth) * PixelFormatInfo::GetBytesPerChannel(_format);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "DLLCommon.h"
+#include "PixelFormat.h"
+
+#include <cstddef>
+
+// Per image inputs the scanline converters need besides the scanline itself.
+// The tables hold values of the output format's channel type (unsigned char, unsigned short or float).
+struct RENDERER_API PNGConvertParams
+{
+	const void* sampleTable;	// raw sample -> colour channel value, one entry per sample value
+	const void* alphaTable;		// raw sample -> alpha channel value
+	const void* palette;		// RGBA entries for indexed images
+	unsigned int paletteSize;
+
+	bool hasTRNS;
+	unsigned short trnsSamples[3]; // raw gray or RGB samples that are fully transparent
+};
+
+// Unpacks _count pixels of an unfiltered scanline into _dst, _dstStride is the number of bytes between output pixels.
+typedef void (*PNGScanlineConverter)(const unsigned char* _src, unsigned int _count, unsigned char* _dst, size_t _dstStride, const PNGConvertParams& _params);
+
+// Scanline converters generated at compile time for each valid colour type / bit depth pair and output format.
+class RENDERER_API PNGConverters
+{
+public:
+	// Returns nullptr if the pair isn't allowed by the PNG spec. _identity means the tables map samples
+	// to themselves, which lets formats that already match the output be copied straight through.
+	static PNGScanlineConverter GetConverter(unsigned int _colourType, unsigned int _bitDepth, PixelFormat _format, bool _identity);
+
+	// Fills _table with 2^_bitDepth entries mapping a raw sample to the format's channel type.
+	static void BuildSampleTable(unsigned int _bitDepth, PixelFormat _format, void* _table);
+
+	// Same as BuildSampleTable, with every normalised sample raised to _gammaPower first.
+	static void BuildGammaTable(unsigned int _bitDepth, PixelFormat _format, float _gammaPower, void* _table);
+
+	// Writes a normalised 0-1 value as entry _index of a table of the format's channel type.
+	static void WriteChannel(float _value, PixelFormat _format, void* _table, size_t _index);
+
+	// Size in bytes of the table BuildSampleTable fills.
+	static size_t GetSampleTableSize(unsigned int _bitDepth, PixelFormat _format);
+};
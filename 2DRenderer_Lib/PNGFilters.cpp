@@ -0,0 +1,387 @@
+#include "PNGFilters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(R2D_X86)
+#include <immintrin.h>
+#endif
+
+typedef void (*UnfilterKernel)(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length);
+
+struct KernelTable
+{
+	UnfilterKernel sub[6];
+	UnfilterKernel up[6];
+	UnfilterKernel average[6];
+	UnfilterKernel paeth[6];
+};
+
+static std::atomic<int> gSIMDLevel = { -1 }; // -1 until first use, then the level in use
+
+// PNG pixels are always 1, 2, 3, 4, 6 or 8 bytes wide (sub-byte pixels filter on single bytes)
+static int GetKernelIndex(size_t _bytesPerPixel)
+{
+	switch (_bytesPerPixel)
+	{
+		case 1: return 0;
+		case 2: return 1;
+		case 3: return 2;
+		case 4: return 3;
+		case 6: return 4;
+		case 8: return 5;
+	}
+
+	return -1;
+}
+
+// Scalar kernels
+
+template <size_t BPP>
+static void SubScalar(const unsigned char* _in, unsigned char* _out, const unsigned char*, size_t _length)
+{
+	for (size_t i = 0; i < BPP; i++) _out[i] = _in[i];
+	for (size_t i = BPP; i < _length; i++) _out[i] = (unsigned char)(_in[i] + _out[i - BPP]);
+}
+
+template <size_t BPP>
+static void UpScalar(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	for (size_t i = 0; i < _length; i++) _out[i] = (unsigned char)(_in[i] + _prior[i]);
+}
+
+template <size_t BPP>
+static void AverageScalar(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	for (size_t i = 0; i < BPP; i++) _out[i] = (unsigned char)(_in[i] + (_prior[i] >> 1));
+	for (size_t i = BPP; i < _length; i++) _out[i] = (unsigned char)(_in[i] + ((_out[i - BPP] + _prior[i]) >> 1));
+}
+
+static inline unsigned char PaethPredictor(int _left, int _up, int _upLeft)
+{
+	// Distances from the initial estimate p = left + up - upLeft to left, up and upLeft
+	int pa = abs(_up - _upLeft);
+	int pb = abs(_left - _upLeft);
+	int pc = abs(_up - _upLeft + _left - _upLeft);
+
+	// Use the minimum distance, written as selects so the compiler can avoid branches
+	int nearest = (pb <= pc) ? _up : _upLeft;
+	return (unsigned char)((pa <= pb && pa <= pc) ? _left : nearest);
+}
+
+template <size_t BPP>
+static void PaethScalar(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	for (size_t i = 0; i < BPP; i++) _out[i] = (unsigned char)(_in[i] + _prior[i]);
+	for (size_t i = BPP; i < _length; i++) _out[i] = (unsigned char)(_in[i] + PaethPredictor(_out[i - BPP], _prior[i], _prior[i - BPP]));
+}
+
+// First scanline of a pass, the prior scanline is all zeroes
+static void AverageFirstRow(const unsigned char* _in, unsigned char* _out, size_t _length, size_t _bytesPerPixel)
+{
+	for (size_t i = 0; i < _bytesPerPixel; i++) _out[i] = _in[i];
+	for (size_t i = _bytesPerPixel; i < _length; i++) _out[i] = (unsigned char)(_in[i] + (_out[i - _bytesPerPixel] >> 1));
+}
+
+#if defined(R2D_X86)
+
+// SSE2 kernels, one pixel per step for SUB/AVERAGE/PAETH since each pixel depends on the one
+// before it. Loads and stores touch exactly BPP bytes so rows can be unfiltered in place.
+
+// WIDE loads read a whole 4 or 8 bytes, only used while that stays inside the scanline
+template <size_t BPP, bool WIDE = false>
+R2D_TARGET("sse2") static inline __m128i LoadPixel(const unsigned char* _src)
+{
+	if (BPP <= 4)
+	{
+		std::uint32_t value = 0;
+		memcpy(&value, _src, WIDE ? 4 : BPP);
+		return _mm_cvtsi32_si128((int)value);
+	}
+
+	std::uint64_t value = 0;
+	memcpy(&value, _src, WIDE ? 8 : BPP);
+	return _mm_loadl_epi64((const __m128i*)&value);
+}
+
+template <size_t BPP>
+R2D_TARGET("sse2") static inline void StorePixel(unsigned char* _dst, __m128i _value)
+{
+	if (BPP <= 4)
+	{
+		std::uint32_t value = (std::uint32_t)_mm_cvtsi128_si32(_value);
+		memcpy(_dst, &value, BPP);
+		return;
+	}
+
+	std::uint64_t value = 0;
+	_mm_storel_epi64((__m128i*)&value, _value);
+	memcpy(_dst, &value, BPP);
+}
+
+template <size_t BPP>
+R2D_TARGET("sse2") static void SubSSE2(const unsigned char* _in, unsigned char* _out, const unsigned char*, size_t _length)
+{
+	constexpr size_t WIDTH = (BPP <= 4) ? 4 : 8;
+	__m128i left = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; i + WIDTH <= _length; i += BPP)
+	{
+		left = _mm_add_epi8(left, LoadPixel<BPP, true>(_in + i));
+		StorePixel<BPP>(_out + i, left);
+	}
+
+	for (; i < _length; i += BPP)
+	{
+		left = _mm_add_epi8(left, LoadPixel<BPP>(_in + i));
+		StorePixel<BPP>(_out + i, left);
+	}
+}
+
+R2D_TARGET("sse2") static void UpSSE2(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= _length; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(_in + i));
+		__m128i up = _mm_loadu_si128((const __m128i*)(_prior + i));
+		_mm_storeu_si128((__m128i*)(_out + i), _mm_add_epi8(x, up));
+	}
+
+	for (; i < _length; i++) _out[i] = (unsigned char)(_in[i] + _prior[i]);
+}
+
+template <size_t BPP>
+R2D_TARGET("sse2") static void AverageSSE2(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	constexpr size_t WIDTH = (BPP <= 4) ? 4 : 8;
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i left = _mm_setzero_si128();
+
+	// _mm_avg_epu8 rounds up, the filter rounds down
+	auto step = [&](__m128i _up, __m128i _x)
+		{
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(left, _up), _mm_and_si128(_mm_xor_si128(left, _up), one));
+			left = _mm_add_epi8(average, _x);
+		};
+
+	size_t i = 0;
+
+	for (; i + WIDTH <= _length; i += BPP)
+	{
+		step(LoadPixel<BPP, true>(_prior + i), LoadPixel<BPP, true>(_in + i));
+		StorePixel<BPP>(_out + i, left);
+	}
+
+	for (; i < _length; i += BPP)
+	{
+		step(LoadPixel<BPP>(_prior + i), LoadPixel<BPP>(_in + i));
+		StorePixel<BPP>(_out + i, left);
+	}
+}
+
+R2D_TARGET("sse2") static inline __m128i Abs16(__m128i _x)
+{
+	return _mm_max_epi16(_x, _mm_sub_epi16(_mm_setzero_si128(), _x));
+}
+
+R2D_TARGET("sse2") static inline __m128i Select(__m128i _mask, __m128i _a, __m128i _b)
+{
+	return _mm_or_si128(_mm_and_si128(_mask, _a), _mm_andnot_si128(_mask, _b));
+}
+
+template <size_t BPP>
+R2D_TARGET("sse2") static void PaethSSE2(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	constexpr size_t WIDTH = (BPP <= 4) ? 4 : 8;
+	const __m128i zero = _mm_setzero_si128();
+
+	// left, up and upLeft pixels widened to 16 bits
+	__m128i a = zero, c = zero;
+
+	auto step = [&](__m128i _up, __m128i _x)
+		{
+			__m128i b = _mm_unpacklo_epi8(_up, zero);
+
+			// p = a + b - c, so p - a = b - c, p - b = a - c and p - c = (b - c) + (a - c)
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = _mm_add_epi16(pa, pb);
+
+			pa = Abs16(pa);
+			pb = Abs16(pb);
+			pc = Abs16(pc);
+
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+			// Ties go to a, then b, then c
+			__m128i predictor = Select(_mm_cmpeq_epi16(smallest, pa), a, Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+			__m128i x = _mm_add_epi8(_mm_packus_epi16(predictor, predictor), _x);
+
+			a = _mm_unpacklo_epi8(x, zero);
+			c = b;
+
+			return x;
+		};
+
+	size_t i = 0;
+
+	for (; i + WIDTH <= _length; i += BPP)
+	{
+		StorePixel<BPP>(_out + i, step(LoadPixel<BPP, true>(_prior + i), LoadPixel<BPP, true>(_in + i)));
+	}
+
+	for (; i < _length; i += BPP)
+	{
+		StorePixel<BPP>(_out + i, step(LoadPixel<BPP>(_prior + i), LoadPixel<BPP>(_in + i)));
+	}
+}
+
+// AVX2 only widens UP, the other filters are bound by the dependency on the previous pixel
+R2D_TARGET("avx2") static void UpAVX2(const unsigned char* _in, unsigned char* _out, const unsigned char* _prior, size_t _length)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= _length; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(_in + i));
+		__m256i up = _mm256_loadu_si256((const __m256i*)(_prior + i));
+		_mm256_storeu_si256((__m256i*)(_out + i), _mm256_add_epi8(x, up));
+	}
+
+	for (; i + 16 <= _length; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(_in + i));
+		__m128i up = _mm_loadu_si128((const __m128i*)(_prior + i));
+		_mm_storeu_si128((__m128i*)(_out + i), _mm_add_epi8(x, up));
+	}
+
+	for (; i < _length; i++) _out[i] = (unsigned char)(_in[i] + _prior[i]);
+}
+
+#endif
+
+static KernelTable BuildKernelTable(SIMDLevel _level)
+{
+	KernelTable table = {
+		{ SubScalar<1>, SubScalar<2>, SubScalar<3>, SubScalar<4>, SubScalar<6>, SubScalar<8> },
+		{ UpScalar<1>, UpScalar<2>, UpScalar<3>, UpScalar<4>, UpScalar<6>, UpScalar<8> },
+		{ AverageScalar<1>, AverageScalar<2>, AverageScalar<3>, AverageScalar<4>, AverageScalar<6>, AverageScalar<8> },
+		{ PaethScalar<1>, PaethScalar<2>, PaethScalar<3>, PaethScalar<4>, PaethScalar<6>, PaethScalar<8> }
+	};
+
+#if defined(R2D_X86)
+	if (_level >= SIMD_SSE2)
+	{
+		// 1 and 2 byte pixels stay scalar, a vector per pixel costs more than it saves there
+		UnfilterKernel sub[4] = { SubSSE2<3>, SubSSE2<4>, SubSSE2<6>, SubSSE2<8> };
+		UnfilterKernel average[4] = { AverageSSE2<3>, AverageSSE2<4>, AverageSSE2<6>, AverageSSE2<8> };
+		UnfilterKernel paeth[4] = { PaethSSE2<3>, PaethSSE2<4>, PaethSSE2<6>, PaethSSE2<8> };
+
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			table.sub[i + 2] = sub[i];
+			table.average[i + 2] = average[i];
+			table.paeth[i + 2] = paeth[i];
+		}
+
+		for (unsigned int i = 0; i < 6; i++) table.up[i] = UpSSE2;
+	}
+
+	if (_level >= SIMD_AVX2)
+	{
+		for (unsigned int i = 0; i < 6; i++) table.up[i] = UpAVX2;
+	}
+#endif
+
+	return table;
+}
+
+static const KernelTable& GetKernelTable()
+{
+	static const KernelTable tables[3] = {
+		BuildKernelTable(SIMD_SCALAR),
+		BuildKernelTable(SIMD_SSE2),
+		BuildKernelTable(SIMD_AVX2)
+	};
+
+	return tables[PNGFilters::GetSIMDLevel()];
+}
+
+void PNGFilters::UnfilterScanline(unsigned char _filterType, const unsigned char* _in, unsigned char* _out,
+	const unsigned char* _prior, size_t _length, size_t _bytesPerPixel)
+{
+	// Without a prior scanline, UP is a no-op and PAETH always predicts the left byte
+	if (_prior == nullptr)
+	{
+		if (_filterType == UP) _filterType = NONE;
+		else if (_filterType == PAETH) _filterType = SUB;
+	}
+
+	int kernelIndex = GetKernelIndex(_bytesPerPixel);
+
+	if (kernelIndex < 0 || _length < _bytesPerPixel)
+	{
+		throw std::runtime_error("Invalid scanline layout for unfiltering, " + std::to_string(_length) + " bytes at " + std::to_string(_bytesPerPixel) + " bytes per pixel.");
+	}
+
+	const KernelTable& kernels = GetKernelTable();
+
+	switch (_filterType)
+	{
+		case NONE:
+		{
+			if (_out != _in) memmove(_out, _in, _length);
+			break;
+		}
+
+		case SUB:		kernels.sub[kernelIndex](_in, _out, _prior, _length);	break;
+		case UP:		kernels.up[kernelIndex](_in, _out, _prior, _length);	break;
+
+		case AVERAGE:
+		{
+			if (_prior == nullptr)
+			{
+				AverageFirstRow(_in, _out, _length, _bytesPerPixel);
+				break;
+			}
+
+			kernels.average[kernelIndex](_in, _out, _prior, _length);
+			break;
+		}
+
+		case PAETH:		kernels.paeth[kernelIndex](_in, _out, _prior, _length);	break;
+
+		default:
+		{
+			throw std::runtime_error("Invalid scanline filter type " + std::to_string((unsigned int)_filterType) + " in IDAT PNG data.");
+		}
+	}
+}
+
+void PNGFilters::SetSIMDLevel(SIMDLevel _level)
+{
+	SIMDLevel supported = CPUFeatures::GetInstance().GetSIMDLevel();
+
+	gSIMDLevel = (_level < supported) ? _level : supported;
+}
+
+SIMDLevel PNGFilters::GetSIMDLevel()
+{
+	int level = gSIMDLevel;
+
+	if (level < 0)
+	{
+		level = CPUFeatures::GetInstance().GetSIMDLevel();
+		gSIMDLevel = level;
+	}
+
+	return (SIMDLevel)level;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "DLLCommon.h"
+#include "CPUFeatures.h"
+
+#include <cstddef>
+
+// PNG scanline reconstruction (unfiltering). Kernels are specialised per bytes-per-pixel,
+// with SSE2/AVX2 versions picked at runtime from what the CPU supports.
+class RENDERER_API PNGFilters
+{
+public:
+	enum FilterType
+	{
+		NONE,
+		SUB,
+		UP,
+		AVERAGE,
+		PAETH,
+
+		TOTAL_FILTER_TYPES
+	};
+
+	// Reverses the filter on one scanline. _in and _out may overlap as long as _out <= _in,
+	// _prior is the already unfiltered previous scanline of the pass, or nullptr for the first one.
+	static void UnfilterScanline(unsigned char _filterType, const unsigned char* _in, unsigned char* _out,
+		const unsigned char* _prior, size_t _length, size_t _bytesPerPixel);
+
+	// Caps the kernels used to the given instruction set, mainly for benchmarking against the scalar path.
+	static void SetSIMDLevel(SIMDLevel _level);
+	static SIMDLevel GetSIMDLevel();
+};
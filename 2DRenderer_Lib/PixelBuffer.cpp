@@ -0,0 +1,90 @@
+#include "PixelBuffer.h"
+
+#include <atomic>
+
+static std::atomic<size_t> gBytesHeld = { 0 };
+static std::atomic<unsigned int> gStorageCount = { 0 };
+static std::atomic<size_t> gBytesViewed = { 0 };
+
+// Frees storage once its last buffer lets go of it, keeping the counters in step
+struct StorageDeleter
+{
+	void operator()(std::vector<unsigned char>* _bytes) const
+	{
+		gBytesHeld -= _bytes->capacity();
+		gStorageCount--;
+
+		delete _bytes;
+	}
+};
+
+static std::shared_ptr<std::vector<unsigned char>> TrackStorage(std::vector<unsigned char>* _bytes)
+{
+	gBytesHeld += _bytes->capacity();
+	gStorageCount++;
+
+	return std::shared_ptr<std::vector<unsigned char>>(_bytes, StorageDeleter());
+}
+
+void PixelBuffer::AssignView(std::shared_ptr<const void> _owner, const unsigned char* _data, size_t _size)
+{
+	mBytes.reset();
+
+	gBytesViewed += _size;
+
+	mView = std::shared_ptr<const View>(new View{ std::move(_owner), _data, _size }, [](const View* _view)
+	{
+		gBytesViewed -= _view->size;
+		delete _view;
+	});
+}
+
+void PixelBuffer::assign(size_t _size, unsigned char _value)
+{
+	mView.reset();
+
+	if (IsShared())
+	{
+		mBytes.reset();
+	}
+
+	if (!mBytes)
+	{
+		mBytes = TrackStorage(new std::vector<unsigned char>());
+	}
+
+	// Capacity only ever grows here
+	size_t capacity = mBytes->capacity();
+	mBytes->assign(_size, _value);
+	gBytesHeld += mBytes->capacity() - capacity;
+}
+
+unsigned char* PixelBuffer::GetWritableData()
+{
+	if (mView)
+	{
+		mBytes = TrackStorage(new std::vector<unsigned char>(mView->data, mView->data + mView->size));
+		mView.reset();
+	}
+	else if (IsShared())
+	{
+		mBytes = TrackStorage(new std::vector<unsigned char>(*mBytes));
+	}
+
+	return mBytes ? mBytes->data() : nullptr;
+}
+
+size_t PixelBuffer::GetBytesHeld()
+{
+	return gBytesHeld;
+}
+
+unsigned int PixelBuffer::GetStorageCount()
+{
+	return gStorageCount;
+}
+
+size_t PixelBuffer::GetBytesViewed()
+{
+	return gBytesViewed;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "DLLCommon.h"
+
+#pragma warning(disable : 4251)
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Byte storage shared between copies, copying a buffer only adds a reference to it. Reads are const only,
+// writes go through GetWritableData(), which first gives this copy storage of its own if another copy shares it,
+// so pixels are only ever duplicated when one of the copies actually changes them.
+// The bytes can also be a view of memory something else owns, a mapped file, which is copied the same way on the first write.
+// Keeps std::vector's names for the read-only parts of it the uploaders use.
+class RENDERER_API PixelBuffer
+{
+public:
+	size_t size() const								{ return mView ? mView->size : (mBytes ? mBytes->size() : 0); }
+	bool empty() const								{ return size() == 0; }
+
+	const unsigned char* data() const				{ return mView ? mView->data : (mBytes ? mBytes->data() : nullptr); }
+	const unsigned char& operator[](size_t _index) const	{ return data()[_index]; }
+
+	const unsigned char* begin() const				{ return data(); }
+	const unsigned char* end() const				{ return data() + size(); }
+
+	// _size bytes of _value, re-using the current storage's capacity unless it's shared
+	void assign(size_t _size, unsigned char _value);
+
+	// Views _size bytes at _data instead of holding storage, _owner keeps them alive for as long as any copy views them
+	void AssignView(std::shared_ptr<const void> _owner, const unsigned char* _data, size_t _size);
+
+	// Empties the buffer, keeping the storage's capacity unless it's shared
+	void clear()
+	{
+		mView.reset();
+
+		if (IsShared())
+		{
+			mBytes.reset();
+		}
+		else if (mBytes)
+		{
+			mBytes->clear();
+		}
+	}
+
+	// Copies the bytes first if they're shared
+	unsigned char* GetWritableData();
+
+	// Frees the storage, or only lets go of it if it's shared
+	void Release()									{ mBytes.reset(); mView.reset(); }
+
+	bool IsShared() const							{ return mBytes && mBytes.use_count() > 1; }
+	bool IsView() const								{ return mView != nullptr; }
+
+	bool operator==(const PixelBuffer& _other) const
+	{
+		return size() == _other.size() && (data() == _other.data() || std::equal(begin(), end(), _other.begin()));
+	}
+
+	bool operator!=(const PixelBuffer& _other) const	{ return !(*this == _other); }
+
+	// Storage alive across every buffer right now, storage shared by several buffers counted once
+	static size_t GetBytesHeld();
+	static unsigned int GetStorageCount();
+
+	// Bytes viewed across every buffer right now, not counted in GetBytesHeld(), each view counted once
+	static size_t GetBytesViewed();
+
+protected:
+	struct View
+	{
+		std::shared_ptr<const void> owner;
+		const unsigned char* data;
+		size_t size;
+	};
+
+	std::shared_ptr<std::vector<unsigned char>> mBytes;
+	std::shared_ptr<const View> mView; // set instead of mBytes for views
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include "DLLCommon.h"
+
+// Layout of decoded pixels in memory. Rows are tightly packed, top row first.
+enum RENDERER_API PixelFormat
+{
+	R8,			// gray, or the red channel of colour images
+	RG8,		// gray / red + alpha
+	RGBA8,
+	RGBA16,		// 16-bit channels in native byte order
+	RGBA32F,	// four floats per pixel, the same layout as Color
+	BGRA8,		// RGBA8 with red and blue swapped, how TGA and BMP store pixels
+
+	TOTAL_PIXEL_FORMATS
+};
+
+class RENDERER_API PixelFormatInfo
+{
+public:
+	static unsigned int GetChannelCount(PixelFormat _format)
+	{
+		switch (_format)
+		{
+			case R8:		return 1;
+			case RG8:		return 2;
+			case RGBA8:
+			case RGBA16:
+			case RGBA32F:
+			case BGRA8:		return 4;
+			default:		return 0;
+		}
+	}
+
+	static unsigned int GetBytesPerChannel(PixelFormat _format)
+	{
+		switch (_format)
+		{
+			case RGBA16:	return 2;
+			case RGBA32F:	return 4;
+			default:		return 1;
+		}
+	}
+
+	static unsigned int GetBytesPerPixel(PixelFormat _format)
+	{
+		return GetChannelCount(_format) * GetBytesPerChannel(_format);
+	}
+};
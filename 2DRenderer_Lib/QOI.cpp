@@ -0,0 +1,372 @@
+#include "QOI.h"
+
+#include "MappedFile.h"
+#include "PNGConverters.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+static constexpr unsigned char QOI_MAGIC[4] = { 'q', 'o', 'i', 'f' };
+static constexpr unsigned char QOI_END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+static constexpr size_t QOI_HEADER_SIZE = 14;
+
+// 8-bit tags, checked before the 2-bit ones they overlap
+static constexpr unsigned char QOI_OP_RGB = 0xFE, QOI_OP_RGBA = 0xFF;
+
+// 2-bit tags, the top two bits of the op byte
+static constexpr unsigned char QOI_OP_INDEX = 0x00, QOI_OP_DIFF = 0x40, QOI_OP_LUMA = 0x80, QOI_OP_RUN = 0xC0, QOI_TAG_MASK = 0xC0;
+
+// Same limit as the reference implementation, so a bad header can't ask for more than 1.6GB of RGBA
+static constexpr unsigned int QOI_PIXELS_MAX = 400000000;
+
+// Longest run one op holds, 63 and 64 would collide with the RGB and RGBA tags
+static constexpr unsigned int QOI_RUN_MAX = 62;
+
+struct QOIPixel
+{
+	unsigned char r, g, b, a;
+};
+
+static inline bool operator==(const QOIPixel& _a, const QOIPixel& _b)
+{
+	return _a.r == _b.r && _a.g == _b.g && _a.b == _b.b && _a.a == _b.a;
+}
+
+// Slot of the pixel in the index of recently seen pixels
+static inline unsigned int Hash(const QOIPixel& _pixel)
+{
+	return (_pixel.r * 3 + _pixel.g * 5 + _pixel.b * 7 + _pixel.a * 11) & 63;
+}
+
+static unsigned int ReadUInt32(const unsigned char* _data)
+{
+	return ((unsigned int)_data[0] << 24) | ((unsigned int)_data[1] << 16) | ((unsigned int)_data[2] << 8) | _data[3];
+}
+
+static unsigned char* WriteUInt32(unsigned char* _out, unsigned int _value)
+{
+	_out[0] = (unsigned char)(_value >> 24);
+	_out[1] = (unsigned char)(_value >> 16);
+	_out[2] = (unsigned char)(_value >> 8);
+	_out[3] = (unsigned char)_value;
+
+	return _out + 4;
+}
+
+QOIProperties::QOIProperties()
+{
+	width = height = 0;
+	channels = 0;
+	linear = false;
+	pixelFormat = RGBA8;
+}
+
+void QOIProperties::LoadQOI(const char* _filePath, PixelFormat _format)
+{
+	width = height = 0;
+	channels = 0;
+	pixelFormat = _format;
+	pixels.clear();
+
+	MappedFile file;
+
+	if (!file.Open(_filePath))
+	{
+		throw std::runtime_error(std::string("Could not map file at: \"") + _filePath + std::string("\""));
+	}
+
+	Load(file.GetData(), file.GetSize());
+}
+
+void QOIProperties::Load(const unsigned char* _data, size_t _size)
+{
+	if (_size < QOI_HEADER_SIZE + sizeof(QOI_END_MARKER) || memcmp(_data, QOI_MAGIC, sizeof(QOI_MAGIC)) != 0)
+	{
+		throw std::runtime_error("File is not a QOI image.");
+	}
+
+	width = ReadUInt32(_data + 4);
+	height = ReadUInt32(_data + 8);
+	channels = _data[12];
+	linear = (_data[13] == 1);
+
+	if (width == 0 || height == 0 || height >= QOI_PIXELS_MAX / width)
+	{
+		throw std::runtime_error("QOI header has a zero or too large width or height.");
+	}
+
+	if ((channels != 3 && channels != 4) || _data[13] > 1)
+	{
+		throw std::runtime_error("QOI header has an invalid channel count or colour space.");
+	}
+
+	const size_t bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+
+	pixels.assign((size_t)width * height * bytesPerPixel, 0);
+	unsigned char* out = pixels.GetWritableData();
+
+	// RGBA8 is decoded straight into pixels, other formats are converted from an RGBA8 row by the PNG converter for 8-bit RGBA
+	PNGScanlineConverter convert = nullptr;
+	PNGConvertParams params = PNGConvertParams();
+	std::vector<unsigned char> sampleTable;
+	std::vector<QOIPixel> rgbaRow;
+
+	if (pixelFormat != RGBA8)
+	{
+		rgbaRow.resize(width);
+		sampleTable.resize(PNGConverters::GetSampleTableSize(8, pixelFormat));
+		PNGConverters::BuildSampleTable(8, pixelFormat, sampleTable.data());
+
+		params.sampleTable = params.alphaTable = sampleTable.data();
+		convert = PNGConverters::GetConverter(6, 8, pixelFormat, true);
+	}
+
+	QOIPixel index[64] = {};
+	QOIPixel pixel = { 0, 0, 0, 255 };
+	unsigned int run = 0;
+
+	// Every op is at most 5 bytes, so reading one that starts before the end marker never runs off the data.
+	// Data that stops short repeats its last pixel to the end, the same as the reference decoder
+	const unsigned char* data = _data + QOI_HEADER_SIZE;
+	const unsigned char* dataEnd = _data + _size - sizeof(QOI_END_MARKER);
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		QOIPixel* row = convert ? rgbaRow.data() : (QOIPixel*)out + (size_t)y * width;
+
+		for (unsigned int x = 0; x < width;)
+		{
+			// Runs fill as much of the row as they cover at once, carrying on into the next row if they're longer
+			if (run > 0)
+			{
+				const unsigned int count = std::min(run, width - x);
+				std::fill(row + x, row + x + count, pixel);
+
+				x += count;
+				run -= count;
+				continue;
+			}
+
+			if (data >= dataEnd)
+			{
+				run = width - x;
+				continue;
+			}
+
+			const unsigned int op = *data++;
+
+			if (op == QOI_OP_RGB)
+			{
+				pixel.r = data[0];
+				pixel.g = data[1];
+				pixel.b = data[2];
+				data += 3;
+			}
+			else if (op == QOI_OP_RGBA)
+			{
+				pixel.r = data[0];
+				pixel.g = data[1];
+				pixel.b = data[2];
+				pixel.a = data[3];
+				data += 4;
+			}
+			else
+			{
+				switch (op & QOI_TAG_MASK)
+				{
+					case QOI_OP_INDEX:
+					{
+						pixel = index[op];
+						break;
+					}
+
+					// Each channel -2 to 1 from the previous pixel
+					case QOI_OP_DIFF:
+					{
+						pixel.r += ((op >> 4) & 3) - 2;
+						pixel.g += ((op >> 2) & 3) - 2;
+						pixel.b += (op & 3) - 2;
+						break;
+					}
+
+					// Green -32 to 31 from the previous pixel, red and blue -8 to 7 from that plus green's difference
+					case QOI_OP_LUMA:
+					{
+						const unsigned int next = *data++;
+						const int green = (int)(op & 0x3F) - 32;
+
+						pixel.r += green - 8 + ((next >> 4) & 15);
+						pixel.g += green;
+						pixel.b += green - 8 + (next & 15);
+						break;
+					}
+
+					// The previous pixel 1 to 62 times, this op's pixel plus the rest
+					case QOI_OP_RUN:
+					{
+						run = op & 0x3F;
+						break;
+					}
+				}
+			}
+
+			index[Hash(pixel)] = pixel;
+			row[x++] = pixel;
+		}
+
+		if (convert)
+		{
+			convert((const unsigned char*)rgbaRow.data(), width, out + (size_t)y * width * bytesPerPixel, bytesPerPixel, params);
+		}
+	}
+}
+
+void QOIProperties::Encode(const unsigned char* _pixels, unsigned int _width, unsigned int _height, PixelFormat _format,
+	std::vector<unsigned char>& _output, bool _linear)
+{
+	if (_width == 0 || _height == 0 || _height >= QOI_PIXELS_MAX / _width)
+	{
+		throw std::runtime_error("QOI images must have a non-zero width and height, and fewer than " + std::to_string(QOI_PIXELS_MAX) + " pixels.");
+	}
+
+	if (_format != R8 && _format != RG8 && _format != RGBA8)
+	{
+		throw std::runtime_error("Only R8, RG8 and RGBA8 pixels can be encoded as QOI.");
+	}
+
+	const size_t pixelCount = (size_t)_width * _height;
+	const unsigned int bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(_format);
+
+	auto readPixel = [_pixels, _format, bytesPerPixel](size_t _index)
+	{
+		const unsigned char* source = _pixels + _index * bytesPerPixel;
+
+		switch (_format)
+		{
+			case R8:	return QOIPixel{ source[0], source[0], source[0], 255 };
+			case RG8:	return QOIPixel{ source[0], source[0], source[0], source[1] };
+			default:	return QOIPixel{ source[0], source[1], source[2], source[3] };
+		}
+	};
+
+	bool opaque = true;
+
+	if (_format != R8)
+	{
+		for (size_t i = 0; i < pixelCount && opaque; i++)
+		{
+			opaque = (_pixels[i * bytesPerPixel + bytesPerPixel - 1] == 255);
+		}
+	}
+
+	// The most an image can take, every pixel an RGBA op. Shrunk to what was written at the end
+	_output.resize(QOI_HEADER_SIZE + pixelCount * 5 + sizeof(QOI_END_MARKER));
+	unsigned char* out = _output.data();
+
+	memcpy(out, QOI_MAGIC, sizeof(QOI_MAGIC));
+	out = WriteUInt32(out + 4, _width);
+	out = WriteUInt32(out, _height);
+	*out++ = opaque ? 3 : 4;
+	*out++ = _linear ? 1 : 0;
+
+	QOIPixel index[64] = {};
+	QOIPixel previous = { 0, 0, 0, 255 };
+	unsigned int run = 0;
+
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		const QOIPixel pixel = readPixel(i);
+
+		if (pixel == previous)
+		{
+			if (++run == QOI_RUN_MAX || i + 1 == pixelCount)
+			{
+				*out++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run > 0)
+		{
+			*out++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		const unsigned int slot = Hash(pixel);
+
+		if (index[slot] == pixel)
+		{
+			*out++ = (unsigned char)(QOI_OP_INDEX | slot);
+		}
+		else
+		{
+			index[slot] = pixel;
+
+			if (pixel.a == previous.a)
+			{
+				// Differences wrap, so 255 -> 0 is +1
+				const int red = (signed char)(pixel.r - previous.r), green = (signed char)(pixel.g - previous.g), blue = (signed char)(pixel.b - previous.b);
+				const int redGreen = red - green, blueGreen = blue - green;
+
+				if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1)
+				{
+					*out++ = (unsigned char)(QOI_OP_DIFF | ((red + 2) << 4) | ((green + 2) << 2) | (blue + 2));
+				}
+				else if (green >= -32 && green <= 31 && redGreen >= -8 && redGreen <= 7 && blueGreen >= -8 && blueGreen <= 7)
+				{
+					*out++ = (unsigned char)(QOI_OP_LUMA | (green + 32));
+					*out++ = (unsigned char)(((redGreen + 8) << 4) | (blueGreen + 8));
+				}
+				else
+				{
+					out[0] = QOI_OP_RGB;
+					out[1] = pixel.r;
+					out[2] = pixel.g;
+					out[3] = pixel.b;
+					out += 4;
+				}
+			}
+			else
+			{
+				out[0] = QOI_OP_RGBA;
+				out[1] = pixel.r;
+				out[2] = pixel.g;
+				out[3] = pixel.b;
+				out[4] = pixel.a;
+				out += 5;
+			}
+		}
+
+		previous = pixel;
+	}
+
+	memcpy(out, QOI_END_MARKER, sizeof(QOI_END_MARKER));
+	out += sizeof(QOI_END_MARKER);
+
+	_output.resize(out - _output.data());
+}
+
+bool QOIProperties::WriteQOI(const char* _filePath, const unsigned char* _pixels, unsigned int _width, unsigned int _height,
+	PixelFormat _format, bool _linear)
+{
+	std::vector<unsigned char> encoded;
+	Encode(_pixels, _width, _height, _format, encoded, _linear);
+
+	std::ofstream writer = std::ofstream(_filePath, std::ios::binary | std::ios::trunc);
+
+	if (!writer.is_open())
+	{
+		perror((std::string("Could not create QOI file at: \"") + _filePath + "\"").c_str());
+		return false;
+	}
+
+	writer.write((const char*)encoded.data(), encoded.size());
+
+	return writer.good();
+}
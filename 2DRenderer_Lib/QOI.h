@@ -0,0 +1,41 @@
+#pragma once
+#include "DLLCommon.h"
+#include "PixelBuffer.h"
+#include "PixelFormat.h"
+
+#pragma warning(disable : 4251)
+#include <cstddef>
+#include <vector>
+
+// QOI, "Quite OK Image": 8-bit RGB or RGBA, each pixel coded as a run, an index into the last 64 distinct pixels seen,
+// a small difference from the previous pixel or the pixel itself. Decodes in one pass with no entropy coding,
+// several times faster than PNG at a similar size.
+class RENDERER_API QOIProperties
+{
+public:
+	QOIProperties();
+
+	// Decodes the whole image into pixels as _format. RGBA8 is written straight out by the decoder,
+	// other formats go through the PNG converters a row at a time.
+	void LoadQOI(const char* _filePath, PixelFormat _format = RGBA8);
+
+	// Encodes _width * _height pixels laid out as _format (R8, RG8 or RGBA8, R8 and RG8 as gray) into QOI data.
+	// The file says 4 channels only if some pixel isn't opaque. _linear marks the colour channels as linear rather than sRGB.
+	static void Encode(const unsigned char* _pixels, unsigned int _width, unsigned int _height, PixelFormat _format,
+		std::vector<unsigned char>& _output, bool _linear = false);
+
+	// Encode() into a file at _filePath, false if it couldn't be written
+	static bool WriteQOI(const char* _filePath, const unsigned char* _pixels, unsigned int _width, unsigned int _height,
+		PixelFormat _format = RGBA8, bool _linear = false);
+
+protected:
+	void Load(const unsigned char* _data, size_t _size);
+
+public:
+	unsigned int width, height;
+	unsigned char channels; // 3 or 4, as the file says, the pixels always decode with alpha
+	bool linear; // colour channels are linear, sRGB otherwise
+
+	PixelFormat pixelFormat;
+	PixelBuffer pixels; // width * height pixels laid out as pixelFormat, shared between copies
+};
@@ -0,0 +1,715 @@
+#include "RawImage.h"
+
+#include "MappedFile.h"
+#include "PNGConverters.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Same limit as QOI, so a bad header can't ask for more than 1.6GB of RGBA
+static constexpr unsigned int RAW_PIXELS_MAX = 400000000;
+
+static constexpr size_t TGA_HEADER_SIZE = 18;
+static constexpr size_t BMP_FILE_HEADER_SIZE = 14;
+
+// BMP compression types, every other one is compressed
+static constexpr unsigned int BMP_RGB = 0, BMP_BITFIELDS = 3, BMP_ALPHABITFIELDS = 6;
+
+typedef void (*RawRowUnpacker)(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout& _layout);
+
+// Where the pixels sit in the file and how to read them
+struct RawLayout
+{
+	size_t offset;			// first stored row
+	size_t rowPitch;		// bytes from one stored row to the next, padding included
+	size_t rowBytes;		// bytes of pixels in a stored row
+	bool bottomUp;			// the first stored row is the bottom one
+	bool rightToLeft;		// pixels are stored right to left in each row
+
+	PixelFormat matches;	// format the stored rows already are byte for byte, TOTAL_PIXEL_FORMATS if none
+
+	// TGA and BMP rows are unpacked to RGBA8 first
+	RawRowUnpacker unpack;
+	unsigned int masks[4], shifts[4], maxima[4];	// bitfields, red, green, blue then alpha, alpha opaque if its mask is 0
+	unsigned char palette[256][4];					// RGBA, unused entries opaque black
+
+	// PNM rows go straight through the PNG converter for the same samples
+	unsigned int colourType, bitDepth, maxValue;
+};
+
+// Little-endian, as TGA and BMP store them
+static unsigned int ReadUInt16(const unsigned char* _data)
+{
+	return (unsigned int)_data[0] | ((unsigned int)_data[1] << 8);
+}
+
+static unsigned int ReadUInt32(const unsigned char* _data)
+{
+	return (unsigned int)_data[0] | ((unsigned int)_data[1] << 8) | ((unsigned int)_data[2] << 16) | ((unsigned int)_data[3] << 24);
+}
+
+static void CheckDimensions(unsigned int _width, unsigned int _height)
+{
+	if (_width == 0 || _height == 0 || _height >= RAW_PIXELS_MAX / _width)
+	{
+		throw std::runtime_error("Image header has a zero or too large width or height.");
+	}
+}
+
+static void SetMasks(RawLayout& _layout, unsigned int _red, unsigned int _green, unsigned int _blue, unsigned int _alpha)
+{
+	const unsigned int masks[4] = { _red, _green, _blue, _alpha };
+
+	for (unsigned int c = 0; c < 4; c++)
+	{
+		unsigned int shift = 0;
+		while (masks[c] != 0 && ((masks[c] >> shift) & 1) == 0) shift++;
+
+		_layout.masks[c] = masks[c];
+		_layout.shifts[c] = shift;
+		_layout.maxima[c] = masks[c] >> shift;
+	}
+}
+
+// Unpackers
+
+static void UnpackRGBA(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout&)
+{
+	memcpy(_rgba, _src, (size_t)_count * 4);
+}
+
+static void UnpackBGRA(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout&)
+{
+	for (unsigned int i = 0; i < _count; i++, _src += 4, _rgba += 4)
+	{
+		_rgba[0] = _src[2];
+		_rgba[1] = _src[1];
+		_rgba[2] = _src[0];
+		_rgba[3] = _src[3];
+	}
+}
+
+// BGRA with the fourth byte unused
+static void UnpackBGRX(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout&)
+{
+	for (unsigned int i = 0; i < _count; i++, _src += 4, _rgba += 4)
+	{
+		_rgba[0] = _src[2];
+		_rgba[1] = _src[1];
+		_rgba[2] = _src[0];
+		_rgba[3] = 255;
+	}
+}
+
+static void UnpackBGR(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout&)
+{
+	for (unsigned int i = 0; i < _count; i++, _src += 3, _rgba += 4)
+	{
+		_rgba[0] = _src[2];
+		_rgba[1] = _src[1];
+		_rgba[2] = _src[0];
+		_rgba[3] = 255;
+	}
+}
+
+static void UnpackGray(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout&)
+{
+	for (unsigned int i = 0; i < _count; i++, _rgba += 4)
+	{
+		_rgba[0] = _rgba[1] = _rgba[2] = _src[i];
+		_rgba[3] = 255;
+	}
+}
+
+// 16 or 32-bit pixels, each channel scaled from however many bits its mask has to 8
+template <unsigned int BYTES>
+static void UnpackBitfields(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout& _layout)
+{
+	for (unsigned int i = 0; i < _count; i++, _src += BYTES, _rgba += 4)
+	{
+		const unsigned int pixel = (BYTES == 2) ? ReadUInt16(_src) : ReadUInt32(_src);
+
+		for (unsigned int c = 0; c < 4; c++)
+		{
+			const unsigned long long maximum = _layout.maxima[c];
+			const unsigned long long value = (pixel & _layout.masks[c]) >> _layout.shifts[c];
+
+			_rgba[c] = maximum ? (unsigned char)((value * 255 + maximum / 2) / maximum) : ((c == 3) ? 255 : 0);
+		}
+	}
+}
+
+// 1, 4 or 8-bit palette indices, leftmost pixel in the most significant bits
+template <unsigned int BITS>
+static void UnpackIndexed(const unsigned char* _src, unsigned int _count, unsigned char* _rgba, const RawLayout& _layout)
+{
+	constexpr unsigned int PIXELS_PER_BYTE = 8 / BITS;
+	constexpr unsigned int INDEX_MASK = (1u << BITS) - 1;
+
+	for (unsigned int i = 0; i < _count; i++, _rgba += 4)
+	{
+		const unsigned int index = (_src[i / PIXELS_PER_BYTE] >> (8 - BITS * (i % PIXELS_PER_BYTE + 1))) & INDEX_MASK;
+		memcpy(_rgba, _layout.palette[index], 4);
+	}
+}
+
+// PNM header tokens
+
+static void SkipWhitespace(const unsigned char* _data, size_t _size, size_t& _pos)
+{
+	while (_pos < _size)
+	{
+		if (_data[_pos] == '#')
+		{
+			while (_pos < _size && _data[_pos] != '\n') _pos++;
+		}
+		else if (isspace(_data[_pos]))
+		{
+			_pos++;
+		}
+		else break;
+	}
+}
+
+static std::string ReadToken(const unsigned char* _data, size_t _size, size_t& _pos)
+{
+	SkipWhitespace(_data, _size, _pos);
+
+	const size_t start = _pos;
+	while (_pos < _size && !isspace(_data[_pos]) && _data[_pos] != '#') _pos++;
+
+	return std::string((const char*)_data + start, _pos - start);
+}
+
+static unsigned int ReadNumber(const unsigned char* _data, size_t _size, size_t& _pos)
+{
+	const std::string token = ReadToken(_data, _size, _pos);
+
+	if (token.empty() || token.size() > 9 || token.find_first_not_of("0123456789") != token.npos)
+	{
+		throw std::runtime_error("PNM header has a missing or invalid number.");
+	}
+
+	return (unsigned int)std::stoul(token);
+}
+
+RawImageProperties::RawImageProperties()
+{
+	width = height = 0;
+	channels = 0;
+	pixelFormat = RGBA8;
+	mapped = false;
+}
+
+void RawImageProperties::LoadTGA(const char* _filePath, PixelFormat _format)
+{
+	std::shared_ptr<MappedFile> file = Open(_filePath, _format);
+
+	RawLayout layout = RawLayout();
+	ReadTGAHeader(file->GetData(), file->GetSize(), layout);
+
+	Load(file, layout);
+}
+
+void RawImageProperties::LoadBMP(const char* _filePath, PixelFormat _format)
+{
+	std::shared_ptr<MappedFile> file = Open(_filePath, _format);
+
+	RawLayout layout = RawLayout();
+	ReadBMPHeader(file->GetData(), file->GetSize(), layout);
+
+	Load(file, layout);
+}
+
+void RawImageProperties::LoadPNM(const char* _filePath, PixelFormat _format)
+{
+	std::shared_ptr<MappedFile> file = Open(_filePath, _format);
+
+	RawLayout layout = RawLayout();
+	ReadPNMHeader(file->GetData(), file->GetSize(), layout);
+
+	Load(file, layout);
+}
+
+std::shared_ptr<MappedFile> RawImageProperties::Open(const char* _filePath, PixelFormat _format)
+{
+	width = height = 0;
+	channels = 0;
+	pixelFormat = _format;
+	pixels.clear();
+	mapped = false;
+
+	// Shared, the pixels keep it mapped if they view it
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+
+	if (!file->Open(_filePath))
+	{
+		throw std::runtime_error(std::string("Could not map file at: \"") + _filePath + std::string("\""));
+	}
+
+	return file;
+}
+
+void RawImageProperties::ReadTGAHeader(const unsigned char* _data, size_t _size, RawLayout& _layout)
+{
+	if (_size < TGA_HEADER_SIZE)
+	{
+		throw std::runtime_error("File is too small to be a TGA image.");
+	}
+
+	const unsigned int idLength = _data[0], colourMapType = _data[1], imageType = _data[2];
+	const unsigned int mapFirst = ReadUInt16(_data + 3), mapLength = ReadUInt16(_data + 5), mapEntryBits = _data[7];
+	const unsigned int depth = _data[16], descriptor = _data[17], alphaBits = descriptor & 15;
+
+	if (imageType >= 9 && imageType <= 11)
+	{
+		throw std::runtime_error("RLE compressed TGA images aren't supported.");
+	}
+
+	if (imageType < 1 || imageType > 3 || colourMapType > 1)
+	{
+		throw std::runtime_error("File is not an uncompressed TGA image.");
+	}
+
+	width = ReadUInt16(_data + 12);
+	height = ReadUInt16(_data + 14);
+	CheckDimensions(width, height);
+
+	// The colour map sits between the ID and the pixels, whether the image uses it or not
+	const size_t mapEntryBytes = (mapEntryBits + 7) / 8;
+	const size_t mapOffset = TGA_HEADER_SIZE + idLength;
+
+	_layout.offset = mapOffset + (colourMapType ? mapLength * mapEntryBytes : 0);
+	_layout.rowBytes = _layout.rowPitch = (size_t)width * ((depth + 7) / 8);
+	_layout.bottomUp = !(descriptor & 0x20);
+	_layout.rightToLeft = (descriptor & 0x10) != 0;
+	_layout.matches = TOTAL_PIXEL_FORMATS;
+
+	switch (imageType)
+	{
+		case 1: // colour mapped
+		{
+			if (!colourMapType || depth != 8 || (mapEntryBits != 15 && mapEntryBits != 16 && mapEntryBits != 24 && mapEntryBits != 32))
+			{
+				throw std::runtime_error("TGA colour map or index size isn't supported.");
+			}
+
+			if (_layout.offset > _size)
+			{
+				throw std::runtime_error("TGA colour map is cut short.");
+			}
+
+			for (unsigned int i = 0; i < 256; i++)
+			{
+				_layout.palette[i][3] = 255;
+			}
+
+			// Entries are indexed from mapFirst
+			for (unsigned int i = 0; i < mapLength && mapFirst + i < 256; i++)
+			{
+				const unsigned char* entry = _data + mapOffset + i * mapEntryBytes;
+				unsigned char* rgba = _layout.palette[mapFirst + i];
+
+				if (mapEntryBytes == 2)
+				{
+					const unsigned int value = ReadUInt16(entry);
+					rgba[0] = (unsigned char)((((value >> 10) & 31) * 255 + 15) / 31);
+					rgba[1] = (unsigned char)((((value >> 5) & 31) * 255 + 15) / 31);
+					rgba[2] = (unsigned char)(((value & 31) * 255 + 15) / 31);
+					rgba[3] = (mapEntryBits == 16 && alphaBits == 1 && !(value & 0x8000)) ? 0 : 255;
+				}
+				else
+				{
+					rgba[0] = entry[2];
+					rgba[1] = entry[1];
+					rgba[2] = entry[0];
+					rgba[3] = (mapEntryBytes == 4 && alphaBits == 8) ? entry[3] : 255;
+				}
+			}
+
+			channels = (alphaBits != 0) ? 4 : 3;
+			_layout.unpack = UnpackIndexed<8>;
+			break;
+		}
+
+		case 2: // true colour
+		{
+			if (depth == 15 || depth == 16)
+			{
+				const bool hasAlpha = (depth == 16 && alphaBits == 1);
+
+				channels = hasAlpha ? 4 : 3;
+				SetMasks(_layout, 0x7C00, 0x03E0, 0x001F, hasAlpha ? 0x8000 : 0);
+				_layout.unpack = UnpackBitfields<2>;
+			}
+			else if (depth == 24)
+			{
+				channels = 3;
+				_layout.unpack = UnpackBGR;
+			}
+			else if (depth == 32)
+			{
+				// Without alpha bits the fourth byte is unused, often 0
+				if (alphaBits == 8)
+				{
+					channels = 4;
+					_layout.unpack = UnpackBGRA;
+					_layout.matches = BGRA8;
+				}
+				else
+				{
+					channels = 3;
+					_layout.unpack = UnpackBGRX;
+				}
+			}
+			else throw std::runtime_error("TGA pixel depth isn't supported.");
+
+			break;
+		}
+
+		case 3: // gray
+		{
+			if (depth != 8)
+			{
+				throw std::runtime_error("TGA pixel depth isn't supported.");
+			}
+
+			channels = 1;
+			_layout.unpack = UnpackGray;
+			_layout.matches = R8;
+			break;
+		}
+	}
+}
+
+void RawImageProperties::ReadBMPHeader(const unsigned char* _data, size_t _size, RawLayout& _layout)
+{
+	if (_size < BMP_FILE_HEADER_SIZE + 12 || _data[0] != 'B' || _data[1] != 'M')
+	{
+		throw std::runtime_error("File is not a BMP image.");
+	}
+
+	const size_t headerSize = ReadUInt32(_data + 14);
+	unsigned int bitCount, compression, coloursUsed, paletteEntryBytes;
+	long long signedHeight;
+
+	// OS/2 core header, 16-bit sizes and 3-byte palette entries
+	if (headerSize == 12)
+	{
+		width = ReadUInt16(_data + 18);
+		signedHeight = ReadUInt16(_data + 20);
+		bitCount = ReadUInt16(_data + 24);
+		compression = BMP_RGB;
+		coloursUsed = 0;
+		paletteEntryBytes = 3;
+	}
+	else if (headerSize >= 40 && headerSize <= _size - BMP_FILE_HEADER_SIZE)
+	{
+		const int signedWidth = (int)ReadUInt32(_data + 18);
+
+		width = (signedWidth > 0) ? (unsigned int)signedWidth : 0;
+		signedHeight = (int)ReadUInt32(_data + 22);
+		bitCount = ReadUInt16(_data + 28);
+		compression = ReadUInt32(_data + 30);
+		coloursUsed = ReadUInt32(_data + 46);
+		paletteEntryBytes = 4;
+	}
+	else throw std::runtime_error("BMP header isn't supported.");
+
+	// Negative heights are stored top row first
+	height = (unsigned int)((signedHeight < 0) ? -signedHeight : signedHeight);
+	CheckDimensions(width, height);
+
+	if (compression != BMP_RGB && compression != BMP_BITFIELDS && compression != BMP_ALPHABITFIELDS)
+	{
+		throw std::runtime_error("Compressed BMP images aren't supported.");
+	}
+
+	_layout.offset = ReadUInt32(_data + 10);
+	_layout.rowBytes = ((size_t)width * bitCount + 7) / 8;
+	_layout.rowPitch = (((size_t)width * bitCount + 31) / 32) * 4;
+	_layout.bottomUp = (signedHeight > 0);
+	_layout.rightToLeft = false;
+	_layout.matches = TOTAL_PIXEL_FORMATS;
+
+	// Masks follow a 40-byte header, or are part of the later ones, at the same place either way
+	unsigned int masks[4] = {};
+
+	if (compression != BMP_RGB)
+	{
+		const bool hasAlphaMask = (compression == BMP_ALPHABITFIELDS || headerSize >= 56);
+
+		if (_size < BMP_FILE_HEADER_SIZE + 40 + (hasAlphaMask ? 16 : 12))
+		{
+			throw std::runtime_error("BMP bitfields are cut short.");
+		}
+
+		for (unsigned int c = 0; c < (hasAlphaMask ? 4u : 3u); c++)
+		{
+			masks[c] = ReadUInt32(_data + BMP_FILE_HEADER_SIZE + 40 + c * 4);
+		}
+	}
+
+	switch (bitCount)
+	{
+		case 1:
+		case 4:
+		case 8:
+		{
+			if (compression != BMP_RGB)
+			{
+				throw std::runtime_error("BMP bitfields need 16 or 32-bit pixels.");
+			}
+
+			const size_t paletteOffset = BMP_FILE_HEADER_SIZE + headerSize;
+			const unsigned int maxColours = 1u << bitCount;
+			const unsigned int paletteSize = (coloursUsed == 0 || coloursUsed > maxColours) ? maxColours : coloursUsed;
+
+			if (paletteOffset + (size_t)paletteSize * paletteEntryBytes > _size)
+			{
+				throw std::runtime_error("BMP palette is cut short.");
+			}
+
+			// Stored BGR, indices past the end of the palette are opaque black
+			for (unsigned int i = 0; i < 256; i++)
+			{
+				_layout.palette[i][3] = 255;
+			}
+
+			for (unsigned int i = 0; i < paletteSize; i++)
+			{
+				const unsigned char* entry = _data + paletteOffset + i * paletteEntryBytes;
+
+				_layout.palette[i][0] = entry[2];
+				_layout.palette[i][1] = entry[1];
+				_layout.palette[i][2] = entry[0];
+			}
+
+			channels = 3;
+			_layout.unpack = (bitCount == 1) ? UnpackIndexed<1> : (bitCount == 4) ? UnpackIndexed<4> : UnpackIndexed<8>;
+			break;
+		}
+
+		case 16:
+		{
+			if (compression == BMP_RGB)
+			{
+				masks[0] = 0x7C00;
+				masks[1] = 0x03E0;
+				masks[2] = 0x001F;
+			}
+
+			channels = masks[3] ? 4 : 3;
+			SetMasks(_layout, masks[0], masks[1], masks[2], masks[3]);
+			_layout.unpack = UnpackBitfields<2>;
+			break;
+		}
+
+		case 24:
+		{
+			if (compression != BMP_RGB)
+			{
+				throw std::runtime_error("BMP bitfields need 16 or 32-bit pixels.");
+			}
+
+			channels = 3;
+			_layout.unpack = UnpackBGR;
+			break;
+		}
+
+		case 32:
+		{
+			// BI_RGB leaves the fourth byte unused
+			if (compression == BMP_RGB)
+			{
+				masks[0] = 0x00FF0000;
+				masks[1] = 0x0000FF00;
+				masks[2] = 0x000000FF;
+			}
+
+			const bool bgr = (masks[0] == 0x00FF0000 && masks[1] == 0x0000FF00 && masks[2] == 0x000000FF);
+			const bool rgb = (masks[0] == 0x000000FF && masks[1] == 0x0000FF00 && masks[2] == 0x00FF0000);
+
+			channels = masks[3] ? 4 : 3;
+
+			if (bgr && masks[3] == 0xFF000000)
+			{
+				_layout.unpack = UnpackBGRA;
+				_layout.matches = BGRA8;
+			}
+			else if (rgb && masks[3] == 0xFF000000)
+			{
+				_layout.unpack = UnpackRGBA;
+				_layout.matches = RGBA8;
+			}
+			else if (bgr && masks[3] == 0)
+			{
+				_layout.unpack = UnpackBGRX;
+			}
+			else
+			{
+				SetMasks(_layout, masks[0], masks[1], masks[2], masks[3]);
+				_layout.unpack = UnpackBitfields<4>;
+			}
+
+			break;
+		}
+
+		default: throw std::runtime_error("BMP bit depth isn't supported.");
+	}
+}
+
+void RawImageProperties::ReadPNMHeader(const unsigned char* _data, size_t _size, RawLayout& _layout)
+{
+	if (_size < 3 || _data[0] != 'P' || (_data[1] != '5' && _data[1] != '6' && _data[1] != '7'))
+	{
+		throw std::runtime_error("File is not a binary PGM, PPM or PAM image.");
+	}
+
+	size_t pos = 2;
+
+	if (_data[1] == '7')
+	{
+		// Keyword and value lines up to ENDHDR, the tuple type is left out as the depth says as much
+		width = height = channels = _layout.maxValue = 0;
+
+		for (std::string key = ReadToken(_data, _size, pos); key != "ENDHDR"; key = ReadToken(_data, _size, pos))
+		{
+			if (key == "WIDTH")			width = ReadNumber(_data, _size, pos);
+			else if (key == "HEIGHT")	height = ReadNumber(_data, _size, pos);
+			else if (key == "DEPTH")	channels = ReadNumber(_data, _size, pos);
+			else if (key == "MAXVAL")	_layout.maxValue = ReadNumber(_data, _size, pos);
+			else if (key == "TUPLTYPE")	ReadToken(_data, _size, pos);
+			else throw std::runtime_error("PAM header has an unknown or missing keyword.");
+		}
+
+		while (pos < _size && _data[pos] != '\n') pos++;
+	}
+	else
+	{
+		width = ReadNumber(_data, _size, pos);
+		height = ReadNumber(_data, _size, pos);
+		_layout.maxValue = ReadNumber(_data, _size, pos);
+		channels = (_data[1] == '5') ? 1 : 3;
+	}
+
+	// One whitespace character between the header and the samples
+	if (pos >= _size || !isspace(_data[pos]))
+	{
+		throw std::runtime_error("PNM header is cut short.");
+	}
+
+	CheckDimensions(width, height);
+
+	if (channels < 1 || channels > 4 || _layout.maxValue < 1 || _layout.maxValue > 65535)
+	{
+		throw std::runtime_error("PNM header has an invalid depth or max value.");
+	}
+
+	// PNM samples are big-endian like PNG's, so the PNG converters read them as they are
+	static constexpr unsigned int COLOUR_TYPES[4] = { 0, 4, 2, 6 };
+
+	_layout.offset = pos + 1;
+	_layout.colourType = COLOUR_TYPES[channels - 1];
+	_layout.bitDepth = (_layout.maxValue > 255) ? 16 : 8;
+	_layout.rowBytes = _layout.rowPitch = (size_t)width * channels * (_layout.bitDepth / 8);
+	_layout.bottomUp = _layout.rightToLeft = false;
+
+	static constexpr PixelFormat MATCHING_FORMATS[4] = { R8, RG8, TOTAL_PIXEL_FORMATS, RGBA8 };
+	_layout.matches = (_layout.maxValue == 255) ? MATCHING_FORMATS[channels - 1] : TOTAL_PIXEL_FORMATS;
+}
+
+void RawImageProperties::Load(const std::shared_ptr<MappedFile>& _file, const RawLayout& _layout)
+{
+	const size_t size = _file->GetSize();
+
+	// The last row doesn't need its padding
+	if (_layout.offset > size || (unsigned long long)_layout.rowPitch * (height - 1) + _layout.rowBytes > size - _layout.offset)
+	{
+		throw std::runtime_error("Image data is cut short.");
+	}
+
+	const unsigned char* rows = _file->GetData() + _layout.offset;
+	const size_t bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+	const size_t outRowBytes = (size_t)width * bytesPerPixel;
+
+	// Already laid out as pixelFormat, the pixels are the file
+	if (_layout.matches == pixelFormat && !_layout.bottomUp && !_layout.rightToLeft && _layout.rowPitch == outRowBytes)
+	{
+		pixels.AssignView(_file, rows, outRowBytes * height);
+		mapped = true;
+		return;
+	}
+
+	pixels.assign(outRowBytes * height, 0);
+	unsigned char* out = pixels.GetWritableData();
+
+	// PNM samples convert straight to pixelFormat. TGA and BMP rows are unpacked to RGBA8, straight into pixels if that's
+	// the format, otherwise into a row converted by the PNG converter for 8-bit RGBA like JPEGs and QOIs
+	PNGScanlineConverter convert = nullptr;
+	PNGConvertParams params = PNGConvertParams();
+	std::vector<unsigned char> sampleTable, rgbaRow;
+
+	if (_layout.matches != pixelFormat)
+	{
+		const unsigned int bitDepth = _layout.unpack ? 8 : _layout.bitDepth;
+		const unsigned int sampleMax = (1u << bitDepth) - 1;
+		const unsigned int maxValue = _layout.unpack ? sampleMax : _layout.maxValue;
+
+		if (_layout.unpack && pixelFormat != RGBA8)
+		{
+			rgbaRow.resize((size_t)width * 4);
+		}
+
+		if (!_layout.unpack || pixelFormat != RGBA8)
+		{
+			sampleTable.resize(PNGConverters::GetSampleTableSize(bitDepth, pixelFormat));
+
+			// Samples over a max value that isn't all ones clamp to it
+			if (maxValue == sampleMax)
+			{
+				PNGConverters::BuildSampleTable(bitDepth, pixelFormat, sampleTable.data());
+			}
+			else for (unsigned int i = 0; i <= sampleMax; i++)
+			{
+				PNGConverters::WriteChannel((float)std::min(i, maxValue) / (float)maxValue, pixelFormat, sampleTable.data(), i);
+			}
+
+			params.sampleTable = params.alphaTable = sampleTable.data();
+			convert = PNGConverters::GetConverter(_layout.unpack ? 6 : _layout.colourType, bitDepth, pixelFormat, maxValue == sampleMax);
+		}
+	}
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const unsigned char* src = rows + (size_t)(_layout.bottomUp ? height - 1 - y : y) * _layout.rowPitch;
+		unsigned char* dst = out + (size_t)y * outRowBytes;
+
+		if (_layout.matches == pixelFormat)
+		{
+			memcpy(dst, src, outRowBytes);
+		}
+		else if (!_layout.unpack)
+		{
+			convert(src, width, dst, bytesPerPixel, params);
+		}
+		else if (convert)
+		{
+			_layout.unpack(src, width, rgbaRow.data(), _layout);
+			convert(rgbaRow.data(), width, dst, bytesPerPixel, params);
+		}
+		else _layout.unpack(src, width, dst, _layout);
+
+		if (_layout.rightToLeft)
+		{
+			for (unsigned int x = 0; x < width / 2; x++)
+			{
+				std::swap_ranges(dst + x * bytesPerPixel, dst + (x + 1) * bytesPerPixel, dst + (width - 1 - x) * bytesPerPixel);
+			}
+		}
+	}
+}
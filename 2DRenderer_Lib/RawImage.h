@@ -0,0 +1,50 @@
+#pragma once
+#include "DLLCommon.h"
+#include "PixelBuffer.h"
+#include "PixelFormat.h"
+
+#pragma warning(disable : 4251)
+#include <cstddef>
+#include <memory>
+
+class MappedFile;
+struct RawLayout;
+
+// Uncompressed TGA, BMP and binary PNM (PGM, PPM and PAM) images. When the file's rows are already laid out as the
+// requested format, top row first with no padding between them, the pixels are a view of the mapped file and loading
+// costs the mapping and nothing else: 32-bit TGAs and BMPs as BGRA8, 8-bit gray TGAs and PGMs as R8, PAMs as R8, RG8 or RGBA8.
+// Anything else is converted a row at a time.
+// A file viewed this way must not be rewritten in place while its pixels are alive, replace it instead.
+class RENDERER_API RawImageProperties
+{
+public:
+	RawImageProperties();
+
+	// Types 1 (8-bit colour mapped), 2 (15, 16, 24 or 32-bit true colour) and 3 (8-bit gray), RLE compressed types aren't supported
+	void LoadTGA(const char* _filePath, PixelFormat _format = RGBA8);
+
+	// 1, 4 or 8-bit indexed, 16, 24 or 32-bit, BI_RGB or bitfields, RLE compressed files aren't supported
+	void LoadBMP(const char* _filePath, PixelFormat _format = RGBA8);
+
+	// P5, P6 and P7 with up to 4 channels and any max value up to 65535
+	void LoadPNM(const char* _filePath, PixelFormat _format = RGBA8);
+
+protected:
+	std::shared_ptr<MappedFile> Open(const char* _filePath, PixelFormat _format);
+
+	void ReadTGAHeader(const unsigned char* _data, size_t _size, RawLayout& _layout);
+	void ReadBMPHeader(const unsigned char* _data, size_t _size, RawLayout& _layout);
+	void ReadPNMHeader(const unsigned char* _data, size_t _size, RawLayout& _layout);
+
+	// Views or converts the rows _layout describes into pixels
+	void Load(const std::shared_ptr<MappedFile>& _file, const RawLayout& _layout);
+
+public:
+	unsigned int width, height;
+	unsigned int channels; // in the file, 1 gray, 2 gray + alpha, 3 RGB or 4 RGBA
+
+	PixelFormat pixelFormat;
+	PixelBuffer pixels; // width * height pixels laid out as pixelFormat, shared between copies
+
+	bool mapped; // pixels view the file, nothing was copied
+};
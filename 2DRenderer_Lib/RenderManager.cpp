@@ -5,7 +5,9 @@
 #define GLEW_STATIC
 #include <glew.h>
 
-#include "Texture2D.h"
+#include "TextureBake.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
 
 static const GLchar* vertexSource = R"glsl(
     #version 150 core
@@ -51,12 +53,19 @@ RenderManager* RenderManager::mInstance = nullptr;
 RenderManager::RenderManager()
 {
     mWindow = nullptr;
+    mTextureStreamer = nullptr;
+    mTextureCache = nullptr;
+    mTexture = 0;
+    mBakedTextures = nullptr;
     mShaderProgram = 0;
 }
 
 RenderManager::~RenderManager()
 {
-
+    // The cache releases its textures through the streamer
+    delete mTextureCache;
+    delete mTextureStreamer;
+    delete mBakedTextures;
 }
 
 static void error_callback(int error, const char* description)
@@ -161,19 +170,21 @@ void RenderManager::CreateGraphicObjects()
 
 void RenderManager::LoadTexture()
 {
-    // Create texture
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    Texture2D t = Texture2D("./PNGSuite/5-transparency/tbgn2c16.png");
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, t.mPNGProps.width, t.mPNGProps.height, 0, GL_RGBA, GL_FLOAT, t.mPNGProps.pixels.data());
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Returns straight away, a transparent placeholder is bound until the texture is decoded and uploaded
+    if (!mTextureStreamer)
+    {
+        mTextureStreamer = new TextureStreamer();
+        mTextureCache = new TextureCache(*mTextureStreamer);
+
+        // Optional, without it everything is decoded from source
+        mBakedTextures = new TextureBakeFile();
+        if (mBakedTextures->Open("./Textures.r2dtex"))
+        {
+            mTextureStreamer->SetBakedTextures(mBakedTextures);
+        }
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    mTexture = mTextureCache->Acquire("./PNGSuite/5-transparency/tbgn2c16.png");
 
     // Enable transparency
     glEnable(GL_BLEND);
@@ -184,6 +195,11 @@ void RenderManager::RenderLoop()
 {
     while (!glfwWindowShouldClose(mWindow))
     {
+        // Uploads whatever finished decoding, within the per-frame budget
+        mTextureStreamer->Update();
+        mTextureCache->Update();
+        glBindTexture(GL_TEXTURE_2D, mTextureStreamer->GetGLTexture(mTexture));
+
         int width, height;
         glfwGetWindowSize(mWindow, &width, &height);
 
@@ -2,6 +2,9 @@
 #include "DLLCommon.h"
 
 struct GLFWwindow;
+class TextureBakeFile;
+class TextureCache;
+class TextureStreamer;
 
 class RENDERER_API RenderManager
 {
@@ -36,6 +39,12 @@ protected:
 
 	GLFWwindow* mWindow;
 
+	// Decodes off the render thread, finished textures are uploaded at the start of each frame within a budget
+	TextureStreamer* mTextureStreamer;
+	TextureCache* mTextureCache; // shares textures requested more than once
+	unsigned int mTexture; // streamer handle
+	TextureBakeFile* mBakedTextures; // textures decoded ahead of time, used over their sources while still up to date
+
 	unsigned int mShaderProgram;
 };
 
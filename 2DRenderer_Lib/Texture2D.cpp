@@ -1,51 +1,185 @@
 #include "Texture2D.h"
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
 #pragma warning(disable : 6054)
 
+static std::atomic<TextureResidency> gDefaultResidency = { KEEP_PIXELS };
+static std::atomic<unsigned int> gReleasedPixels = { 0 }, gRematerialisedPixels = { 0 };
+
 Texture2D::Texture2D()
 {
 	mFilePath		= "";
 	mFileName		= "";
 	mFormat			= UNSUPPORTED;
+	mPixelFormat	= RGBA8;
+	mDecodeScale	= FULL_SIZE;
 	mPNGProps		= PNGProperties();
+	mLoaded			= false;
+	mResidency		= gDefaultResidency;
+	mPixelsReleased	= false;
 }
 
-Texture2D::Texture2D(std::string _filePath)
+Texture2D::Texture2D(std::string _filePath, PixelFormat _pixelFormat, TextureDecodeScale _scale)
 {
 	mFilePath = _filePath;
+	mPixelFormat = _pixelFormat;
+	mDecodeScale = _scale;
 	mPNGProps = PNGProperties();
+	mLoaded = false;
+	mResidency = gDefaultResidency;
+	mPixelsReleased = false;
 
-	SetFileName();
-	SetFormat();
+	Load(nullptr);
+}
+
+Texture2D::Texture2D(std::string _filePath, PNGDecoder& _decoder, PixelFormat _pixelFormat, TextureDecodeScale _scale)
+{
+	mFilePath = _filePath;
+	mPixelFormat = _pixelFormat;
+	mDecodeScale = _scale;
+	mPNGProps = PNGProperties();
+	mLoaded = false;
+	mResidency = gDefaultResidency;
+	mPixelsReleased = false;
+
+	Load(&_decoder);
+}
+
+Texture2D::Texture2D(const Texture2D& _tex)
+{
+	mFilePath		= _tex.mFilePath;
+	mFileName		= _tex.mFileName;
+	mFormat			= _tex.mFormat;
+	mPixelFormat	= _tex.mPixelFormat;
+	mDecodeScale	= _tex.mDecodeScale;
+	mPNGProps		= _tex.mPNGProps;
+	mLoaded			= _tex.mLoaded;
+	mResidency		= _tex.mResidency;
+	mPixelsReleased	= _tex.mPixelsReleased;
+}
+
+Texture2D::Texture2D(Texture2D&& _tex)
+{
+	*this = std::move(_tex);
+}
+
+Texture2D& Texture2D::operator=(const Texture2D& _tex)
+{
+	mFilePath		= _tex.mFilePath;
+	mFileName		= _tex.mFileName;
+	mFormat			= _tex.mFormat;
+	mPixelFormat	= _tex.mPixelFormat;
+	mDecodeScale	= _tex.mDecodeScale;
+	mPNGProps		= _tex.mPNGProps;
+	mLoaded			= _tex.mLoaded;
+	mResidency		= _tex.mResidency;
+	mPixelsReleased	= _tex.mPixelsReleased;
+
+	return *this;
+}
+
+Texture2D& Texture2D::operator=(Texture2D&& _tex)
+{
+	mFilePath		= std::move(_tex.mFilePath);
+	mFileName		= std::move(_tex.mFileName);
+	mFormat			= _tex.mFormat;
+	mPixelFormat	= _tex.mPixelFormat;
+	mDecodeScale	= _tex.mDecodeScale;
+	mPNGProps		= std::move(_tex.mPNGProps);
+	mLoaded			= _tex.mLoaded;
+	mResidency		= _tex.mResidency;
+	mPixelsReleased	= _tex.mPixelsReleased;
+
+	// Its pixels went with the move
+	_tex.mLoaded = false;
+
+	return *this;
+}
+
+bool Texture2D::ProbeInfo(std::string _filePath, PNGInfo& _info, bool _scanChunks)
+{
+	Texture2D tex = Texture2D();
+	tex.mFilePath = _filePath;
+
+	tex.SetFileName();
+	tex.SetFormat();
+
+	// Only PNG headers can be probed so far
+	if (tex.mFormat != PNG)
+		return false;
 
 	try
 	{
-		if (IsValidFormat())
-		{
-			switch (mFormat)
-			{
-				case PNG:	LoadPNG();	break;
-				case JPG:	LoadJPG();	break;
-			}
-		}
+		_info = PNGProperties::Probe(_filePath.c_str(), _scanChunks);
 	}
 	catch (const std::exception& _e)
 	{
-		std::cout << "!! Exception reading " << mFileName << " !!" << std::endl;
+		std::cout << "!! Exception probing " << tex.mFileName << " !!" << std::endl;
 		std::cout << _e.what() << std::endl;
+
+		return false;
 	}
+
+	return true;
 }
 
-Texture2D::Texture2D(const Texture2D& _tex)
+void Texture2D::OnUploaded()
 {
-	mFilePath		= _tex.mFilePath;
-	mFileName		= _tex.mFileName;
-	mFormat			= _tex.mFormat;
-	mPNGProps		= _tex.mPNGProps;
+	if (mResidency == RELEASE_AFTER_UPLOAD)
+	{
+		ReleasePixels();
+	}
+}
+
+void Texture2D::ReleasePixels()
+{
+	if (mPixelsReleased || !mLoaded)
+		return;
+
+	// Only lets go of the storage if a copy of this texture still shares it
+	mPNGProps.pixels.Release();
+	mPixelsReleased = true;
+
+	gReleasedPixels++;
+}
+
+const PixelBuffer& Texture2D::GetPixels()
+{
+	if (mPixelsReleased)
+	{
+		mPixelsReleased = false;
+		mLoaded = false;
+
+		Load(nullptr);
+
+		gRematerialisedPixels++;
+	}
+
+	return mPNGProps.pixels;
+}
+
+void Texture2D::SetDefaultResidency(TextureResidency _residency)
+{
+	gDefaultResidency = _residency;
+}
+
+TextureMemoryStats Texture2D::GetMemoryStats()
+{
+	TextureMemoryStats stats = TextureMemoryStats();
+	stats.cpuBytes = PixelBuffer::GetBytesHeld();
+	stats.pixelBuffers = PixelBuffer::GetStorageCount();
+	stats.released = gReleasedPixels;
+	stats.rematerialised = gRematerialisedPixels;
+	stats.mappedBytes = PixelBuffer::GetBytesViewed();
+
+	return stats;
 }
 
 void Texture2D::SetFileName()
@@ -60,26 +194,46 @@ void Texture2D::SetFileName()
 
 void Texture2D::SetFormat()
 {
-	size_t extStart = mFileName.find_last_of('.');
-	if (extStart == mFileName.npos || mFileName.back() == '.')
+	mFormat = GetFileFormat(mFileName);
+}
+
+FileFormat Texture2D::GetFileFormat(std::string _filePath)
+{
+	size_t extStart = _filePath.find_last_of('.');
+	if (extStart == _filePath.npos || _filePath.back() == '.' || _filePath.find_first_of("/\\", extStart) != _filePath.npos)
 	{
-		mFormat = UNSUPPORTED;
-		return;
+		return UNSUPPORTED;
 	}
 
-	std::string extension = mFileName.substr(extStart + 1, mFileName.length() - extStart);
+	std::string extension = _filePath.substr(extStart + 1, _filePath.length() - extStart);
 	std::transform(extension.begin(), extension.end(), extension.begin(),
 		[](unsigned char c) { return std::tolower(c); });
 
 	if (extension == "png")
 	{
-		mFormat = PNG;
+		return PNG;
 	} 
 	else if (extension == "jpg" || extension == "jpeg")
 	{
-		mFormat = JPG;
+		return JPG;
 	} 
-	else mFormat = UNSUPPORTED;
+	else if (extension == "qoi")
+	{
+		return QOI;
+	}
+	else if (extension == "tga")
+	{
+		return TGA;
+	}
+	else if (extension == "bmp")
+	{
+		return BMP;
+	}
+	else if (extension == "pgm" || extension == "ppm" || extension == "pam" || extension == "pnm")
+	{
+		return PNM;
+	}
+	else return UNSUPPORTED;
 }
 
 const bool Texture2D::IsValidFormat() const
@@ -87,12 +241,93 @@ const bool Texture2D::IsValidFormat() const
 	return !(mFormat == UNSUPPORTED || mFormat >= TOTAL_SUPPORTED_FORMATS);
 }
 
-void Texture2D::LoadPNG()
+void Texture2D::Load(PNGDecoder* _decoder)
 {
-	mPNGProps.LoadPNG(mFilePath.c_str());
+	SetFileName();
+	SetFormat();
+
+	try
+	{
+		if (IsValidFormat())
+		{
+			switch (mFormat)
+			{
+				case PNG:	LoadPNG(_decoder);	mLoaded = true;	break;
+				case JPG:	LoadJPG(_decoder);	mLoaded = true;	break;
+				case QOI:	LoadQOI();			mLoaded = true;	break;
+				case TGA:
+				case BMP:
+				case PNM:	LoadRaw();			mLoaded = true;	break;
+				default:	throw std::runtime_error("No loader for file format " + std::to_string((int)mFormat) + ".");
+			}
+		}
+	}
+	catch (const std::exception& _e)
+	{
+		std::cout << "!! Exception reading " << mFileName << " !!" << std::endl;
+		std::cout << _e.what() << std::endl;
+	}
+}
+
+void Texture2D::LoadPNG(PNGDecoder* _decoder)
+{
+	if (_decoder != nullptr)
+	{
+		_decoder->Decode(mFilePath.c_str(), mPNGProps, mPixelFormat);
+	}
+	else mPNGProps.LoadPNG(mFilePath.c_str(), mPixelFormat);
 }
 
-void Texture2D::LoadJPG()
+void Texture2D::LoadJPG(PNGDecoder* _decoder)
 {
-	// TODO
+	// A decoder that doesn't pool its work is running on a pool worker, the JPEG mustn't queue tasks behind it either
+	JPEGProperties jpeg = JPEGProperties();
+	jpeg.LoadJPEG(mFilePath.c_str(), mPixelFormat, _decoder == nullptr || _decoder->IsPooledConversion(), mDecodeScale);
+
+	// Uploaders only look at mPNGProps, so the size and pixels of a JPEG go there too. The pixels are shared, not copied
+	mPNGProps = PNGProperties();
+	mPNGProps.width = jpeg.width;
+	mPNGProps.height = jpeg.height;
+	mPNGProps.bitDepth = 8;
+	mPNGProps.colourType = (jpeg.componentCount == 1) ? 0 : 2;
+	mPNGProps.pixelFormat = jpeg.pixelFormat;
+	mPNGProps.pixels = jpeg.pixels;
+}
+
+void Texture2D::LoadQOI()
+{
+	QOIProperties qoi = QOIProperties();
+	qoi.LoadQOI(mFilePath.c_str(), mPixelFormat);
+
+	// Handed to the uploaders through mPNGProps like JPEGs, sharing the pixels
+	mPNGProps = PNGProperties();
+	mPNGProps.width = qoi.width;
+	mPNGProps.height = qoi.height;
+	mPNGProps.bitDepth = 8;
+	mPNGProps.colourType = (qoi.channels == 4) ? 6 : 2;
+	mPNGProps.pixelFormat = qoi.pixelFormat;
+	mPNGProps.pixels = qoi.pixels;
+}
+
+void Texture2D::LoadRaw()
+{
+	// Pixels laid out as mPixelFormat in the file stay a view of it, 32-bit TGAs and BMPs as BGRA8 for example
+	RawImageProperties raw = RawImageProperties();
+
+	switch (mFormat)
+	{
+		case TGA:	raw.LoadTGA(mFilePath.c_str(), mPixelFormat);	break;
+		case BMP:	raw.LoadBMP(mFilePath.c_str(), mPixelFormat);	break;
+		default:	raw.LoadPNM(mFilePath.c_str(), mPixelFormat);	break;
+	}
+
+	static constexpr unsigned int COLOUR_TYPES[4] = { 0, 4, 2, 6 };
+
+	mPNGProps = PNGProperties();
+	mPNGProps.width = raw.width;
+	mPNGProps.height = raw.height;
+	mPNGProps.bitDepth = 8;
+	mPNGProps.colourType = COLOUR_TYPES[raw.channels - 1];
+	mPNGProps.pixelFormat = raw.pixelFormat;
+	mPNGProps.pixels = raw.pixels;
 }
@@ -1,6 +1,9 @@
 #pragma once
 #include "DLLCommon.h"
+#include "JPEG.h"
 #include "PNG.h"
+#include "QOI.h"
+#include "RawImage.h"
 
 #pragma warning(disable : 4251)
 #include <string>
@@ -10,16 +13,76 @@ enum RENDERER_API FileFormat
 	UNSUPPORTED = -1,
 	PNG,
 	JPG,
+	QOI,
+	TGA,
+	BMP,
+	PNM, // binary PGM, PPM and PAM
 
 	TOTAL_SUPPORTED_FORMATS
 };
 
+// What happens to a texture's decoded pixels once they're on the GPU
+enum RENDERER_API TextureResidency
+{
+	KEEP_PIXELS,			// the CPU copy stays for the texture's lifetime
+	RELEASE_AFTER_UPLOAD	// only the metadata stays, pixels are decoded again if they're asked for
+};
+
+// Size JPEGs decode at, straight from the DCT coefficients without reconstructing full resolution first.
+// Other formats always load at full size
+enum RENDERER_API TextureDecodeScale
+{
+	FULL_SIZE = 1,
+	HALF_SIZE = 2,
+	QUARTER_SIZE = 4,
+	EIGHTH_SIZE = 8
+};
+
+struct RENDERER_API TextureMemoryStats
+{
+	size_t cpuBytes = 0;				// pixel storage alive right now, storage shared by copies counted once
+	unsigned int pixelBuffers = 0;		// distinct pixel storages alive
+	unsigned int released = 0;			// CPU copies dropped after upload so far
+	unsigned int rematerialised = 0;	// dropped copies decoded again because they were accessed
+	size_t mappedBytes = 0;				// file bytes pixels view in place of storage of their own, not part of cpuBytes
+};
+
 class RENDERER_API Texture2D
 {
 public:
 	Texture2D();
-	Texture2D(std::string _filePath);
+	Texture2D(std::string _filePath, PixelFormat _pixelFormat = RGBA8, TextureDecodeScale _scale = FULL_SIZE);
+	Texture2D(std::string _filePath, PNGDecoder& _decoder, PixelFormat _pixelFormat = RGBA8, TextureDecodeScale _scale = FULL_SIZE); // decodes through _decoder's buffers
+
+	// Copies share the decoded pixels, moves take them
 	Texture2D(const Texture2D& _tex);
+	Texture2D(Texture2D&& _tex);
+	Texture2D& operator=(const Texture2D& _tex);
+	Texture2D& operator=(Texture2D&& _tex);
+
+	// Fills _info from the file header without loading the texture, returns false if the format
+	// isn't supported or the header couldn't be read.
+	static bool ProbeInfo(std::string _filePath, PNGInfo& _info, bool _scanChunks = false);
+
+	// Format from the file extension, UNSUPPORTED if it's missing or not one we can load
+	static FileFormat GetFileFormat(std::string _filePath);
+
+	// Called by whatever uploaded the pixels, drops the CPU copy under RELEASE_AFTER_UPLOAD
+	void OnUploaded();
+
+	// Drops the CPU copy whatever the residency. Width, height and format stay valid
+	void ReleasePixels();
+
+	// Decodes the pixels again from mFilePath first if they were released, empty if that fails. Not thread safe
+	const PixelBuffer& GetPixels();
+	const bool ArePixelsResident() const		{ return !mPixelsReleased; }
+
+	void SetResidency(TextureResidency _residency)		{ mResidency = _residency; }
+	const TextureResidency GetResidency() const			{ return mResidency; }
+
+	// Residency of textures constructed after this, KEEP_PIXELS to begin with
+	static void SetDefaultResidency(TextureResidency _residency);
+	static TextureMemoryStats GetMemoryStats();
 
 protected:
 	void SetFileName();
@@ -27,14 +90,25 @@ protected:
 
 	const bool IsValidFormat() const;
 
-	void LoadPNG();
-	void LoadJPG();
+	void Load(PNGDecoder* _decoder);
+	void LoadPNG(PNGDecoder* _decoder);
+	void LoadJPG(PNGDecoder* _decoder);
+	void LoadQOI();
+	void LoadRaw(); // TGA, BMP and PNM
 
 public:
 	std::string mFilePath;
 	std::string mFileName;
 
 	FileFormat mFormat;
+	PixelFormat mPixelFormat;
+	TextureDecodeScale mDecodeScale; // kept so released pixels decode again at the same size
 	PNGProperties mPNGProps;
+
+	bool mLoaded; // decoded without errors
+
+protected:
+	TextureResidency mResidency;
+	bool mPixelsReleased; // mPNGProps has metadata only
 };
 
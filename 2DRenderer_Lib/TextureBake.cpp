@@ -0,0 +1,406 @@
+#include "TextureBake.h"
+#include "ByteHelpers.h"
+#include "TextureBatchLoader.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+static std::uint64_t AlignUp(std::uint64_t _value, std::uint64_t _alignment)
+{
+	return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+// Modification time and size of a source file, false if it doesn't exist
+static bool GetSourceStamp(const std::string& _filePath, std::int64_t& _time, std::uint64_t& _size)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(_filePath.c_str(), &info) != 0)
+		return false;
+#else
+	struct stat info;
+	if (stat(_filePath.c_str(), &info) != 0)
+		return false;
+#endif
+
+	_time = (std::int64_t)info.st_mtime;
+	_size = (std::uint64_t)info.st_size;
+
+	return true;
+}
+
+static std::string MakeKey(const std::string& _sourcePath, PixelFormat _pixelFormat)
+{
+	return TextureCache::CanonicalisePath(_sourcePath) + '|' + std::to_string((int)_pixelFormat);
+}
+
+// Bytes taken by all of an entry's levels, each padded out to the data alignment
+static std::uint64_t GetDataSize(const TextureBakeEntry& _entry)
+{
+	std::uint64_t size = 0;
+	unsigned int width = _entry.width, height = _entry.height;
+
+	for (unsigned int level = 0; level < _entry.levelCount; level++)
+	{
+		size += AlignUp(TextureBaker::GetLevelSize(width, height, (PixelFormat)_entry.pixelFormat, _entry.rowAlignment), TEXTURE_BAKE_DATA_ALIGNMENT);
+
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	return size;
+}
+
+template<typename T>
+static T Average(T _a, T _b, T _c, T _d)
+{
+	return (T)(((std::uint32_t)_a + _b + _c + _d + 2) / 4);
+}
+
+template<>
+float Average(float _a, float _b, float _c, float _d)
+{
+	return (_a + _b + _c + _d) * 0.25f;
+}
+
+// 2x2 box filter down to the next mip level, odd rows / columns at the edge are reused
+template<typename T>
+static void Downsample(const unsigned char* _source, unsigned int _width, unsigned int _height, unsigned int _channels, unsigned char* _destination)
+{
+	const T* source = (const T*)_source;
+	T* destination = (T*)_destination;
+
+	unsigned int width = std::max(1u, _width / 2), height = std::max(1u, _height / 2);
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const T* row0 = source + (size_t)std::min(y * 2, _height - 1) * _width * _channels;
+		const T* row1 = source + (size_t)std::min(y * 2 + 1, _height - 1) * _width * _channels;
+
+		for (unsigned int x = 0; x < width; x++)
+		{
+			size_t x0 = (size_t)std::min(x * 2, _width - 1) * _channels;
+			size_t x1 = (size_t)std::min(x * 2 + 1, _width - 1) * _channels;
+
+			for (unsigned int c = 0; c < _channels; c++)
+			{
+				*destination++ = Average<T>(row0[x0 + c], row0[x1 + c], row1[x0 + c], row1[x1 + c]);
+			}
+		}
+	}
+}
+
+TextureBakeFile::TextureBakeFile()
+{
+}
+
+bool TextureBakeFile::Open(const char* _filePath)
+{
+	Close();
+
+	if (!mFile.Open(_filePath))
+		return false;
+
+	const unsigned char* data = mFile.GetData();
+	const size_t size = mFile.GetSize();
+
+	const TextureBakeHeader* header = (const TextureBakeHeader*)data;
+
+	if (size < sizeof(TextureBakeHeader) || memcmp(header->magic, TEXTURE_BAKE_MAGIC, sizeof(TEXTURE_BAKE_MAGIC)) != 0 ||
+		header->version != TEXTURE_BAKE_VERSION || header->fileSize != size || header->tocOffset % 8 != 0 ||
+		header->tocOffset > size || (size - header->tocOffset) / sizeof(TextureBakeEntry) < header->entryCount)
+	{
+		Close();
+		return false;
+	}
+
+	const TextureBakeEntry* entries = (const TextureBakeEntry*)(data + header->tocOffset);
+	mIndex.reserve(header->entryCount);
+
+	for (unsigned int i = 0; i < header->entryCount; i++)
+	{
+		const TextureBakeEntry& entry = entries[i];
+
+		// Anything pointing outside the file is skipped rather than trusted
+		bool valid = entry.pixelFormat < TOTAL_PIXEL_FORMATS && entry.width != 0 && entry.height != 0 && entry.levelCount != 0 &&
+			(entry.rowAlignment == 1 || entry.rowAlignment == 2 || entry.rowAlignment == 4 || entry.rowAlignment == 8) &&
+			entry.dataOffset % TEXTURE_BAKE_DATA_ALIGNMENT == 0 && entry.dataOffset <= size && entry.dataSize <= size - entry.dataOffset &&
+			entry.dataSize >= GetDataSize(entry) && entry.pathOffset <= size && entry.pathLength <= size - entry.pathOffset;
+
+		if (!valid)
+			continue;
+
+		std::string sourcePath((const char*)data + entry.pathOffset, entry.pathLength);
+		mIndex[MakeKey(sourcePath, (PixelFormat)entry.pixelFormat)] = &entry;
+	}
+
+	return true;
+}
+
+void TextureBakeFile::Close()
+{
+	mIndex.clear();
+	mFile.Close();
+}
+
+const TextureBakeEntry* TextureBakeFile::Find(const std::string& _sourcePath, PixelFormat _pixelFormat) const
+{
+	auto found = mIndex.find(MakeKey(_sourcePath, _pixelFormat));
+	if (found == mIndex.end())
+		return nullptr;
+
+	const TextureBakeEntry* entry = found->second;
+
+	// Shipped without its sources, nothing to go stale against
+	std::int64_t time;
+	std::uint64_t size;
+	if (!GetSourceStamp(_sourcePath, time, size))
+		return entry;
+
+	if (time == entry->sourceTime && size == entry->sourceSize)
+		return entry;
+
+	if (size != entry->sourceSize)
+		return nullptr;
+
+	// Touched but possibly unchanged, e.g. checked out again
+	MappedFile source;
+	if (!source.Open(_sourcePath.c_str()))
+		return nullptr;
+
+	return (R2D_BH::HashBytes(source.GetData(), source.GetSize()) == entry->contentHash) ? entry : nullptr;
+}
+
+BakedTextureLevel TextureBakeFile::GetLevel(const TextureBakeEntry& _entry, const unsigned char* _fileData, unsigned int _level)
+{
+	const PixelFormat pixelFormat = (PixelFormat)_entry.pixelFormat;
+
+	std::uint64_t offset = _entry.dataOffset;
+	unsigned int width = _entry.width, height = _entry.height;
+
+	for (unsigned int level = 0; level < _level; level++)
+	{
+		offset += AlignUp(TextureBaker::GetLevelSize(width, height, pixelFormat, _entry.rowAlignment), TEXTURE_BAKE_DATA_ALIGNMENT);
+
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	BakedTextureLevel level;
+	level.width = width;
+	level.height = height;
+	level.rowPitch = (size_t)AlignUp((std::uint64_t)width * PixelFormatInfo::GetBytesPerPixel(pixelFormat), _entry.rowAlignment);
+	level.data = _fileData + offset;
+
+	return level;
+}
+
+TextureBaker::TextureBaker()
+{
+	mMipmaps = false;
+	mRowAlignment = 4;
+}
+
+void TextureBaker::Add(const std::string& _sourcePath, PixelFormat _pixelFormat)
+{
+	mSources.push_back({ _sourcePath, _pixelFormat });
+}
+
+void TextureBaker::Add(const std::vector<std::string>& _sourcePaths, PixelFormat _pixelFormat)
+{
+	for (const std::string& sourcePath : _sourcePaths)
+	{
+		Add(sourcePath, _pixelFormat);
+	}
+}
+
+void TextureBaker::SetRowAlignment(unsigned int _alignment)
+{
+	if (_alignment != 1 && _alignment != 2 && _alignment != 4 && _alignment != 8)
+		throw std::runtime_error("Texture bake row alignment must be 1, 2, 4 or 8 bytes!");
+
+	mRowAlignment = _alignment;
+}
+
+unsigned int TextureBaker::Write(const std::string& _outputPath, ThreadPool& _pool)
+{
+	const std::string tempPath = _outputPath + ".tmp";
+	std::ofstream writer = std::ofstream(tempPath, std::ios::binary | std::ios::trunc);
+
+	if (!writer.is_open())
+	{
+		perror(("Could not create texture bake at: \"" + tempPath + "\"").c_str());
+		return 0;
+	}
+
+	// Filled in once the table of contents is written
+	TextureBakeHeader header = TextureBakeHeader();
+	memcpy(header.magic, TEXTURE_BAKE_MAGIC, sizeof(TEXTURE_BAKE_MAGIC));
+	header.version = TEXTURE_BAKE_VERSION;
+	writer.write((const char*)&header, sizeof(header));
+
+	const char zeros[TEXTURE_BAKE_DATA_ALIGNMENT] = {};
+	std::uint64_t offset = AlignUp(sizeof(header), TEXTURE_BAKE_DATA_ALIGNMENT);
+	writer.write(zeros, offset - sizeof(header));
+
+	std::vector<TextureBakeEntry> entries(mSources.size(), TextureBakeEntry());
+	std::vector<bool> baked(mSources.size(), false);
+
+	// Sources decode concurrently, each is written out as soon as it's done so only the ones in flight are held
+	TextureBatchLoader loader(_pool);
+	std::unordered_map<unsigned int, size_t> sourceIndices;
+
+	for (size_t i = 0; i < mSources.size(); i++)
+	{
+		sourceIndices[loader.Load(mSources[i].path, mSources[i].pixelFormat)] = i;
+	}
+
+	TextureLoadResult result;
+	std::vector<unsigned char> level, nextLevel, padded;
+
+	while (loader.WaitNext(result))
+	{
+		if (!result.texture)
+			continue;
+
+		size_t index = sourceIndices[result.requestID];
+		TextureBakeEntry& entry = entries[index];
+
+		MappedFile source;
+		if (!GetSourceStamp(result.filePath, entry.sourceTime, entry.sourceSize) || !source.Open(result.filePath.c_str()))
+			continue;
+
+		entry.contentHash = R2D_BH::HashBytes(source.GetData(), source.GetSize());
+
+		const PNGProperties& props = result.texture->mPNGProps;
+		const PixelFormat pixelFormat = props.pixelFormat;
+		const unsigned int bytesPerPixel = PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+
+		entry.width = props.width;
+		entry.height = props.height;
+		entry.pixelFormat = (std::uint32_t)pixelFormat;
+		entry.rowAlignment = mRowAlignment;
+		entry.levelCount = 1;
+
+		if (mMipmaps)
+		{
+			for (unsigned int size = std::max(props.width, props.height); size > 1; size /= 2)
+			{
+				entry.levelCount++;
+			}
+		}
+
+		entry.dataOffset = offset;
+		entry.dataSize = GetDataSize(entry);
+
+		// Level 0 is written straight from the decoded pixels, later ones from the scratch buffers
+		const unsigned char* levelData = props.pixels.data();
+		unsigned int width = props.width, height = props.height;
+
+		for (unsigned int i = 0; i < entry.levelCount; i++)
+		{
+			const size_t rowBytes = (size_t)width * bytesPerPixel;
+			const size_t levelSize = GetLevelSize(width, height, pixelFormat, mRowAlignment);
+
+			if (levelSize == rowBytes * height)
+			{
+				writer.write((const char*)levelData, levelSize);
+			}
+			else
+			{
+				// Pad each row out to the alignment
+				padded.assign(levelSize, 0);
+
+				for (unsigned int row = 0; row < height; row++)
+				{
+					memcpy(padded.data() + row * (levelSize / height), levelData + row * rowBytes, rowBytes);
+				}
+
+				writer.write((const char*)padded.data(), levelSize);
+			}
+
+			writer.write(zeros, AlignUp(levelSize, TEXTURE_BAKE_DATA_ALIGNMENT) - levelSize);
+
+			if (i + 1 < entry.levelCount)
+			{
+				nextLevel.resize((size_t)std::max(1u, width / 2) * std::max(1u, height / 2) * bytesPerPixel);
+
+				switch (PixelFormatInfo::GetBytesPerChannel(pixelFormat))
+				{
+					case 2:		Downsample<std::uint16_t>(levelData, width, height, PixelFormatInfo::GetChannelCount(pixelFormat), nextLevel.data());	break;
+					case 4:		Downsample<float>(levelData, width, height, PixelFormatInfo::GetChannelCount(pixelFormat), nextLevel.data());			break;
+					default:	Downsample<std::uint8_t>(levelData, width, height, PixelFormatInfo::GetChannelCount(pixelFormat), nextLevel.data());	break;
+				}
+
+				level.swap(nextLevel);
+				levelData = level.data();
+				width = std::max(1u, width / 2);
+				height = std::max(1u, height / 2);
+			}
+		}
+
+		offset += entry.dataSize;
+		baked[index] = true;
+	}
+
+	// Table of contents in the order the sources were added, then their paths
+	std::vector<TextureBakeEntry> toc;
+	std::string paths;
+
+	header.tocOffset = offset;
+	header.entryCount = (std::uint32_t)std::count(baked.begin(), baked.end(), true);
+
+	const std::uint64_t pathsOffset = offset + header.entryCount * sizeof(TextureBakeEntry);
+
+	for (size_t i = 0; i < mSources.size(); i++)
+	{
+		if (!baked[i])
+			continue;
+
+		std::string path = mSources[i].path;
+		std::replace(path.begin(), path.end(), '\\', '/');
+
+		entries[i].pathOffset = pathsOffset + paths.size();
+		entries[i].pathLength = (std::uint32_t)path.size();
+		paths += path;
+
+		toc.push_back(entries[i]);
+	}
+
+	writer.write((const char*)toc.data(), toc.size() * sizeof(TextureBakeEntry));
+	writer.write(paths.data(), paths.size());
+
+	header.fileSize = pathsOffset + paths.size();
+	writer.seekp(0);
+	writer.write((const char*)&header, sizeof(header));
+	writer.close();
+
+	if (!writer)
+	{
+		perror(("Could not write texture bake at: \"" + tempPath + "\"").c_str());
+		std::remove(tempPath.c_str());
+		return 0;
+	}
+
+	// Windows won't rename over an existing file
+	std::remove(_outputPath.c_str());
+
+	if (std::rename(tempPath.c_str(), _outputPath.c_str()) != 0)
+	{
+		perror(("Could not replace texture bake at: \"" + _outputPath + "\"").c_str());
+		return 0;
+	}
+
+	return header.entryCount;
+}
+
+size_t TextureBaker::GetLevelSize(unsigned int _width, unsigned int _height, PixelFormat _pixelFormat, unsigned int _rowAlignment)
+{
+	return (size_t)AlignUp((std::uint64_t)_width * PixelFormatInfo::GetBytesPerPixel(_pixelFormat), _rowAlignment) * _height;
+}
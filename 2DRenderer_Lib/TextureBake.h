@@ -0,0 +1,118 @@
+#pragma once
+#include "DLLCommon.h"
+#include "MappedFile.h"
+#include "PixelFormat.h"
+#include "ThreadPool.h"
+
+#pragma warning(disable : 4251)
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// .r2dtex, textures decoded ahead of time into the layout they're uploaded in. Little endian:
+//   TextureBakeHeader
+//   pixel data, each entry's mip levels largest first, every level TEXTURE_BAKE_DATA_ALIGNMENT aligned,
+//   rows padded to the entry's rowAlignment the way GL_UNPACK_ALIGNMENT expects
+//   TextureBakeEntry[entryCount], the table of contents
+//   source paths, as given to the baker with '/' separators
+static constexpr char TEXTURE_BAKE_MAGIC[8] = { 'R', '2', 'D', 'T', 'E', 'X', '\r', '\n' };
+static constexpr std::uint32_t TEXTURE_BAKE_VERSION = 2;
+static constexpr std::uint64_t TEXTURE_BAKE_DATA_ALIGNMENT = 64;
+
+struct RENDERER_API TextureBakeHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t entryCount;
+	std::uint64_t tocOffset;
+	std::uint64_t fileSize; // catches truncated files
+};
+
+struct RENDERER_API TextureBakeEntry
+{
+	// Source as it was when baked, the entry is stale once these no longer match
+	std::uint64_t contentHash;
+	std::int64_t sourceTime; // modification time, seconds
+	std::uint64_t sourceSize;
+
+	std::uint64_t dataOffset, dataSize;
+	std::uint64_t pathOffset; // the paths follow every level's pixels, well past 4 GB in large bakes
+	std::uint32_t pathLength;
+
+	std::uint32_t width, height;
+	std::uint32_t pixelFormat;
+	std::uint32_t levelCount;
+	std::uint32_t rowAlignment; // 1, 2, 4 or 8
+};
+
+struct RENDERER_API BakedTextureLevel
+{
+	unsigned int width, height;
+	size_t rowPitch; // bytes from one row to the next, padding included
+	const unsigned char* data;
+};
+
+// Maps a .r2dtex file and finds textures in it, handing out pointers straight into the mapping.
+class RENDERER_API TextureBakeFile
+{
+public:
+	TextureBakeFile();
+
+	TextureBakeFile(const TextureBakeFile&) = delete;
+	TextureBakeFile& operator=(const TextureBakeFile&) = delete;
+
+	// False if the file is missing, isn't a bake of this version or is truncated
+	bool Open(const char* _filePath);
+	void Close();
+
+	const bool IsOpen() const						{ return mFile.IsOpen(); }
+	const unsigned int GetEntryCount() const		{ return (unsigned int)mIndex.size(); }
+
+	// Entry baked from _sourcePath in _pixelFormat, null if there isn't one or the source changed since.
+	// A source with a new time or size is hashed, and its entry still used if the contents are the same.
+	const TextureBakeEntry* Find(const std::string& _sourcePath, PixelFormat _pixelFormat) const;
+
+	static BakedTextureLevel GetLevel(const TextureBakeEntry& _entry, const unsigned char* _fileData, unsigned int _level);
+	BakedTextureLevel GetLevel(const TextureBakeEntry& _entry, unsigned int _level) const	{ return GetLevel(_entry, mFile.GetData(), _level); }
+
+protected:
+	MappedFile mFile;
+
+	// Canonical source path and pixel format -> entry
+	std::unordered_map<std::string, const TextureBakeEntry*> mIndex;
+};
+
+// Decodes source images and writes them out as a .r2dtex file.
+class RENDERER_API TextureBaker
+{
+public:
+	TextureBaker();
+
+	void Add(const std::string& _sourcePath, PixelFormat _pixelFormat = RGBA8);
+	void Add(const std::vector<std::string>& _sourcePaths, PixelFormat _pixelFormat = RGBA8);
+
+	// Box filtered levels down to 1x1, off by default
+	void SetMipmaps(bool _mipmaps)					{ mMipmaps = _mipmaps; }
+
+	// Row padding, 1, 2, 4 or 8 bytes to match GL_UNPACK_ALIGNMENT. 4 by default, GL's own default
+	void SetRowAlignment(unsigned int _alignment);
+
+	// Decodes every source on _pool and writes the bake, returns how many made it in. Sources that fail to decode are
+	// left out. It's written to a temporary file renamed over _outputPath once complete, so a crash never leaves half a bake.
+	unsigned int Write(const std::string& _outputPath, ThreadPool& _pool = ThreadPool::GetShared());
+
+	static size_t GetLevelSize(unsigned int _width, unsigned int _height, PixelFormat _pixelFormat, unsigned int _rowAlignment);
+
+protected:
+	struct Source
+	{
+		std::string path;
+		PixelFormat pixelFormat;
+	};
+
+	std::vector<Source> mSources;
+
+	bool mMipmaps;
+	unsigned int mRowAlignment;
+};
@@ -0,0 +1,308 @@
+#include "TextureBatchLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Appends the supported image files in _directoryPath to _filePaths
+static void ListDirectory(const std::string& _directoryPath, bool _recursive, std::vector<std::string>& _filePaths)
+{
+	std::string prefix = _directoryPath;
+	if (!prefix.empty() && prefix.back() != '/' && prefix.back() != '\\')
+	{
+		prefix += '/';
+	}
+
+	std::vector<std::string> subDirectories;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((prefix + "*").c_str(), &entry);
+
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		std::string name = entry.cFileName;
+
+		if (name == "." || name == "..")
+			continue;
+
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			subDirectories.push_back(prefix + name);
+		}
+		else if (Texture2D::GetFileFormat(name) != UNSUPPORTED)
+		{
+			_filePaths.push_back(prefix + name);
+		}
+	} while (FindNextFileA(find, &entry));
+
+	FindClose(find);
+#else
+	DIR* directory = opendir(prefix.c_str());
+
+	if (directory == nullptr)
+		return;
+
+	while (dirent* entry = readdir(directory))
+	{
+		std::string name = entry->d_name;
+
+		if (name == "." || name == "..")
+			continue;
+
+		struct stat info;
+		if (stat((prefix + name).c_str(), &info) != 0)
+			continue;
+
+		if (S_ISDIR(info.st_mode))
+		{
+			subDirectories.push_back(prefix + name);
+		}
+		else if (Texture2D::GetFileFormat(name) != UNSUPPORTED)
+		{
+			_filePaths.push_back(prefix + name);
+		}
+	}
+
+	closedir(directory);
+#endif
+
+	if (_recursive)
+	{
+		std::sort(subDirectories.begin(), subDirectories.end());
+
+		for (const std::string& subDirectory : subDirectories)
+		{
+			ListDirectory(subDirectory, _recursive, _filePaths);
+		}
+	}
+}
+
+TextureBatchLoader::TextureBatchLoader(ThreadPool& _pool) : mTasks(_pool)
+{
+	mInFlight = 0;
+	mNextRequestID = 1;
+	mStats = TextureBatchStats();
+}
+
+TextureBatchLoader::~TextureBatchLoader()
+{
+	// Tasks use the decoders and queue, they have to finish first
+	mTasks.Wait();
+}
+
+unsigned int TextureBatchLoader::Load(const std::string& _filePath, PixelFormat _pixelFormat)
+{
+	unsigned int requestID;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		requestID = mNextRequestID++;
+
+		// Going from idle to busy, time spent idle between batches doesn't count towards throughput
+		if (mInFlight == 0)
+		{
+			mBusySince = std::chrono::steady_clock::now();
+		}
+
+		mInFlight++;
+		mStats.queued++;
+	}
+
+	mTasks.Run([this, requestID, _filePath, _pixelFormat]()
+	{
+		Decode(requestID, _filePath, _pixelFormat);
+	});
+
+	return requestID;
+}
+
+void TextureBatchLoader::Load(const std::vector<std::string>& _filePaths, PixelFormat _pixelFormat)
+{
+	for (const std::string& filePath : _filePaths)
+	{
+		Load(filePath, _pixelFormat);
+	}
+}
+
+unsigned int TextureBatchLoader::LoadDirectory(const std::string& _directoryPath, bool _recursive, PixelFormat _pixelFormat)
+{
+	std::vector<std::string> filePaths;
+	ListDirectory(_directoryPath, _recursive, filePaths);
+
+	// Directory listing order isn't defined, keep the load order stable between runs
+	std::sort(filePaths.begin(), filePaths.end());
+
+	Load(filePaths, _pixelFormat);
+
+	return (unsigned int)filePaths.size();
+}
+
+unsigned int TextureBatchLoader::LoadManifest(const std::string& _manifestPath, PixelFormat _pixelFormat)
+{
+	std::ifstream reader = std::ifstream(_manifestPath);
+
+	if (!reader.is_open())
+	{
+		perror(("Could not open texture manifest at: \"" + _manifestPath + "\"").c_str());
+		return 0;
+	}
+
+	size_t directoryEnd = _manifestPath.find_last_of("/\\");
+	std::string directory = (directoryEnd != _manifestPath.npos) ? _manifestPath.substr(0, directoryEnd + 1) : "";
+
+	std::vector<std::string> filePaths;
+	std::string line;
+
+	while (std::getline(reader, line))
+	{
+		// Tolerate CRLF manifests and blank lines
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+		{
+			line.pop_back();
+		}
+
+		if (line.empty())
+			continue;
+
+		bool absolute = (line[0] == '/' || line[0] == '\\' || (line.size() > 1 && line[1] == ':'));
+		filePaths.push_back(absolute ? line : directory + line);
+	}
+
+	Load(filePaths, _pixelFormat);
+
+	return (unsigned int)filePaths.size();
+}
+
+bool TextureBatchLoader::Poll(TextureLoadResult& _result)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mResults.empty())
+		return false;
+
+	_result = std::move(mResults.front());
+	mResults.pop_front();
+
+	return true;
+}
+
+bool TextureBatchLoader::WaitNext(TextureLoadResult& _result)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mResultReady.wait(lock, [this]() { return !mResults.empty() || mInFlight == 0; });
+
+	if (mResults.empty())
+		return false;
+
+	_result = std::move(mResults.front());
+	mResults.pop_front();
+
+	return true;
+}
+
+void TextureBatchLoader::Wait()
+{
+	mTasks.Wait();
+}
+
+TextureBatchStats TextureBatchLoader::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	TextureBatchStats stats = mStats;
+
+	// Still loading, count the current busy stretch up to now
+	if (mInFlight != 0)
+	{
+		stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - mBusySince).count();
+	}
+
+	return stats;
+}
+
+void TextureBatchLoader::Decode(unsigned int _requestID, const std::string& _filePath, PixelFormat _pixelFormat)
+{
+	PNGDecoder* decoder = AcquireDecoder();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Texture2D reports its own decode errors, a failed one is just left unloaded
+	TextureLoadResult result = TextureLoadResult();
+	result.requestID = _requestID;
+	result.filePath = _filePath;
+	result.texture.reset(new Texture2D(_filePath, *decoder, _pixelFormat));
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	ReleaseDecoder(decoder);
+
+	result.decodeSeconds = std::chrono::duration<double>(end - start).count();
+
+	bool failed = !result.texture->mLoaded;
+	if (failed)
+	{
+		result.texture.reset();
+	}
+	else result.decodedBytes = result.texture->mPNGProps.pixels.size();
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if (failed) mStats.failed++;
+		else		mStats.loaded++;
+
+		mStats.decodedBytes += result.decodedBytes;
+		mStats.decodeSeconds += result.decodeSeconds;
+
+		mResults.push_back(std::move(result));
+
+		if (--mInFlight == 0)
+		{
+			mStats.elapsedSeconds += std::chrono::duration<double>(end - mBusySince).count();
+		}
+	}
+
+	mResultReady.notify_all();
+}
+
+PNGDecoder* TextureBatchLoader::AcquireDecoder()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// At most one decoder per worker ever gets created, each is re-used for every file after that
+	if (mFreeDecoders.empty())
+	{
+		mDecoders.emplace_back(new PNGDecoder());
+
+		// Already running on a pool worker, rows are converted right here rather than queued behind other files
+		mDecoders.back()->SetPooledConversion(false);
+
+		return mDecoders.back().get();
+	}
+
+	PNGDecoder* decoder = mFreeDecoders.back();
+	mFreeDecoders.pop_back();
+
+	return decoder;
+}
+
+void TextureBatchLoader::ReleaseDecoder(PNGDecoder* _decoder)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mFreeDecoders.push_back(_decoder);
+}
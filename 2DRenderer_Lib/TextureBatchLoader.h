@@ -0,0 +1,97 @@
+#pragma once
+#include "DLLCommon.h"
+#include "Texture2D.h"
+#include "ThreadPool.h"
+
+#pragma warning(disable : 4251)
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One finished file, texture is null if it couldn't be decoded.
+struct RENDERER_API TextureLoadResult
+{
+	// Move only, exported types get every special member generated otherwise
+	TextureLoadResult() = default;
+	TextureLoadResult(TextureLoadResult&&) = default;
+	TextureLoadResult& operator=(TextureLoadResult&&) = default;
+	TextureLoadResult(const TextureLoadResult&) = delete;
+	TextureLoadResult& operator=(const TextureLoadResult&) = delete;
+
+	unsigned int requestID = 0; // as returned by Load
+	std::string filePath;
+	std::unique_ptr<Texture2D> texture;
+
+	double decodeSeconds = 0.0;
+	size_t decodedBytes = 0;
+};
+
+struct RENDERER_API TextureBatchStats
+{
+	unsigned int queued = 0, loaded = 0, failed = 0;
+	size_t decodedBytes = 0;
+
+	double decodeSeconds = 0.0;		// summed over every worker
+	double elapsedSeconds = 0.0;	// wall clock spent with at least one file queued or decoding
+
+	double GetFilesPerSecond() const		{ return (elapsedSeconds > 0.0) ? (loaded + failed) / elapsedSeconds : 0.0; }
+	double GetMegabytesPerSecond() const	{ return (elapsedSeconds > 0.0) ? decodedBytes / elapsedSeconds / 1e6 : 0.0; }
+};
+
+// Decodes batches of textures concurrently on a thread pool, one re-used PNGDecoder per worker.
+// Finished textures wait in a completion queue that the thread owning the GL context drains with Poll() to upload them.
+class RENDERER_API TextureBatchLoader
+{
+public:
+	TextureBatchLoader(ThreadPool& _pool = ThreadPool::GetShared());
+	~TextureBatchLoader();
+
+	TextureBatchLoader(const TextureBatchLoader&) = delete;
+	TextureBatchLoader& operator=(const TextureBatchLoader&) = delete;
+
+	// Returns an ID the result carries, to tell apart several requests for the same file
+	unsigned int Load(const std::string& _filePath, PixelFormat _pixelFormat = RGBA8);
+	void Load(const std::vector<std::string>& _filePaths, PixelFormat _pixelFormat = RGBA8);
+
+	// Queues every supported image in the directory (and its sub directories when _recursive), returns how many
+	unsigned int LoadDirectory(const std::string& _directoryPath, bool _recursive = true, PixelFormat _pixelFormat = RGBA8);
+
+	// Queues every path listed in a text file, one per line, relative to the manifest's directory. Returns how many
+	unsigned int LoadManifest(const std::string& _manifestPath, PixelFormat _pixelFormat = RGBA8);
+
+	// Takes the next finished texture off the queue, false if none is ready yet
+	bool Poll(TextureLoadResult& _result);
+
+	// Blocks until a texture is finished, false once every queued file has been handed out
+	bool WaitNext(TextureLoadResult& _result);
+
+	// Blocks until every queued file is decoded, results stay in the queue
+	void Wait();
+
+	TextureBatchStats GetStats() const;
+
+protected:
+	void Decode(unsigned int _requestID, const std::string& _filePath, PixelFormat _pixelFormat);
+
+	PNGDecoder* AcquireDecoder();
+	void ReleaseDecoder(PNGDecoder* _decoder);
+
+protected:
+	TaskGroup mTasks;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mResultReady;
+	std::deque<TextureLoadResult> mResults;
+	unsigned int mInFlight;
+	unsigned int mNextRequestID;
+
+	std::vector<std::unique_ptr<PNGDecoder>> mDecoders;
+	std::vector<PNGDecoder*> mFreeDecoders;
+
+	TextureBatchStats mStats;
+	std::chrono::steady_clock::time_point mBusySince;
+};
@@ -0,0 +1,218 @@
+#include "TextureCache.h"
+#include "ByteHelpers.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+TextureCache::TextureCache(TextureStreamer& _streamer) : mStreamer(_streamer)
+{
+	mCPUBudget = 0;
+	mGPUBudget = 0;
+	mContentHashing = false;
+}
+
+TextureCache::~TextureCache()
+{
+	for (const auto& entry : mEntries)
+	{
+		mStreamer.Release(entry.first);
+	}
+}
+
+TextureHandle TextureCache::Acquire(const std::string& _filePath, PixelFormat _pixelFormat)
+{
+	std::string key = CanonicalisePath(_filePath) + '|' + std::to_string((int)_pixelFormat);
+
+	auto path = mPaths.find(key);
+	if (path != mPaths.end())
+	{
+		mStats.hits++;
+		return AddReference(path->second);
+	}
+
+	unsigned long long contentHash = 0;
+
+	if (mContentHashing)
+	{
+		MappedFile file;
+
+		if (file.Open(_filePath.c_str()))
+		{
+			contentHash = R2D_BH::HashBytes(file.GetData(), file.GetSize(), (unsigned long long)_pixelFormat);
+
+			// Same file under another name, remember this path for it too
+			auto content = mContents.find(contentHash);
+			if (content != mContents.end())
+			{
+				mEntries[content->second].keys.push_back(key);
+				mPaths[key] = content->second;
+
+				mStats.hits++;
+				mStats.contentHits++;
+				return AddReference(content->second);
+			}
+		}
+	}
+
+	mStats.misses++;
+
+	TextureHandle handle = mStreamer.Request(_filePath, _pixelFormat);
+
+	Entry& entry = mEntries[handle];
+	entry.keys.push_back(key);
+	entry.contentHash = contentHash;
+	entry.refCount = 1;
+	entry.cpuBytes = 0;
+	entry.gpuBytes = 0;
+	entry.settled = false;
+
+	mPaths[key] = handle;
+	if (contentHash != 0)
+	{
+		mContents[contentHash] = handle;
+	}
+
+	mLoading.push_back(handle);
+	mStats.entries = (unsigned int)mEntries.size();
+
+	return handle;
+}
+
+void TextureCache::Release(TextureHandle _handle)
+{
+	auto entry = mEntries.find(_handle);
+	if (entry == mEntries.end() || entry->second.refCount == 0)
+		return;
+
+	if (--entry->second.refCount == 0)
+	{
+		entry->second.lruPosition = mUnreferenced.insert(mUnreferenced.end(), _handle);
+		Evict();
+	}
+}
+
+void TextureCache::Update()
+{
+	bool settled = false;
+
+	for (size_t i = 0; i < mLoading.size();)
+	{
+		TextureHandle handle = mLoading[i];
+
+		if (mStreamer.GetState(handle) == TextureStreamer::PENDING)
+		{
+			i++;
+			continue;
+		}
+
+		Entry& entry = mEntries[handle];
+		entry.settled = true;
+
+		std::shared_ptr<Texture2D> texture = mStreamer.GetTexture(handle);
+		entry.cpuBytes = texture ? texture->mPNGProps.pixels.size() : 0;
+		entry.gpuBytes = mStreamer.GetGPUBytes(handle);
+
+		mStats.cpuBytes += entry.cpuBytes;
+		mStats.gpuBytes += entry.gpuBytes;
+
+		mLoading[i] = mLoading.back();
+		mLoading.pop_back();
+		settled = true;
+	}
+
+	if (settled)
+	{
+		Evict();
+	}
+}
+
+void TextureCache::SetBudget(size_t _cpuBytes, size_t _gpuBytes)
+{
+	mCPUBudget = _cpuBytes;
+	mGPUBudget = _gpuBytes;
+
+	Evict();
+}
+
+std::string TextureCache::CanonicalisePath(const std::string& _filePath)
+{
+	std::string path = _filePath;
+
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (_fullpath(buffer, _filePath.c_str(), _MAX_PATH) != nullptr)
+	{
+		path = buffer;
+	}
+
+	std::transform(path.begin(), path.end(), path.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#else
+	// Also resolves symlinks, so links to the same file share an entry
+	if (char* resolved = realpath(_filePath.c_str(), nullptr))
+	{
+		path = resolved;
+		free(resolved);
+	}
+#endif
+
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	return path;
+}
+
+TextureHandle TextureCache::AddReference(TextureHandle _handle)
+{
+	Entry& entry = mEntries[_handle];
+
+	// Back in use, no longer a candidate for eviction
+	if (entry.refCount++ == 0)
+	{
+		mUnreferenced.erase(entry.lruPosition);
+	}
+
+	return _handle;
+}
+
+void TextureCache::Evict()
+{
+	while (!mUnreferenced.empty() &&
+		((mCPUBudget != 0 && mStats.cpuBytes > mCPUBudget) || (mGPUBudget != 0 && mStats.gpuBytes > mGPUBudget)))
+	{
+		Remove(mUnreferenced.front());
+		mStats.evictions++;
+	}
+}
+
+void TextureCache::Remove(TextureHandle _handle)
+{
+	auto entry = mEntries.find(_handle);
+
+	for (const std::string& key : entry->second.keys)
+	{
+		mPaths.erase(key);
+	}
+
+	if (entry->second.contentHash != 0)
+	{
+		mContents.erase(entry->second.contentHash);
+	}
+
+	if (entry->second.refCount == 0)
+	{
+		mUnreferenced.erase(entry->second.lruPosition);
+	}
+
+	if (entry->second.settled)
+	{
+		mStats.cpuBytes -= entry->second.cpuBytes;
+		mStats.gpuBytes -= entry->second.gpuBytes;
+	}
+	else mLoading.erase(std::find(mLoading.begin(), mLoading.end(), _handle));
+
+	mStreamer.Release(_handle);
+
+	mEntries.erase(entry);
+	mStats.entries = (unsigned int)mEntries.size();
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "DLLCommon.h"
+#include "TextureStreamer.h"
+
+#pragma warning(disable : 4251)
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct RENDERER_API TextureCacheStats
+{
+	unsigned int hits = 0, misses = 0, evictions = 0;
+	unsigned int contentHits = 0;	// hits matched by content under a different path, also counted in hits
+	unsigned int entries = 0;		// referenced or not
+
+	size_t cpuBytes = 0;	// decoded copies held, only when the streamer retains pixels
+	size_t gpuBytes = 0;
+};
+
+// Shares one decoded copy and one GL texture between every request for the same image. Entries are keyed on the
+// canonical path and pixel format, and optionally on a hash of the file's contents so copies under other names share too.
+// Acquire / Release are refcounted, unreferenced entries stay cached until a byte budget is exceeded and are then
+// evicted least recently used first.
+class RENDERER_API TextureCache
+{
+public:
+	TextureCache(TextureStreamer& _streamer);
+	~TextureCache();
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Handles are the streamer's, resolve them with its GetGLTexture(). Every Acquire needs a matching Release
+	TextureHandle Acquire(const std::string& _filePath, PixelFormat _pixelFormat = RGBA8);
+	void Release(TextureHandle _handle);
+
+	// Accounts for textures that finished loading and evicts while over budget, call once per frame after the streamer's Update()
+	void Update();
+
+	// 0 means no limit. Referenced entries are never evicted, so the budget can be exceeded while they're in use
+	void SetBudget(size_t _cpuBytes, size_t _gpuBytes);
+
+	// Also matches files by a hash of their contents, at the cost of reading every missed file on the calling thread
+	void SetContentHashing(bool _enabled)		{ mContentHashing = _enabled; }
+
+	const TextureCacheStats& GetStats() const	{ return mStats; }
+
+	// Absolute path with '/' separators, case folded on Windows. Only the separators change if the file doesn't exist
+	static std::string CanonicalisePath(const std::string& _filePath);
+
+protected:
+	struct Entry
+	{
+		std::vector<std::string> keys;	// every path it was requested under
+		unsigned long long contentHash;	// 0 if not hashed
+		unsigned int refCount;
+
+		size_t cpuBytes, gpuBytes;
+		bool settled;					// finished loading and its bytes are counted
+
+		std::list<TextureHandle>::iterator lruPosition; // only valid while unreferenced
+	};
+
+	TextureHandle AddReference(TextureHandle _handle);
+	void Evict();
+	void Remove(TextureHandle _handle);
+
+protected:
+	TextureStreamer& mStreamer;
+
+	std::unordered_map<TextureHandle, Entry> mEntries;
+	std::unordered_map<std::string, TextureHandle> mPaths;				// canonical path and format -> entry
+	std::unordered_map<unsigned long long, TextureHandle> mContents;	// content hash -> entry
+	std::list<TextureHandle> mUnreferenced;								// least recently released at the front
+	std::vector<TextureHandle> mLoading;								// not settled yet
+
+	size_t mCPUBudget, mGPUBudget;
+	bool mContentHashing;
+
+	TextureCacheStats mStats;
+};
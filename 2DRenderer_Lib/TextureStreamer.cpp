@@ -0,0 +1,314 @@
+#include "TextureStreamer.h"
+
+#define GLEW_STATIC
+#include <glew.h>
+
+#include <algorithm>
+#include <chrono>
+
+// Band size used when only the time budget limits uploads, small enough to check the clock often
+static constexpr size_t UPLOAD_BAND_BYTES = 1u << 18;
+
+// OpenGL internal format, format and type matching each decoded pixel layout
+static void GetGLFormat(PixelFormat _format, GLint& _internalFormat, GLenum& _glFormat, GLenum& _glType)
+{
+	switch (_format)
+	{
+		case R8:		_internalFormat = GL_R8;		_glFormat = GL_RED;		_glType = GL_UNSIGNED_BYTE;		break;
+		case RG8:		_internalFormat = GL_RG8;		_glFormat = GL_RG;		_glType = GL_UNSIGNED_BYTE;		break;
+		case RGBA16:	_internalFormat = GL_RGBA16;	_glFormat = GL_RGBA;	_glType = GL_UNSIGNED_SHORT;	break;
+		case RGBA32F:	_internalFormat = GL_RGBA32F;	_glFormat = GL_RGBA;	_glType = GL_FLOAT;				break;
+		case BGRA8:		_internalFormat = GL_RGBA8;		_glFormat = GL_BGRA;	_glType = GL_UNSIGNED_BYTE;		break;
+		default:		_internalFormat = GL_RGBA8;		_glFormat = GL_RGBA;	_glType = GL_UNSIGNED_BYTE;		break;
+	}
+}
+
+static GLuint CreateTexture(GLsizei _width, GLsizei _height, const unsigned char* _rgba)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE, _rgba);
+
+	return texture;
+}
+
+TextureStreamer::TextureStreamer(ThreadPool& _pool) : mLoader(_pool)
+{
+	mPendingCount = 0;
+
+	mBytesPerFrame = 4u << 20;
+	mMicrosecondsPerFrame = 2000;
+	mLastFrameUploadBytes = 0;
+
+	mRetainPixels = false;
+	mBakedTextures = nullptr;
+
+	// Pending textures are transparent so they pop in rather than flash, failed ones are a magenta checker
+	const unsigned char transparent[4] = { 0, 0, 0, 0 };
+	const unsigned char checker[16] = { 255, 0, 255, 255,	0, 0, 0, 255,	0, 0, 0, 255,	255, 0, 255, 255 };
+
+	mPlaceholderTexture = CreateTexture(1, 1, transparent);
+	mErrorTexture = CreateTexture(2, 2, checker);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	// Decodes still in flight hold no GL objects, only uploaded ones need freeing
+	for (const Entry& entry : mEntries)
+	{
+		if (entry.glTexture != 0)
+		{
+			glDeleteTextures(1, &entry.glTexture);
+		}
+	}
+
+	glDeleteTextures(1, &mPlaceholderTexture);
+	glDeleteTextures(1, &mErrorTexture);
+}
+
+TextureHandle TextureStreamer::Request(const std::string& _filePath, PixelFormat _pixelFormat)
+{
+	mEntries.push_back({ 0, PENDING, 0, nullptr });
+	TextureHandle handle = (TextureHandle)mEntries.size();
+
+	mPendingCount++;
+
+	const TextureBakeEntry* bakeEntry = (mBakedTextures != nullptr) ? mBakedTextures->Find(_filePath, _pixelFormat) : nullptr;
+
+	// Already in its upload layout, skips the loader altogether
+	if (bakeEntry != nullptr)
+	{
+		mUploads.push_back({ handle, nullptr, mBakedTextures, bakeEntry, 0, 0, 0 });
+	}
+	else mRequests[mLoader.Load(_filePath, _pixelFormat)] = handle;
+
+	return handle;
+}
+
+void TextureStreamer::Release(TextureHandle _handle)
+{
+	if (_handle == 0 || _handle > mEntries.size() || mEntries[_handle - 1].state == RELEASED)
+		return;
+
+	Entry& entry = mEntries[_handle - 1];
+
+	// Drop the rest of its upload. If it's still decoding the result is thrown away once it arrives
+	if (entry.state == PENDING)
+	{
+		auto upload = std::find_if(mUploads.begin(), mUploads.end(), [_handle](const PendingUpload& _upload) { return _upload.handle == _handle; });
+		if (upload != mUploads.end())
+		{
+			mUploads.erase(upload);
+		}
+
+		mPendingCount--;
+	}
+
+	if (entry.glTexture != 0)
+	{
+		glDeleteTextures(1, &entry.glTexture);
+	}
+
+	entry = { 0, RELEASED, 0, nullptr };
+}
+
+void TextureStreamer::Update()
+{
+	TakeLoadedTextures();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t uploadedBytes = 0;
+
+	while (!mUploads.empty())
+	{
+		size_t remainingBytes = (mBytesPerFrame == 0) ? UPLOAD_BAND_BYTES : std::min(mBytesPerFrame - uploadedBytes, UPLOAD_BAND_BYTES);
+
+		PendingUpload& upload = mUploads.front();
+		uploadedBytes += UploadRows(upload, remainingBytes);
+
+		// Every row of every level is up, swap the placeholder out and free the CPU copy
+		if (upload.level == GetUploadLevelCount(upload))
+		{
+			Entry& entry = mEntries[upload.handle - 1];
+			entry.state = RESIDENT;
+			entry.gpuBytes = upload.uploadedBytes;
+
+			if (upload.texture)
+			{
+				upload.texture->OnUploaded();
+
+				if (mRetainPixels)
+				{
+					entry.texture = std::move(upload.texture);
+				}
+			}
+
+			mUploads.pop_front();
+			mPendingCount--;
+		}
+
+		if (mBytesPerFrame != 0 && uploadedBytes >= mBytesPerFrame)
+			break;
+
+		long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		if (mMicrosecondsPerFrame != 0 && elapsed >= mMicrosecondsPerFrame)
+			break;
+	}
+
+	mLastFrameUploadBytes = uploadedBytes;
+}
+
+void TextureStreamer::SetUploadBudget(size_t _bytesPerFrame, unsigned int _microsecondsPerFrame)
+{
+	mBytesPerFrame = _bytesPerFrame;
+	mMicrosecondsPerFrame = _microsecondsPerFrame;
+}
+
+unsigned int TextureStreamer::GetGLTexture(TextureHandle _handle) const
+{
+	switch (GetState(_handle))
+	{
+		case RESIDENT:	return mEntries[_handle - 1].glTexture;
+		case PENDING:	return mPlaceholderTexture;
+		default:		return mErrorTexture;
+	}
+}
+
+TextureStreamer::TextureState TextureStreamer::GetState(TextureHandle _handle) const
+{
+	if (_handle == 0 || _handle > mEntries.size())
+		return FAILED;
+
+	return mEntries[_handle - 1].state;
+}
+
+std::shared_ptr<Texture2D> TextureStreamer::GetTexture(TextureHandle _handle) const
+{
+	if (GetState(_handle) != RESIDENT)
+		return nullptr;
+
+	return mEntries[_handle - 1].texture;
+}
+
+size_t TextureStreamer::GetGPUBytes(TextureHandle _handle) const
+{
+	if (GetState(_handle) != RESIDENT)
+		return 0;
+
+	return mEntries[_handle - 1].gpuBytes;
+}
+
+void TextureStreamer::TakeLoadedTextures()
+{
+	TextureLoadResult result;
+
+	while (mLoader.Poll(result))
+	{
+		auto request = mRequests.find(result.requestID);
+		TextureHandle handle = request->second;
+		mRequests.erase(request);
+
+		// Released while it was decoding
+		if (mEntries[handle - 1].state == RELEASED)
+			continue;
+
+		if (!result.texture || result.texture->mPNGProps.height == 0)
+		{
+			mEntries[handle - 1].state = FAILED;
+			mPendingCount--;
+			continue;
+		}
+
+		mUploads.push_back({ handle, std::move(result.texture), nullptr, nullptr, 0, 0, 0 });
+	}
+}
+
+size_t TextureStreamer::UploadRows(PendingUpload& _upload, size_t _maxBytes)
+{
+	Entry& entry = mEntries[_upload.handle - 1];
+
+	const PixelFormat pixelFormat = _upload.bakeEntry ? (PixelFormat)_upload.bakeEntry->pixelFormat : _upload.texture->mPNGProps.pixelFormat;
+	const unsigned int levelCount = GetUploadLevelCount(_upload);
+
+	GLint internalFormat;
+	GLenum format, type;
+	GetGLFormat(pixelFormat, internalFormat, format, type);
+
+	// First band, allocate every level at full size, rows are filled in over as many frames as it takes
+	if (entry.glTexture == 0)
+	{
+		glGenTextures(1, &entry.glTexture);
+		glBindTexture(GL_TEXTURE_2D, entry.glTexture);
+
+		for (unsigned int level = 0; level < levelCount; level++)
+		{
+			BakedTextureLevel info = GetUploadLevel(_upload, level);
+			glTexImage2D(GL_TEXTURE_2D, level, internalFormat, info.width, info.height, 0, format, type, nullptr);
+		}
+
+		// Sample gray formats as gray, with RG8 carrying alpha in its second channel
+		if (pixelFormat == R8 || pixelFormat == RG8)
+		{
+			GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, (pixelFormat == RG8) ? GL_GREEN : GL_ONE };
+			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (levelCount > 1) ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	else glBindTexture(GL_TEXTURE_2D, entry.glTexture);
+
+	const BakedTextureLevel level = GetUploadLevel(_upload, _upload.level);
+
+	const size_t rowBytes = (size_t)level.width * PixelFormatInfo::GetBytesPerPixel(pixelFormat);
+	unsigned int rows = (unsigned int)std::min<size_t>(level.height - _upload.rowsUploaded, std::max<size_t>(1, _maxBytes / rowBytes));
+
+	// Decoded rows are tightly packed and baked ones padded to their alignment, GL_UNPACK_ALIGNMENT gives GL the same row pitch
+	glPixelStorei(GL_UNPACK_ALIGNMENT, _upload.bakeEntry ? _upload.bakeEntry->rowAlignment : 1);
+	glTexSubImage2D(GL_TEXTURE_2D, _upload.level, 0, _upload.rowsUploaded, level.width, rows, format, type,
+		level.data + _upload.rowsUploaded * level.rowPitch);
+
+	_upload.rowsUploaded += rows;
+	_upload.uploadedBytes += rows * rowBytes;
+
+	if (_upload.rowsUploaded == level.height)
+	{
+		_upload.level++;
+		_upload.rowsUploaded = 0;
+	}
+
+	return rows * rowBytes;
+}
+
+BakedTextureLevel TextureStreamer::GetUploadLevel(const PendingUpload& _upload, unsigned int _level) const
+{
+	if (_upload.bakeEntry != nullptr)
+		return _upload.bakeFile->GetLevel(*_upload.bakeEntry, _level);
+
+	const PNGProperties& props = _upload.texture->mPNGProps;
+
+	BakedTextureLevel level;
+	level.width = props.width;
+	level.height = props.height;
+	level.rowPitch = (size_t)props.width * PixelFormatInfo::GetBytesPerPixel(props.pixelFormat);
+	level.data = props.pixels.data();
+
+	return level;
+}
+
+unsigned int TextureStreamer::GetUploadLevelCount(const PendingUpload& _upload) const
+{
+	return (_upload.bakeEntry != nullptr) ? _upload.bakeEntry->levelCount : 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include "DLLCommon.h"
+#include "TextureBake.h"
+#include "TextureBatchLoader.h"
+
+#pragma warning(disable : 4251)
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Stable reference to a streamed texture, 0 is never a valid handle
+typedef unsigned int TextureHandle;
+
+// Requests return a handle straight away while the file decodes in the background. Until it's uploaded the handle
+// resolves to a shared placeholder, then to the real texture. Uploads happen in Update() on the thread owning the GL
+// context, spread over as many frames as the per-frame budget needs, in bands of rows so large images don't hitch.
+class RENDERER_API TextureStreamer
+{
+public:
+	enum TextureState
+	{
+		PENDING,	// decoding or uploading, the placeholder is used meanwhile
+		RESIDENT,
+		FAILED,		// couldn't be decoded, resolves to an error texture
+		RELEASED	// given back with Release(), also resolves to the error texture
+	};
+
+	// GL objects are created here, so this has to be constructed on the thread owning the GL context
+	TextureStreamer(ThreadPool& _pool = ThreadPool::GetShared());
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	TextureHandle Request(const std::string& _filePath, PixelFormat _pixelFormat = RGBA8);
+
+	// Frees the GL texture and any retained pixels, cancelling the load if it hasn't finished. The handle stays released.
+	void Release(TextureHandle _handle);
+
+	// Uploads decoded textures until either budget runs out, call once per frame. 0 means no limit,
+	// at least one band of rows is always uploaded so streaming can't stall on a budget smaller than a row.
+	void Update();
+	void SetUploadBudget(size_t _bytesPerFrame, unsigned int _microsecondsPerFrame);
+
+	// Requests found in _bakedTextures, and not stale, upload straight from its mapping with nothing decoded.
+	// It has to stay open while anything baked is still uploading, null stops using it
+	void SetBakedTextures(const TextureBakeFile* _bakedTextures)	{ mBakedTextures = _bakedTextures; }
+
+	// Keeps the decoded texture once uploaded so it can be shared through GetTexture(), off by default.
+	// Its pixels follow the texture's residency, under RELEASE_AFTER_UPLOAD only the metadata is kept
+	void SetRetainPixels(bool _retain)		{ mRetainPixels = _retain; }
+
+	// GL texture name to bind for _handle this frame
+	unsigned int GetGLTexture(TextureHandle _handle) const;
+	TextureState GetState(TextureHandle _handle) const;
+
+	// Decoded texture, only once resident and while pixels are retained. Always null for baked textures
+	std::shared_ptr<Texture2D> GetTexture(TextureHandle _handle) const;
+
+	// Video memory used by _handle's texture, 0 until it's resident
+	size_t GetGPUBytes(TextureHandle _handle) const;
+
+	unsigned int GetPendingCount() const		{ return mPendingCount; }
+	size_t GetLastFrameUploadBytes() const		{ return mLastFrameUploadBytes; }
+
+protected:
+	struct Entry
+	{
+		unsigned int glTexture;		// real texture, only bound once every row is uploaded
+		TextureState state;
+		size_t gpuBytes;
+		std::shared_ptr<Texture2D> texture;
+	};
+
+	struct PendingUpload
+	{
+		TextureHandle handle;
+
+		// Either a decoded texture, or an entry in a bake file
+		std::unique_ptr<Texture2D> texture;
+		const TextureBakeFile* bakeFile;
+		const TextureBakeEntry* bakeEntry;
+
+		unsigned int level, rowsUploaded;
+		size_t uploadedBytes;
+	};
+
+	void TakeLoadedTextures();
+	size_t UploadRows(PendingUpload& _upload, size_t _maxBytes);
+
+	// Decoded textures only have level 0, tightly packed
+	BakedTextureLevel GetUploadLevel(const PendingUpload& _upload, unsigned int _level) const;
+	unsigned int GetUploadLevelCount(const PendingUpload& _upload) const;
+
+protected:
+	TextureBatchLoader mLoader;
+
+	std::vector<Entry> mEntries; // indexed by handle - 1
+	std::unordered_map<unsigned int, TextureHandle> mRequests; // loader request ID -> handle
+	std::deque<PendingUpload> mUploads;
+	unsigned int mPendingCount;
+
+	unsigned int mPlaceholderTexture, mErrorTexture;
+
+	size_t mBytesPerFrame;
+	unsigned int mMicrosecondsPerFrame;
+	size_t mLastFrameUploadBytes;
+
+	bool mRetainPixels;
+
+	const TextureBakeFile* mBakedTextures;
+};
@@ -0,0 +1,101 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int _threadCount)
+{
+	mStopping = false;
+
+	for (unsigned int i = 0; i < _threadCount; i++)
+	{
+		mThreads.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+
+	mTaskAvailable.notify_all();
+
+	for (std::thread& thread : mThreads)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::Submit(std::function<void()> _task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(std::move(_task));
+	}
+
+	mTaskAvailable.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mTaskAvailable.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+
+			// Drain the queue before stopping so no submitted task is dropped
+			if (mTasks.empty())
+				return;
+
+			task = std::move(mTasks.front());
+			mTasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+TaskGroup::TaskGroup(ThreadPool& _pool) : mPool(_pool)
+{
+	mPendingTasks = 0;
+}
+
+TaskGroup::~TaskGroup()
+{
+	Wait();
+}
+
+void TaskGroup::Run(std::function<void()> _task)
+{
+	if (mPool.GetThreadCount() == 0)
+	{
+		_task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPendingTasks++;
+	}
+
+	mPool.Submit([this, task = std::move(_task)]()
+	{
+		task();
+
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		// Notify while locked, a waiter may destroy the group as soon as it sees zero
+		if (--mPendingTasks == 0)
+		{
+			mTasksDone.notify_all();
+		}
+	});
+}
+
+void TaskGroup::Wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mTasksDone.wait(lock, [this]() { return mPendingTasks == 0; });
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "DLLCommon.h"
+
+#pragma warning(disable : 4251)
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks off a shared queue, in the order they were submitted.
+class RENDERER_API ThreadPool
+{
+public:
+	ThreadPool(unsigned int _threadCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Pool shared by the loaders, one worker per core besides the calling thread.
+	// Never destroyed, joining workers from static destructors at process exit isn't safe in a DLL.
+	static ThreadPool& GetShared()
+	{
+		static ThreadPool* instance = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+		return *instance;
+	}
+
+	void Submit(std::function<void()> _task);
+
+	const unsigned int GetThreadCount() const		{ return (unsigned int)mThreads.size(); }
+
+protected:
+	void WorkerLoop();
+
+protected:
+	std::vector<std::thread> mThreads;
+	std::deque<std::function<void()>> mTasks;
+
+	std::mutex mMutex;
+	std::condition_variable mTaskAvailable;
+	bool mStopping;
+};
+
+// Tracks a batch of tasks on a pool so the caller can wait for just those, waits on destruction.
+// Tasks run inline on the calling thread if the pool has no workers.
+class RENDERER_API TaskGroup
+{
+public:
+	TaskGroup(ThreadPool& _pool = ThreadPool::GetShared());
+	~TaskGroup();
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void Run(std::function<void()> _task);
+	void Wait();
+
+protected:
+	ThreadPool& mPool;
+
+	std::mutex mMutex;
+	std::condition_variable mTasksDone;
+	unsigned int mPendingTasks;
+};